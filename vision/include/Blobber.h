@@ -2,7 +2,11 @@
 #define XIMEA_TEST_BLOBBER_H
 
 #include <ImageProcessor.h>
-#include "OpenCLCompute.h"
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "ComputeBackend.h"
 
 #define MAX_WIDTH 1280
 #define MAX_HEIGHT 1024
@@ -26,22 +30,17 @@
 
 class Blobber {
 public:
-	Blobber();
+	explicit Blobber(ComputeBackend* computeBackend);
 	~Blobber();
 
 	static const int COLORS_LOOKUP_SIZE;
+	// largest compact lookup, 6 bits per channel
+	static const int COMPACT_LOOKUP_SIZE = 1 << 18;
+	// blue, magenta, orange, black and white, see isProjectedColor
+	static const int PROJECTED_COLOR_COUNT = 5;
 
-	typedef struct {
-		short x, y, width;
-		unsigned char color;
-		int parent, next;
-	} BlobberRun;
-
-    typedef struct {
-        unsigned int index;
-        unsigned char prevColor;
-        unsigned char newColor;
-    } LookupPixelChange;
+	typedef ComputeBackend::Run BlobberRun;
+	typedef ComputeBackend::Region DeviceRegion;
 
 	enum BlobColor {
 		unknown,
@@ -57,6 +56,7 @@ public:
 		int color;
 		int x1, y1, x2, y2;
 		float cen_x, cen_y;
+		int sum_x, sum_y;
 		int area;
 		int run_start;
 		int iterator_id;
@@ -90,8 +90,8 @@ public:
 	} BlobInfo;
 
     typedef struct Offset3 {
-        Offset3() : x(0), y(0), z(0) {}
-        Offset3(int x, int y, int z) : x(x), y(y), z(z) {}
+        constexpr Offset3() : x(0), y(0), z(0) {}
+        constexpr Offset3(int x, int y, int z) : x(x), y(y), z(z) {}
 
         int x, y, z;
     } Offset3;
@@ -100,23 +100,68 @@ public:
         Offset3 a, b;
     } Offset3Pair;
 
+	// Lookup changes are recorded as they are made, createHistoryEntry makes the changes since the previous entry one
+	// step of undo and redo. Undo and redo take time in proportion to the changes.
 	void undo();
+	void redo();
 	void createHistoryEntry();
 	void setColorMinArea(int color, int min_area);
 	void setColors(unsigned char *data);
+	// Bits per channel of the lookup used for segmentation. 8 uses the colors lookup directly, 6 and 5 use a 256 KB or
+	// 32 KB lookup made from it that stays in cache, entries it changes are reported. Returns false for other values.
+	bool setLookupBits(int bits);
+	int getLookupBits() { return lookupBits; }
+	// Classifies each 2x2 Bayer quad once, segmented image is then half the frame size.
+	// Blobs and getColorAt still use full frame coordinates.
+	void setHalfResolution(bool enabled);
+	bool isHalfResolution() { return segmentedScale > 1; }
+	// Full frame pixels per segmented pixel in each direction
+	int getSegmentedScale() { return segmentedScale; }
+	// Run length encoding is done by the compute backend if it supports it
+	void setDeviceRunEncoding(bool enabled) { deviceRunEncoding = enabled; }
+	// Connecting runs into regions is done by the compute backend, regions are the same as segConnectComponents and
+	// segExtractRegions give but the runs are not linked to them
+	void setDeviceRegionLabelling(bool enabled) { deviceRegionLabelling = enabled; }
     void setPixelColor(unsigned char r, unsigned char g, unsigned char b, unsigned char color);
-    void fillAdjacentColorPixels(unsigned char r, unsigned char g, unsigned char b, unsigned char color);
+	// Closes gaps in the color in one pass over the lookup blocks, a block that has no other colors is given the color
+	// when both blocks on any line through it are fully of it. Meant to be called once a brush stroke ends.
+	void fillColorGaps(unsigned char color);
     unsigned char getLookupColor(int r, int g, int b);
 	void setPixelColorRange(ImageProcessor::RGBRange rgbRange, unsigned char color);
+	// Colors the lookup blocks whose center is closest to the centroid, centroids are in BGR order. The nearest
+	// centroid of each block is cached until the centroids change, so repeating it while the mouse is held is cheap.
 	void setPixelClusterRange(unsigned char *centroids, int centroidIndex, int centroidCount, unsigned char color);
 	void setActivePixels(unsigned char *data);
 	void segEncodeRuns();
+	// Rows of the run encoding that are encoded together, stripes are encoded in parallel
+	static const int RUN_STRIPE_HEIGHT = 32;
+	// segEncodeRuns of a segmented image and its tile classes, returns the run count. Does not change segmented,
+	// stripes keeps the runs of each stripe between calls.
+	static int encodeRuns(
+			const unsigned char* segmented,
+			int width,
+			int height,
+			const unsigned int* tileClasses,
+			unsigned int trackedColors,
+			BlobberRun* runsOut,
+			int maxRuns,
+			std::vector<std::vector<BlobberRun>>& stripes
+	);
+	unsigned int getTrackedColors();
 	void segConnectComponents();
 
 	void segExtractRegions();
 	void segSeparateRegions();
 	BlobberRegion* segSortRegions(BlobberRegion *list, int passes);
 	void analyse(unsigned char *frame);
+	// With depth 2 or more segmentation of the next frame overlaps processing of the previous one
+	void setPipelineDepth(int depth);
+	// Number of buffers the camera cycles through, with one the frame is not valid after analyse returns
+	void setFrameBufferCount(int count) { frameBufferCount = count; }
+	// Lets the compute backend tune itself on a camera frame and the current colors lookup
+	void tuneComputeBackend(unsigned char* frame, bool retune) {
+		computeBackend->tune(frame, colors_lookup, width, height, COLORS_LOOKUP_SIZE, retune);
+	}
 	BlobInfo* getBlobs(BlobColor color);
 
 	void getSegmentedRgb(unsigned char* out);
@@ -124,35 +169,173 @@ public:
 
 	bool saveColors(const std::string& filename);
     bool loadColors(const std::string& filename);
+	// Loads a colors lookup file, or the data of one, into a standby buffer in the background. It replaces the lookup
+	// between frames once loaded, lookup changes made meanwhile are lost but can be undone with the swap.
+	// Returns false if the previous lookup is still being loaded.
+	bool loadStandbyColors(const std::string& filename);
+	bool loadStandbyColors(std::vector<unsigned char> data);
 
     int getColorCount();
     ColorClassState* getColor(BlobColor colorIndex);
     ColorClassState* getColor(const std::string& name);
     BlobColor getColorAt(int x, int y);
+	// Classes in the tile containing full frame point x, y as a bit mask (bit 1 << color), 0 outside the frame
+	unsigned int getTileClasses(int x, int y);
+	// Side of the class tiles in full frame pixels
+	int getTileSize() { return ComputeBackend::TILE_SIZE * segmentedScale; }
+	static bool isSingleClass(unsigned int tileClasses) { return tileClasses != 0 && (tileClasses & (tileClasses - 1)) == 0; }
+	// Pixels of blue, magenta, orange, black and white are counted per row and column of the segmented image,
+	// counts are in segmented pixels and -1 for other colors
+	static bool isProjectedColor(BlobColor color) { return color >= blue && color <= white; }
+	int getRowColorCount(BlobColor color, int y);
+	int getColumnColorCount(BlobColor color, int x);
+	// Pixels of the color in rows or columns between full frame coordinates from and to, inclusive
+	int getRowsColorCount(BlobColor color, int y1, int y2);
+	int getColumnsColorCount(BlobColor color, int x1, int x2);
 
 	void clearColors();
 	void clearColor(unsigned char colorIndex);
 	void clearColor(std::string colorName);
 
-	unsigned char *bgr;//BGR buffer
+	unsigned char *bgr;//BGR buffer, only updated while there are consumers
+
+	// GUI, recorder etc that read bgr after analyse, without any only the segmented image is produced
+	void addBgrConsumer();
+	void removeBgrConsumer();
+	bool hasBgrConsumers() { return bgrConsumerCount > 0; }
+
+	// scales 2, 4 and 8
+	static const int PREVIEW_SCALE_COUNT = 3;
+
+	// Downscaled frame and class map for consumers that do not need the full frame, previews of a scale are made by
+	// the compute backend along with the segmentation while the scale has consumers. Returns false for other scales.
+	bool addPreviewConsumer(int scale);
+	void removePreviewConsumer(int scale);
+	// BGR of the analysed frame, width / scale x height / scale, nullptr without consumers of the scale
+	unsigned char* getBgrPreview(int scale);
+	// Classes of the preview pixels, same size as the BGR preview
+	unsigned char* getClassPreview(int scale);
+	// Class preview in the class colors like getSegmentedRgb, returns false without consumers of the scale
+	bool getClassPreviewRgb(int scale, unsigned char* out);
+	int getPreviewWidth(int scale) { return width / scale; }
+	int getPreviewHeight(int scale) { return height / scale; }
+
+	ComputeBackend* getComputeBackend() { return computeBackend; }
 
 private:
 	//unsigned char colors_lookup[0x1000000];//all possible bgr combinations lookup table/
 	unsigned char* colors_lookup;//all possible bgr combinations lookup table/
-    unsigned char* prev_colors_lookup;
-    std::vector<std::vector<LookupPixelChange>> lookupChangeHistory;
+	// colors_lookup reduced to lookupBits, remade before the next segmentation after colors_lookup changes
+	unsigned char* compactLookup;
+	int lookupBits;
+	bool compactLookupStale;
+	void updateCompactLookup(bool report);
+
+	// lookup edits are journaled in blocks of 4x4x4 entries like setPixelColor writes
+	static const int LOOKUP_BLOCK_SIZE = 64;
+	static const unsigned int LOOKUP_BLOCK_COUNT = 1 << 18;
+	static const unsigned int UNIFORM_BEFORE = 1u << 30;
+	static const unsigned int UNIFORM_AFTER = 1u << 31;
+	// undo and redo entries are dropped oldest first to stay below this
+	static const size_t HISTORY_MEMORY_BUDGET = 8 * 1024 * 1024;
+
+	typedef struct {
+		// changed blocks with the UNIFORM_BEFORE and UNIFORM_AFTER flags
+		std::vector<unsigned int> blocks;
+		// colors of each block before and after the edit, one for a uniform block and LOOKUP_BLOCK_SIZE otherwise
+		std::vector<unsigned char> colors;
+	} LookupEdit;
+
+	std::deque<LookupEdit> lookupHistory;
+	std::vector<LookupEdit> lookupRedoHistory;
+	size_t historyMemory;
+	// blocks written since the last history entry and their colors before that, LOOKUP_BLOCK_SIZE per block
+	std::vector<unsigned int> pendingBlocks;
+	std::vector<unsigned char> pendingColors;
+	std::vector<bool> pendingBlockMarks;
+
+	static unsigned int getLookupBlock(unsigned int r, unsigned int g, unsigned int b) {
+		return (b >> 2) + ((g >> 2) << 6) + ((r >> 2) << 12);
+	}
+	static size_t getEditMemory(const LookupEdit& edit) {
+		return edit.blocks.size() * sizeof(unsigned int) + edit.colors.size();
+	}
+	static void readBlock(const unsigned char* lookup, unsigned int block, unsigned char* colorsOut);
+	static void writeBlock(unsigned char* lookup, unsigned int block, const unsigned char* colors);
+	void journalBlock(unsigned int block);
+	void applyEdit(const LookupEdit& edit, bool undo);
+	void clearHistory();
 	unsigned char pixel_active[MAX_WIDTH * MAX_HEIGHT]{};//0=ignore in segmentation, 1=use pixel
 	//unsigned char *segmented;//segmented image buffer 0-9
 
-	bool hasLookupChanged;
+	int bgrConsumerCount;
+	bool deviceRunEncoding;
+	bool deviceRegionLabelling;
+	DeviceRegion* deviceRegions;
+
+	// segmented and bgr point to one of the sets
+	std::vector<unsigned char*> segmentedSets;
+	std::vector<unsigned char*> bgrSets;
+	// class masks of ComputeBackend::TILE_SIZE tiles of the segmented image, tileClasses belongs to segmented
+	std::vector<unsigned int*> tileClassesSets;
+	unsigned int* tileClasses;
+	int tileColumns;
+	// pixel counts of the projected colors, class by class
+	std::vector<unsigned short*> rowCountsSets;
+	std::vector<unsigned short*> columnCountsSets;
+	unsigned short* rowCounts;
+	unsigned short* columnCounts;
+	// previews of each scale, the ones of set previewSet belong to segmented
+	int previewConsumerCounts[PREVIEW_SCALE_COUNT]{};
+	std::vector<unsigned char*> bgrPreviewSets[PREVIEW_SCALE_COUNT];
+	std::vector<unsigned char*> classPreviewSets[PREVIEW_SCALE_COUNT];
+	int previewSet;
+	static int getPreviewScaleIndex(int scale);
+	void addPreviewSet();
+	int pipelineDepth;
+	int queuedSet;
+	int frameBufferCount;
+
+	void enqueueSegmentation(unsigned char *frame, int set);
+	void processSegmented();
+
+	// nearest centroid of each lookup block, indexed like getLookupBlock, for partitionCentroids
+	std::vector<unsigned short> clusterPartition;
+	std::vector<unsigned char> partitionCentroids;
+	void updateClusterPartition(const unsigned char* centroids, int centroidCount);
+
+	enum StandbyState {
+		STANDBY_IDLE,
+		STANDBY_LOADING,
+		STANDBY_READY
+	};
+
+	// lookup written by standbyLoader, swapped with colors_lookup between frames once it is ready
+	unsigned char* standbyLookup;
+	std::atomic<int> standbyState;
+	std::thread* standbyLoader;
+	bool startStandbyLoader(std::function<bool()> load, const std::string& name);
+	void activateStandbyLookup();
 
 	unsigned short *pout;//Temp out buffer (for blobs)
 	int width, height, bpp;
+	int segmentedWidth, segmentedHeight, segmentedScale;
 
-	OpenCLCompute* openCLCompute;
+	ComputeBackend* computeBackend;
 
-	BlobberRun rle[MAX_RUNS]{};
-	BlobberRegion regions[MAX_REG]{};
+	BlobberRun* rle;
+	std::vector<std::vector<BlobberRun>> runStripes;
+	static int encodeRunRows(
+			const unsigned char* segmented,
+			int width,
+			int firstRow,
+			int lastRow,
+			const unsigned int* tileClasses,
+			unsigned int trackedColors,
+			std::vector<BlobberRun>& runsOut,
+			int maxRuns
+	);
+	BlobberRegion* regions;
 	ColorClassState colors[COLOR_COUNT]{};
 	BlobInfo* blobInfoCache[COLOR_COUNT]{};
 	int run_c;
@@ -164,8 +347,14 @@ private:
         return w * (2 * x + w - 1) / 2;
     }
 
-	std::vector<Offset3Pair> fillerOffsetPairs;
-	void createFillerOffsetPairs();
+	// Opposite neighbours in the 3x3x3 neighbourhood are neighbour i and 26 - i, i < 13 gives each line through the
+	// center once
+	static constexpr Offset3 getNeighbourOffset(int i) {
+		return Offset3(i / 9 - 1, i / 3 % 3 - 1, i % 3 - 1);
+	}
+	static constexpr Offset3Pair getFillerOffsetPair(int i) {
+		return Offset3Pair{getNeighbourOffset(i), getNeighbourOffset(26 - i)};
+	}
 };
 
 #endif //XIMEA_TEST_BLOBBER_H
@@ -5,26 +5,36 @@
 #ifndef BBR18_VISION_CLUSTERER_H
 #define BBR18_VISION_CLUSTERER_H
 
-#include "OpenCLCompute.h"
+#include "ComputeBackend.h"
 
 
 class Clusterer {
 
 public:
-    Clusterer();
+    explicit Clusterer(ComputeBackend* computeBackend);
     ~Clusterer();
 
     unsigned char* centroids;
     int centroidCount;
 
+    // kMeans refines the centroids on every SAMPLE_STEP'th pixel of every SAMPLE_STEP'th row of each frame,
+    // starting from the previous ones
+    static const int SAMPLE_STEP = 4;
+    static const int MAX_ITERATIONS = 8;
+
     void processFrame(unsigned char *bgr);
     void getSegmentedRgb(unsigned char* out);
     void getClusterRange(int x, int y);
     int getCentroidIndexAt(int x, int y);
     void setCentroidCount(int newCentroidCount);
 private:
-    OpenCLCompute* openCLCompute;
+    ComputeBackend* computeBackend;
     unsigned char* clustered;
+    // kMeans outputs and input while it runs on the compute backend
+    unsigned char* queuedClustered;
+    unsigned char* queuedCentroids;
+    unsigned char* queuedFrame;
+    bool queued;
 };
 
 
@@ -0,0 +1,237 @@
+#ifndef BBR18_VISION_COMPUTEBACKEND_H
+#define BBR18_VISION_COMPUTEBACKEND_H
+
+#include <string>
+#include <vector>
+
+// Common interface of the compute implementations (OpenCL, native CPU, null).
+//
+// Backends are created from spec strings:
+//   "opencl[:platform[:gpu|cpu|any]]" - first matching OpenCL device, platform is matched as substring
+//   "cpu"                             - native SIMD implementation
+//   "null"                            - does no work, for tests
+class ComputeBackend {
+public:
+	// Run length encoded part of a segmented image row, layout is shared with kernels/encode_runs.cl
+	typedef struct {
+		short x, y, width;
+		unsigned char color;
+		int parent, next;
+	} Run;
+
+	// Region of connected runs, layout is shared with kernels/label_regions.cl.
+	// x2 is inclusive and sumX, sumY are the sums of the pixel coordinates.
+	typedef struct {
+		int color;
+		int x1, y1, x2, y2;
+		int area;
+		int sumX, sumY;
+		int runStart;
+	} Region;
+
+	virtual ~ComputeBackend() = default;
+
+	// Colors lookups have 2^(3 * bits) entries indexed by blue + (green << bits) + (red << 2 * bits) of the channels
+	// reduced to bits, 8 bits is the full 16 MB lookup, 6 bits 256 KB and 5 bits 32 KB
+	static int getLookupBits(int colorsLookupSize);
+
+	// Reduces a full colors lookup to bits per channel, each entry gets the most common color of the block of full
+	// entries it covers. Returns the number of full entries that change, 0 when the conversion is lossless.
+	// changedByColor counts them by their previous color if not nullptr, it has 256 entries.
+	static int quantizeLookup(const unsigned char* lookup, int bits, unsigned char* compactOut, int* changedByColor);
+
+	virtual std::string getName() = 0;
+
+	// Returns false if the backend can not be used on this machine
+	virtual bool setup() = 0;
+
+	// rgbOut may be nullptr, then only the segmented class map is written
+	virtual void deBayer(
+			unsigned char* frame,
+			unsigned char* rgbOut,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) = 0;
+
+	// Classifies each 2x2 Bayer quad by its red, mean green and blue without interpolation,
+	// segmentedOut is width / 2 x height / 2
+	virtual void segmentQuads(
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) = 0;
+
+	// Asynchronous versions of deBayer and segmentQuads, outputs can be read once finish(segmentedOut) returns.
+	// Backends that can not overlap work with the caller do it synchronously.
+	virtual void enqueueDeBayer(
+			unsigned char* frame,
+			unsigned char* rgbOut,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) {
+		deBayer(frame, rgbOut, lookup, segmentedOut, width, height, colorsLookupSize);
+	}
+
+	virtual void enqueueSegmentQuads(
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) {
+		segmentQuads(frame, lookup, segmentedOut, width, height, colorsLookupSize);
+	}
+
+	virtual void finish(unsigned char* segmentedOut) {}
+
+	// Side of the square tiles summarized by enqueueClassifyTiles
+	static const int TILE_SIZE = 16;
+
+	// Queues summarizing the segmented image in TILE_SIZE tiles after the segmentation writing it, bit c of a
+	// tile mask is set when class c appears in the tile, a class of 32 or more sets every bit so the tile is never
+	// taken for a single class. Masks are in row order and can be read once finish(segmented) returns. Width and
+	// height must be multiples of TILE_SIZE.
+	virtual void enqueueClassifyTiles(unsigned char* segmented, int width, int height, unsigned int* tileClassesOut);
+
+	static const int MAX_PROJECTED_CLASSES = 8;
+
+	// Queues counting the pixels of classes firstClass .. firstClass + classCount - 1 in each row and column of the
+	// segmented image. Counts are stored class by class, row count of class c at y is
+	// rowCountsOut[(c - firstClass) * height + y] and column counts are laid out the same with width.
+	virtual void enqueueProjectClasses(
+			unsigned char* segmented,
+			int width,
+			int height,
+			int firstClass,
+			int classCount,
+			unsigned short* rowCountsOut,
+			unsigned short* columnCountsOut
+	);
+
+	// Queues a 1 / scale preview of the frame after the segmentation writing segmented, scale is 2, 4 or 8.
+	// BGR of a preview pixel is the mean of the Bayer samples in its block and its class is the segmented pixel at the
+	// block center. Both outputs are width / scale x height / scale and can be read once finish(segmented) returns.
+	virtual void enqueuePreview(
+			unsigned char* frame,
+			unsigned char* segmented,
+			int width,
+			int height,
+			int segmentedScale,
+			int scale,
+			unsigned char* bgrOut,
+			unsigned char* classesOut
+	);
+
+	// Backends may keep device buffers for host memory passed to them, call before freeing it.
+	// Buffers still held are released when the backend is deleted.
+	virtual void releaseBuffer(void* hostPointer) {}
+
+	// Run length encodes the segmented image produced by the last deBayer or segmentQuads call,
+	// same output as Blobber::segEncodeRuns. Colors not set in trackedColors are only emitted at row ends.
+	// Returns the number of runs or -1 if the backend can not do it.
+	virtual int encodeRuns(
+			unsigned char* segmented,
+			int width,
+			int height,
+			unsigned int trackedColors,
+			Run* runsOut,
+			int maxRuns
+	) {
+		return -1;
+	}
+
+
+	// Connects runs of the same tracked color that overlap on adjacent rows into regions, same regions in the same
+	// order as Blobber::segConnectComponents and Blobber::segExtractRegions. Runs are not modified.
+	// Returns the number of regions or -1 if there are maxRegions or more.
+	virtual int labelRegions(
+			Run* runs,
+			int runCount,
+			int maxRuns,
+			int height,
+			unsigned int trackedColors,
+			Region* regionsOut,
+			int maxRegions
+	);
+	// Picks the fastest work sizes for this machine on a representative frame and saves them for later runs.
+	// Does nothing if saved results were loaded, unless retune is set.
+	virtual void tune(
+			unsigned char* frame,
+			unsigned char* lookup,
+			int width,
+			int height,
+			int colorsLookupSize,
+			bool retune
+	) {}
+
+	virtual void kMeans(
+			unsigned char* rgb,
+			unsigned char* clustered,
+			unsigned char* centroids,
+			int centroidCount,
+			int width,
+			int height
+	) = 0;
+
+	// Calibration work is queued apart from the vision kernels so it does not hold back frames, backends that can not
+	// run it in the background do it right away. Inputs must not change and outputs are not ready before
+	// isCalibrationDone returns true. Centroids are copied when queued.
+	virtual void enqueueKMeans(
+			unsigned char* rgb,
+			unsigned char* clustered,
+			unsigned char* centroids,
+			int centroidCount,
+			int width,
+			int height
+	) {
+		kMeans(rgb, clustered, centroids, centroidCount, width, height);
+	}
+
+	// Clustered outputs have a byte per pixel
+	static const int MAX_KMEANS_CENTROIDS = 256;
+
+	// Calibration work like enqueueKMeans that first refines the centroids, starting from the given ones. Each of at
+	// most maxIterations rounds assigns every sampleStep'th pixel of every sampleStep'th row to its closest centroid and
+	// moves the centroids to the rounded means of their pixels, centroids without pixels stay. Stops early once no
+	// centroid moves. Every pixel is then assigned to the refined centroids, which are written back to centroids.
+	virtual void enqueueKMeansIterations(
+			unsigned char* bgr,
+			unsigned char* clustered,
+			unsigned char* centroids,
+			int centroidCount,
+			int width,
+			int height,
+			int sampleStep,
+			int maxIterations
+	);
+
+	// Lookup table generation for cluster colors. Writes the closest centroid of each 4x4x4 block of the full colors
+	// lookup, measured from the block center, to partitionOut at b + (g << 6) + (r << 12) of the block coordinates.
+	// partitionOut has 2^18 entries and centroids are blue, green, red. Ties go to the lower centroid index.
+	virtual void generateClusterPartition(const unsigned char* centroids, int centroidCount, unsigned short* partitionOut);
+
+	// True when all queued calibration work has completed
+	virtual bool isCalibrationDone() { return true; }
+
+	virtual void finishCalibration() {}
+
+	static ComputeBackend* create(const std::string& spec);
+
+	// Tries the specs in order and returns the first backend that sets up, nullptr if none does
+	static ComputeBackend* createFirstAvailable(const std::vector<std::string>& specs);
+
+	// Specs of every backend that could exist on this machine, one per OpenCL platform and device type
+	static std::vector<std::string> getAvailableSpecs();
+};
+
+#endif //BBR18_VISION_COMPUTEBACKEND_H
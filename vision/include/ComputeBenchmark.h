@@ -0,0 +1,44 @@
+#ifndef BBR18_VISION_COMPUTEBENCHMARK_H
+#define BBR18_VISION_COMPUTEBENCHMARK_H
+
+#include <string>
+
+class ComputeBackend;
+class OpenCLCompute;
+
+// Runs the same frame through every available compute backend, reports the timings and
+// whether the output matches the native CPU implementation.
+class ComputeBenchmark {
+public:
+	// frameFilename is a raw 8-bit Bayer frame, random data is used if it is empty or can not be read
+	static void run(const std::string& frameFilename, int iterations = 100);
+
+	// Tunes every available backend on the frame and saves the results, same frame format as run
+	static void tune(const std::string& frameFilename);
+
+private:
+	static bool loadFile(const std::string& filename, unsigned char* buffer, long size);
+	static int compareRegions(
+			ComputeBackend* reference,
+			ComputeBackend* backend,
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmented,
+			int width,
+			int height,
+			int colorsLookupSize
+	);
+	static void benchmarkRunEncoding(unsigned char* segmented, int width, int height, int iterations);
+	static void benchmarkWorkGroups(
+			OpenCLCompute* backend,
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* bgr,
+			unsigned char* segmented,
+			unsigned char* expectedBgr,
+			unsigned char* expectedSegmented,
+			int iterations
+	);
+};
+
+#endif //BBR18_VISION_COMPUTEBENCHMARK_H
@@ -49,6 +49,8 @@ namespace Config {
 	const float cameraGain = 2.0;
 	//const int cameraGain = 6;
 	const int cameraExposure = 8000;
+	// frames per second the vision must keep up with, reported by vision benchmark
+	const int cameraFrameRate = 60;
 
 	// default startup controller name
 	const std::string defaultController = "test";
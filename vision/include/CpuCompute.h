@@ -0,0 +1,59 @@
+#ifndef BBR18_VISION_CPUCOMPUTE_H
+#define BBR18_VISION_CPUCOMPUTE_H
+
+#include "ComputeBackend.h"
+
+// CPU implementation of the kernels in ../kernels, used when the OpenCL device is unavailable.
+// Results are bit-identical to the OpenCL kernels.
+class CpuCompute : public ComputeBackend {
+public:
+	enum SimdLevel {
+		SCALAR,
+		SSE41,
+		AVX2
+	};
+
+	CpuCompute();
+	~CpuCompute() override;
+
+	std::string getName() override;
+
+	bool setup() override;
+
+	void deBayer(
+			unsigned char* frame,
+			unsigned char* rgbOut,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void segmentQuads(
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void kMeans(
+			unsigned char* rgb,
+			unsigned char* clustered,
+			unsigned char* centroids,
+			int centroidCount,
+			int width,
+			int height
+	) override;
+
+	SimdLevel getSimdLevel() { return simdLevel; }
+
+private:
+	SimdLevel simdLevel;
+
+	void deBayerQuadRow(const unsigned char* frame, int width, int height, int quadY, unsigned char* planes);
+};
+
+#endif //BBR18_VISION_CPUCOMPUTE_H
@@ -33,7 +33,8 @@ class Gui : public MouseListener {
         undo,
         increaseStdDev,
         decreaseStdDev,
-        save
+        save,
+        redo
     };
 
 public:
@@ -102,6 +103,9 @@ public:
 	void emitMouseWheel(int delta, DisplayWindow* win);
 
 private:
+	static const int PREVIEW_SCALE = 4;
+
+	void setPreviewImages();
 	//void handleColorThresholding(unsigned char* dataY, unsigned char* dataU, unsigned char* dataV, unsigned char* rgb, unsigned char* classification);
 	void handleColorThresholding(unsigned char* rgbData, unsigned char* rgb);
 	void handleElements();
@@ -113,6 +117,9 @@ private:
 	std::vector<DisplayWindow*> windows;
 	DisplayWindow* frontRGB;
 	DisplayWindow* frontClassification;
+	// downscaled frame and classes made by the compute backend, a quick overview next to the full size windows
+	DisplayWindow* frontPreviewRGB;
+	DisplayWindow* frontPreviewClassification;
 	//DisplayWindow* rearRGB;
 	//DisplayWindow* frontClassification;
 	//DisplayWindow* rearClassification;
@@ -137,11 +144,15 @@ private:
 	int mouseStartY;
 	bool mouseDown;
 	bool prevMouseDown;
+	// color painted with the brush during the current stroke, -1 if none
+	int strokeColor;
 	bool quitRequested;
 	bool clustering;
 	MouseListener::MouseBtn mouseBtn;
 	int brushRadius;
 	unsigned char* segmentedRgb;
+	unsigned char* previewRgb;
+	unsigned char* previewSegmentedRgb;
 
 	unsigned char* rgbData;
     float colorSelectionStdDev;
@@ -0,0 +1,21 @@
+#ifndef BBR18_VISION_LARGEBUFFERS_H
+#define BBR18_VISION_LARGEBUFFERS_H
+
+#include <cstddef>
+#include <string>
+
+// Allocator for the frame and colors lookup buffers. Buffers are aligned to at least 4096 bytes so compute backends
+// can use them without copying. On Linux they are backed by explicit huge pages (MAP_HUGETLB) if any are reserved,
+// otherwise transparent huge pages are requested for them. On Windows they get large pages (MEM_LARGE_PAGES) when the
+// user has the "Lock pages in memory" right, otherwise normal pages.
+class LargeBuffers {
+public:
+	// Throws std::runtime_error if the memory can not be allocated, name is shown in the report
+	static void* allocate(size_t size, const std::string& name);
+	static void release(void* pointer);
+
+	// Logs the pages backing each allocated buffer, transparent huge pages only back memory that has been written
+	static void report();
+};
+
+#endif //BBR18_VISION_LARGEBUFFERS_H
@@ -0,0 +1,44 @@
+#ifndef BBR18_VISION_LOOKUPFILE_H
+#define BBR18_VISION_LOOKUPFILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Colors lookup file, replaces the raw 16 MB colors.dat. All numbers are little endian.
+//
+//   "BLUT", uint16 version, uint8 channel bits (8), uint8 block bits (2 for 4x4x4 blocks)
+//   uint32 payload size, uint32 CRC-32 of the payload
+//   payload: uint8 class count, each class as uint8 color, red, green, blue, name length and the name,
+//            then the blocks of the lookup in the order of Blobber::getLookupBlock as records of
+//            0, color, varint count - count uniform blocks of the color
+//            1, 64 colors           - one block, red major and blue minor like Blobber::readBlock
+//
+// Painted lookups are mostly uniform blocks and take tens of KB.
+class LookupFile {
+public:
+	typedef struct {
+		std::string name;
+		unsigned char color;
+		unsigned char r, g, b;
+	} ClassInfo;
+
+	static const int VERSION = 1;
+	static const int LOOKUP_SIZE = 0x1000000;
+
+	static std::vector<unsigned char> encode(const unsigned char* lookup, const std::vector<ClassInfo>& classes);
+
+	// Returns false if the data is not a complete lookup file of a known version, lookupOut is then not changed.
+	// classesOut may be nullptr.
+	static bool decode(const unsigned char* data, size_t size, unsigned char* lookupOut, std::vector<ClassInfo>* classesOut);
+
+	// Writes a temporary file next to filename and renames it over filename, so an interrupted save keeps the old file
+	static bool save(const std::string& filename, const unsigned char* lookup, const std::vector<ClassInfo>& classes);
+
+	// Loads a lookup file or a legacy raw 16 MB lookup, legacy files have no classes
+	static bool load(const std::string& filename, unsigned char* lookupOut, std::vector<ClassInfo>* classesOut);
+
+	static unsigned int crc32(const unsigned char* data, size_t size);
+};
+
+#endif //BBR18_VISION_LOOKUPFILE_H
@@ -0,0 +1,54 @@
+#ifndef BBR18_VISION_NULLCOMPUTE_H
+#define BBR18_VISION_NULLCOMPUTE_H
+
+#include "ComputeBackend.h"
+
+// Backend that does no image processing, every pixel is classified as unknown.
+// Allows running the rest of the pipeline without any compute device.
+class NullCompute : public ComputeBackend {
+public:
+	std::string getName() override { return "null"; }
+
+	bool setup() override { return true; }
+
+	void deBayer(
+			unsigned char* frame,
+			unsigned char* rgbOut,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void segmentQuads(
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void kMeans(
+			unsigned char* rgb,
+			unsigned char* clustered,
+			unsigned char* centroids,
+			int centroidCount,
+			int width,
+			int height
+	) override;
+
+	void enqueueKMeansIterations(
+			unsigned char* bgr,
+			unsigned char* clustered,
+			unsigned char* centroids,
+			int centroidCount,
+			int width,
+			int height,
+			int sampleStep,
+			int maxIterations
+	) override;
+};
+
+#endif //BBR18_VISION_NULLCOMPUTE_H
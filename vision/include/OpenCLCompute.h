@@ -2,26 +2,20 @@
 #define XIMEA_TEST_OPENCLCOMPUTE_H
 
 #include "CL/cl.h"
+#include "ComputeBackend.h"
+#include <string>
 #include <vector>
+#include <map>
 
-class OpenCLCompute {
+class OpenCLCompute : public ComputeBackend {
 public:
-    static OpenCLCompute& getInstance() {
-        static OpenCLCompute instance; // Guaranteed to be destroyed.
-        static bool singletonSetupDone = false;
+	// Empty platform name matches any platform, CL_DEVICE_TYPE_ALL prefers GPU devices
+	explicit OpenCLCompute(std::string platformName = "", cl_device_type deviceType = CL_DEVICE_TYPE_ALL);
+	~OpenCLCompute() override;
 
-        if (!singletonSetupDone) {
-            (&instance)->setup();
-            singletonSetupDone = true;
-        }
+	std::string getName() override;
 
-        return instance;
-    }
-
-	OpenCLCompute();
-	~OpenCLCompute();
-
-	void setup();
+	bool setup() override;
 
 	void deBayer(
 			unsigned char* frame,
@@ -31,7 +25,81 @@ public:
 			int width,
 			int height,
 			int colorsLookupSize
-	);
+	) override;
+
+	void enqueueDeBayer(
+			unsigned char* frame,
+			unsigned char* rgbOut,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void segmentQuads(
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void enqueueSegmentQuads(
+			unsigned char* frame,
+			unsigned char* lookup,
+			unsigned char* segmentedOut,
+			int width,
+			int height,
+			int colorsLookupSize
+	) override;
+
+	void enqueueClassifyTiles(unsigned char* segmented, int width, int height, unsigned int* tileClassesOut) override;
+
+	void enqueueProjectClasses(
+			unsigned char* segmented,
+			int width,
+			int height,
+			int firstClass,
+			int classCount,
+			unsigned short* rowCountsOut,
+			unsigned short* columnCountsOut
+	) override;
+
+	void enqueuePreview(
+			unsigned char* frame,
+			unsigned char* segmented,
+			int width,
+			int height,
+			int segmentedScale,
+			int scale,
+			unsigned char* bgrOut,
+			unsigned char* classesOut
+	) override;
+
+	void finish(unsigned char* segmentedOut) override;
+
+	void releaseBuffer(void* hostPointer) override;
+
+	int encodeRuns(
+			unsigned char* segmented,
+			int width,
+			int height,
+			unsigned int trackedColors,
+			Run* runsOut,
+			int maxRuns
+	) override;
+
+	int labelRegions(
+			Run* runs,
+			int runCount,
+			int maxRuns,
+			int height,
+			unsigned int trackedColors,
+			Region* regionsOut,
+			int maxRegions
+	) override;
 
     void kMeans(
             unsigned char* rgb,
@@ -40,50 +108,185 @@ public:
             int centroidCount,
             int width,
             int height
-    );
-
-    void generateLookupTable(
-			unsigned char *centroids,
-			unsigned char *lookupTable,
-			int centroidIndex,
-			int centroidCount,
-			unsigned char color
-	);
+    ) override;
+
+    void enqueueKMeans(
+            unsigned char* rgb,
+            unsigned char* clustered,
+            unsigned char* centroids,
+            int centroidCount,
+            int width,
+            int height
+    ) override;
+
+    void enqueueKMeansIterations(
+            unsigned char* bgr,
+            unsigned char* clustered,
+            unsigned char* centroids,
+            int centroidCount,
+            int width,
+            int height,
+            int sampleStep,
+            int maxIterations
+    ) override;
+
+    bool isCalibrationDone() override;
+
+    void finishCalibration() override;
+
+	// Work group of the interior debayer kernels, width 0 lets the driver choose.
+	// Tiled work groups use kernels that load the raw block of each work group into local memory once.
+	typedef struct {
+		int width;
+		int height;
+		bool tiled;
+	} WorkGroup;
+
+	// Applies to the frame size of the last call, returns false and keeps the previous one if it can not be used
+	bool setDeBayerWorkGroup(WorkGroup workGroup);
+	WorkGroup getDeBayerWorkGroup();
+	// Candidates for benchmarking, some of them may not be usable on the device
+	static std::vector<WorkGroup> getDeBayerWorkGroups();
+
+	void tune(
+			unsigned char* frame,
+			unsigned char* lookup,
+			int width,
+			int height,
+			int colorsLookupSize,
+			bool retune
+	) override;
+
+	static std::vector<std::string> getAvailableSpecs();
 
 private:
+	std::string platformName;
+	cl_device_type deviceType;
+
 	std::vector<cl_platform_id> selectedPlatformIds;
 	std::vector<cl_device_id> selectedDeviceIds;
 
-	bool findDevice(std::string platformName, std::string deviceVendor);
-	std::string GetPlatformName(cl_platform_id id);
-	std::string GetDeviceName(cl_device_id id);
-	std::string GetDeviceVendor(cl_device_id id);
-	int GetDeviceType(cl_device_id id);
+	bool findDevice(std::string platformName, cl_device_type deviceType);
+	static std::string GetPlatformName(cl_platform_id id);
+	static std::string GetDeviceName(cl_device_id id);
+	static std::string GetDeviceVendor(cl_device_id id);
+	static std::string GetDeviceInfoString(cl_device_id id, cl_device_info param);
+	static cl_device_type GetDeviceType(cl_device_id id);
 	void LogDeviceSVM(cl_device_id id);
-	void CheckError(cl_int error, std::string message);
+	bool CheckError(cl_int error, std::string message);
 	std::string LoadKernel(const char *name);
 	cl_program CreateProgram(const std::string &source, cl_context context);
+	cl_program BuildProgram(const char *kernelFile, const std::string &options);
+	std::string GetProgramCacheKey(const std::string &source, const std::string &options);
+	static std::string GetHashText(const std::string &text);
+	static std::string GetProgramCacheFilename(const char *kernelFile, const std::string &key);
+	cl_program LoadCachedProgram(const std::string &filename, const std::string &key);
+	static void SaveCachedProgram(cl_program program, const std::string &filename, const std::string &key);
+	void LogBuildLog(cl_program program, const char *kernelFile);
+
+	typedef struct {
+		cl_mem buffer;
+		size_t size;
+	} HostBuffer;
 
-	cl_mem inputBuffer;
-	cl_mem rgbOutBuffer;
-	cl_mem lookupBuffer;
-	cl_mem segmentedBuffer;
+	// zero copy buffers by host pointer, see getHostBuffer
+	std::map<void*, HostBuffer> hostBuffers;
+	// last queued work writing to each segmented output
+	std::map<unsigned char*, cl_event> frameEvents;
+	// encodeRuns per row state, sized for rowRunBufferRows rows
+	cl_mem rowRunCountsBuffer;
+	cl_mem rowRunOffsetsBuffer;
+	int rowRunBufferRows;
+	// labelRegions state, row starts are sized for labelRowCapacity rows, labels and region ids for labelRunCapacity runs
+	cl_mem rowStartsBuffer;
+	cl_mem labelsBuffer;
+	cl_mem regionIdsBuffer;
+	cl_mem regionCountBuffer;
+	int labelRowCapacity;
+	int labelRunCapacity;
 
 	cl_context clContext;
+	// vision kernels, high priority where the device supports priority hints
 	cl_command_queue clQueue;
+	// kMeans, low priority
+	cl_command_queue calibrationQueue;
+	// last queued calibration work
+	cl_event calibrationEvent;
 
 	cl_program deBayerProgram;
 	cl_kernel deBayerKernel;
+	cl_kernel deBayerBorderKernel;
+	cl_kernel segmentKernel;
+	cl_kernel segmentBorderKernel;
+	cl_kernel segmentQuadsKernel;
+	cl_kernel classifyTilesKernel;
+	cl_kernel projectClassesKernel;
+	cl_kernel previewKernel;
+	// frame size and lookup size the debayer program is built for
+	int deBayerWidth;
+	int deBayerHeight;
+	int deBayerLookupSize;
+	WorkGroup deBayerWorkGroup;
+	// tuned local sizes, tiled is not used
+	WorkGroup segmentQuadsWorkGroup;
+	WorkGroup kMeansWorkGroup;
+	bool workGroupsLoaded;
+
+	cl_program encodeRunsProgram;
+	cl_kernel countRunsKernel;
+	cl_kernel scanRunCountsKernel;
+	cl_kernel encodeRunsKernel;
+
+	cl_program labelRegionsProgram;
+	cl_kernel findRowStartsKernel;
+	cl_kernel mergeRunsKernel;
+	cl_kernel flattenLabelsKernel;
+	cl_kernel numberRegionsKernel;
+	cl_kernel accumulateRegionsKernel;
 
 	cl_program kMeansProgram;
 	cl_kernel kMeansKernel;
+	cl_kernel kMeansAccumulateKernel;
+	cl_kernel kMeansUpdateKernel;
+	// kept for every kMeans call, sized for MAX_KMEANS_CENTROIDS
+	cl_mem kMeansCentroidsBuffer;
+	cl_mem kMeansSumsBuffer;
+	cl_mem kMeansStateBuffer;
+	// queues assigning each pixel to the centroids in kMeansCentroidsBuffer
+	void enqueueKMeansKernel(cl_mem inputBuffer, cl_mem clusteredBuffer, int centroidCount, int width, int height);
 
-	cl_program generateLookupTableProgram;
-	cl_kernel generateLookupTableKernel;
-
-	void setupDeBayer();
-	void setupKMeans();
-	void setupGenerateLookupTable();
+	bool setupDeBayer(int width, int height, int colorsLookupSize);
+	void releaseDeBayer();
+	bool useDeBayerSize(int width, int height, int colorsLookupSize);
+	bool getDeBayerRange(int width, int height, size_t offset[3], size_t size[3], size_t localSize[3]);
+	static const size_t* getLocalSize(const WorkGroup& workGroup, const size_t* size, size_t* localSize);
+	static double timeKernel(
+			cl_command_queue queue,
+			cl_kernel kernel,
+			cl_uint dimensions,
+			const size_t* offset,
+			const size_t* size,
+			const size_t* localSize
+	);
+	std::vector<WorkGroup> getWorkGroups(cl_kernel kernel, size_t width, size_t height);
+	std::string GetDeviceKey();
+	bool loadWorkGroups();
+	void saveWorkGroups();
+	// Device buffer using hostPointer as its storage, kept until releaseBuffer. The host reads and writes the memory
+	// between kernels without mapping it, which is only coherent on devices that share memory with the host, so
+	// findDevice skips devices without CL_DEVICE_HOST_UNIFIED_MEMORY.
+	cl_mem getHostBuffer(void* hostPointer, size_t size, cl_mem_flags flags);
+	void setFrameEvent(unsigned char* segmentedOut, cl_event event);
+	// True if segmented, and frame if given, were written on the device and kernel was built. Otherwise waits for the
+	// work queued on segmented so the CPU default implementation can read it.
+	bool hasDeviceSegmented(unsigned char* segmented, cl_kernel kernel, unsigned char* frame = nullptr);
+	bool setupEncodeRuns();
+	void releaseEncodeRuns();
+	cl_command_queue createCommandQueue(bool highPriority);
+	void setCalibrationEvent(cl_event event);
+	bool setupLabelRegions();
+	void releaseLabelRegions();
+	bool setupKMeans();
 };
 
 #endif
@@ -13,6 +13,8 @@ class Util {
 
 public:
     static std::string base64Encode(const unsigned char* data, unsigned int len);
+    // Returns false if the text has characters outside the base64 alphabet, padding is optional
+    static bool base64Decode(const std::string& text, std::vector<unsigned char>& dataOut);
     static double millitime();
     static double duration(double start);
     static float signum(float value);
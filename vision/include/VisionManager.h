@@ -10,6 +10,7 @@
 class XimeaCamera;
 class Blobber;
 class Gui;
+class ComputeBackend;
 
 class VisionManager {
 
@@ -34,6 +35,7 @@ private:
 	void loadConf();
 	void setupXimeaCamera(std::string name, XimeaCamera* camera);
 
+	ComputeBackend* computeBackend;
 	XimeaCamera* frontCamera;
 	Gui* gui;
 	Blobber* blobber;
@@ -49,10 +51,15 @@ private:
 	double lastStepTime;
 	float totalTime;
 	Dir debugCameraDir;
+	// colors lookup chunks of the vision_lut transfer in progress
+	int lookupTransferId;
+	std::vector<std::vector<unsigned char>> lookupChunks;
+	int lookupChunksReceived;
 
 	void sendState();
 	void handleCommunicationMessages();
 	void handleCommunicationMessage(std::string message);
+	void handleLookupMessage(const nlohmann::json& message);
 	bool isBlobBall(Blobber::Blob blob);
 };
 
@@ -14,7 +14,8 @@
 class XimeaCamera : public BaseCamera {
 
 public:
-	explicit XimeaCamera(int serial);
+	// Frames are written to frameBufferCount buffers in turn, a frame stays valid until as many newer ones are fetched
+	explicit XimeaCamera(int serial, int frameBufferCount = 3);
     ~XimeaCamera();
 	void open();
 	int getSerial() { return serialNumber; }
@@ -24,6 +25,7 @@ public:
     void stopAcquisition();
     void close();
     Frame* getFrame();
+	int getFrameBufferCount() { return (int)frameBuffers.size(); }
     
 	std::vector<int> getAvailableSerials();
 	static unsigned long getNumberDevices();
@@ -65,6 +67,8 @@ public:
 private:
     XI_IMG image;
 	Frame frame;
+	std::vector<unsigned char*> frameBuffers;
+	int nextFrameBuffer;
     HANDLE device;
     bool opened;
 	bool acquisitioning;
@@ -1,51 +1,50 @@
-__kernel void debayerAndSegment(
-    __global uchar* input,
-    __global uchar* output,
-    __global uchar* lookup,
-    __global uchar* segmented
-) {
-    int x = get_global_id(0);
-    int y = get_global_id(1);
+// Built with constants from OpenCLCompute::setupDeBayer:
+//   WIDTH, HEIGHT - frame size in pixels
+//   BAYER_PHASE   - color of the first pixel, 0 for RGGB, 3 for BGGR
+//   LUT_BITS      - bits per channel in the colors lookup index
+//   LUT_CONSTANT  - defined when the colors lookup fits in constant memory
+#ifndef WIDTH
+#error "WIDTH must be defined"
+#endif
+
+#ifndef HEIGHT
+#error "HEIGHT must be defined"
+#endif
+
+#ifndef BAYER_PHASE
+#define BAYER_PHASE 0
+#endif
 
-    int width = 2 * get_global_size(0);
-    int maxIndex = width * 2 * get_global_size(1) - 1;
-
-    int destY     = 2 * y;
-    int destX     = 2 * x;
-    int xy = destY * width + destX;
-
-    // 4 pixels per call, 2 pixels of 2 lines
-    int sourcePixelIndex = xy - width;
-
-    uchar4 line_0;
-    uchar4 line_1;
-    uchar4 line_2;
-    uchar4 line_3;
-
-    // vector access .x .y .z. w
-    line_0.x = input[clamp(sourcePixelIndex-1, 0, maxIndex)];
-    line_0.y = input[clamp(sourcePixelIndex, 0, maxIndex)];
-    line_0.z = input[clamp(sourcePixelIndex+1, 0, maxIndex)];
-    line_0.w = input[clamp(sourcePixelIndex+2, 0, maxIndex)];
-
-    sourcePixelIndex += width;
-    line_1.x = input[clamp(sourcePixelIndex-1, 0, maxIndex)];
-    line_1.y = input[clamp(sourcePixelIndex, 0, maxIndex)];
-    line_1.z = input[clamp(sourcePixelIndex+1, 0, maxIndex)];
-    line_1.w = input[clamp(sourcePixelIndex+2, 0, maxIndex)];
-
-    sourcePixelIndex += width;
-    line_2.x = input[clamp(sourcePixelIndex-1, 0, maxIndex)];
-    line_2.y = input[clamp(sourcePixelIndex, 0, maxIndex)];
-    line_2.z = input[clamp(sourcePixelIndex+1, 0, maxIndex)];
-    line_2.w = input[clamp(sourcePixelIndex+2, 0, maxIndex)];
-
-    sourcePixelIndex += width;
-    line_3.x = input[clamp(sourcePixelIndex-1, 0, maxIndex)];
-    line_3.y = input[clamp(sourcePixelIndex, 0, maxIndex)];
-    line_3.z = input[clamp(sourcePixelIndex+1, 0, maxIndex)];
-    line_3.w = input[clamp(sourcePixelIndex+2, 0, maxIndex)];
+#ifndef LUT_BITS
+#define LUT_BITS 8
+#endif
 
+#if BAYER_PHASE != 0 && BAYER_PHASE != 3
+#error "Only RGGB and BGGR Bayer phases are supported"
+#endif
+
+#ifdef LUT_CONSTANT
+#define LUT_SPACE __constant
+#else
+#define LUT_SPACE __global
+#endif
+
+#define MAX_INDEX (WIDTH * HEIGHT - 1)
+
+#define LUT_SHIFT (8 - LUT_BITS)
+#define LUT_INDEX(red, green, blue) \
+    (((blue) >> LUT_SHIFT) + (((green) >> LUT_SHIFT) << LUT_BITS) + (((red) >> LUT_SHIFT) << (2 * LUT_BITS)))
+
+// Debayers the 2x2 quad from the 4x4 pixels around it, components are pixels 00, 01, 10, 11
+void debayerLines(
+    uchar4 line_0,
+    uchar4 line_1,
+    uchar4 line_2,
+    uchar4 line_3,
+    ushort4* blue,
+    ushort4* green,
+    ushort4* red
+) {
     //R G R G R G
     //G B G B G B
     //R G R G R G
@@ -53,51 +52,504 @@ __kernel void debayerAndSegment(
     //R G R G R G
     //G B G B G B
 
+#if BAYER_PHASE == 3
+    // BGGR has the same layout with red and blue swapped
+    ushort4* swap = blue;
+    blue = red;
+    red = swap;
+#endif
+
     // first pixel first line
-    ushort blue_00  = (line_0.x + line_0.z + line_2.x + line_2.z) / 4;
-    ushort green_00 = (line_0.y + line_1.x + line_1.z + line_2.y) / 4;
-    ushort red_00   = line_1.y;
+    blue->x  = (line_0.x + line_0.z + line_2.x + line_2.z) / 4;
+    green->x = (line_0.y + line_1.x + line_1.z + line_2.y) / 4;
+    red->x   = line_1.y;
 
     // second pixel first line
-    ushort blue_01   = hadd(line_0.z, line_2.z);
-    ushort green_01  = line_1.z;
-    ushort red_01    = hadd(line_1.y, line_1.w);
+    blue->y   = hadd(line_0.z, line_2.z);
+    green->y  = line_1.z;
+    red->y    = hadd(line_1.y, line_1.w);
 
     // first pixel second line
-    ushort blue_10   = hadd(line_2.x, line_2.z);
-    ushort green_10  = line_2.y;
-    ushort red_10    = hadd(line_1.y, line_3.y);
+    blue->z   = hadd(line_2.x, line_2.z);
+    green->z  = line_2.y;
+    red->z    = hadd(line_1.y, line_3.y);
 
     // second pixel second line
-    ushort blue_11   = line_2.z;
-    ushort green_11  = (line_1.z + line_2.y + line_2.w + line_3.z) / 4;
-    ushort red_11    = (line_1.y + line_1.w + line_3.y + line_3.w) / 4;
+    blue->w   = line_2.z;
+    green->w  = (line_1.z + line_2.y + line_2.w + line_3.z) / 4;
+    red->w    = (line_1.y + line_1.w + line_3.y + line_3.w) / 4;
+}
+
+// Quads away from the first and last quad row never read outside the frame,
+// the pixel left of the first column is the last pixel of the previous row
+void debayerQuad(
+    __global uchar* input,
+    int x,
+    int y,
+    ushort4* blue,
+    ushort4* green,
+    ushort4* red
+) {
+    __global uchar* source = input + (2 * y - 1) * WIDTH + 2 * x - 1;
+
+    debayerLines(
+        vload4(0, source),
+        vload4(0, source + WIDTH),
+        vload4(0, source + 2 * WIDTH),
+        vload4(0, source + 3 * WIDTH),
+        blue, green, red
+    );
+}
+
+// Same as debayerQuad for the first and last quad rows, reads outside the frame are clamped to the first and last pixel
+void debayerBorderQuad(
+    __global uchar* input,
+    int x,
+    int y,
+    ushort4* blue,
+    ushort4* green,
+    ushort4* red
+) {
+    int sourcePixelIndex = (2 * y - 1) * WIDTH + 2 * x;
+
+    uchar4 lines[4];
+
+    for (int i = 0; i < 4; i++) {
+        lines[i].x = input[clamp(sourcePixelIndex - 1, 0, MAX_INDEX)];
+        lines[i].y = input[clamp(sourcePixelIndex, 0, MAX_INDEX)];
+        lines[i].z = input[clamp(sourcePixelIndex + 1, 0, MAX_INDEX)];
+        lines[i].w = input[clamp(sourcePixelIndex + 2, 0, MAX_INDEX)];
+
+        sourcePixelIndex += WIDTH;
+    }
+
+    debayerLines(lines[0], lines[1], lines[2], lines[3], blue, green, red);
+}
+
+void writeQuad(
+    __global uchar* output,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented,
+    int x,
+    int y,
+    ushort4 blue,
+    ushort4 green,
+    ushort4 red
+) {
+    int xy = 2 * y * WIDTH + 2 * x;
 
     // first pixel first line
-    int n = 1;
-    int destPixelIndex = (destY * width + destX) * 3;
-    output[destPixelIndex]    = blue_00 * n;
-    output[destPixelIndex+1]  = green_00 * n;
-    output[destPixelIndex+2]  = red_00 * n;
-    segmented[xy] = lookup[blue_00 + (green_00 << 8) + (red_00 << 16)];
+    int destPixelIndex = xy * 3;
+    output[destPixelIndex]    = blue.x;
+    output[destPixelIndex+1]  = green.x;
+    output[destPixelIndex+2]  = red.x;
+    segmented[xy] = lookup[LUT_INDEX(red.x, green.x, blue.x)];
 
     // second pixel first line
-    output[destPixelIndex+3]  = blue_01 * n;
-    output[destPixelIndex+4]  = green_01 * n;
-    output[destPixelIndex+5]  = red_01 * n;
-    segmented[xy + 1] = lookup[blue_01 + (green_01 << 8) + (red_01 << 16)];
+    output[destPixelIndex+3]  = blue.y;
+    output[destPixelIndex+4]  = green.y;
+    output[destPixelIndex+5]  = red.y;
+    segmented[xy + 1] = lookup[LUT_INDEX(red.y, green.y, blue.y)];
 
     // first pixel second line
-    destPixelIndex += width * 3;
-    output[destPixelIndex]    = blue_10 * n;
-    output[destPixelIndex+1]  = green_10 * n;
-    output[destPixelIndex+2]  = red_10 * n;
-    xy += width;
-    segmented[xy] = lookup[blue_10 + (green_10 << 8) + (red_10 << 16)];
+    destPixelIndex += WIDTH * 3;
+    output[destPixelIndex]    = blue.z;
+    output[destPixelIndex+1]  = green.z;
+    output[destPixelIndex+2]  = red.z;
+    xy += WIDTH;
+    segmented[xy] = lookup[LUT_INDEX(red.z, green.z, blue.z)];
 
     // second pixel second line
-    output[destPixelIndex+3]  = blue_11 * n;
-    output[destPixelIndex+4]  = green_11 * n;
-    output[destPixelIndex+5]  = red_11 * n;
-    segmented[xy + 1] = lookup[blue_11 + (green_11 << 8) + (red_11 << 16)];
-}
\ No newline at end of file
+    output[destPixelIndex+3]  = blue.w;
+    output[destPixelIndex+4]  = green.w;
+    output[destPixelIndex+5]  = red.w;
+    segmented[xy + 1] = lookup[LUT_INDEX(red.w, green.w, blue.w)];
+}
+
+void writeSegmentedQuad(
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented,
+    int x,
+    int y,
+    ushort4 blue,
+    ushort4 green,
+    ushort4 red
+) {
+    int xy = 2 * y * WIDTH + 2 * x;
+
+    segmented[xy] = lookup[LUT_INDEX(red.x, green.x, blue.x)];
+    segmented[xy + 1] = lookup[LUT_INDEX(red.y, green.y, blue.y)];
+
+    xy += WIDTH;
+    segmented[xy] = lookup[LUT_INDEX(red.z, green.z, blue.z)];
+    segmented[xy + 1] = lookup[LUT_INDEX(red.w, green.w, blue.w)];
+}
+
+// Quad rows 1 to HEIGHT / 2 - 2, launched with global offset 1 in y
+__kernel void debayerAndSegment(
+    __global uchar* input,
+    __global uchar* output,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    ushort4 blue;
+    ushort4 green;
+    ushort4 red;
+
+    debayerQuad(input, x, y, &blue, &green, &red);
+    writeQuad(output, lookup, segmented, x, y, blue, green, red);
+}
+
+// First and last quad row, global size is WIDTH / 2 x 2
+__kernel void debayerAndSegmentBorder(
+    __global uchar* input,
+    __global uchar* output,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1) == 0 ? 0 : HEIGHT / 2 - 1;
+
+    ushort4 blue;
+    ushort4 green;
+    ushort4 red;
+
+    debayerBorderQuad(input, x, y, &blue, &green, &red);
+    writeQuad(output, lookup, segmented, x, y, blue, green, red);
+}
+
+// Same as debayerAndSegment without writing the BGR frame, used when nothing reads it
+__kernel void segment(
+    __global uchar* input,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    ushort4 blue;
+    ushort4 green;
+    ushort4 red;
+
+    debayerQuad(input, x, y, &blue, &green, &red);
+    writeSegmentedQuad(lookup, segmented, x, y, blue, green, red);
+}
+
+__kernel void segmentBorder(
+    __global uchar* input,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1) == 0 ? 0 : HEIGHT / 2 - 1;
+
+    ushort4 blue;
+    ushort4 green;
+    ushort4 red;
+
+    debayerBorderQuad(input, x, y, &blue, &green, &red);
+    writeSegmentedQuad(lookup, segmented, x, y, blue, green, red);
+}
+
+// Classifies each 2x2 quad without interpolation, output is a quarter of the input size
+__kernel void segmentQuads(
+    __global uchar* input,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    //R G
+    //G B
+    uchar2 line_0 = vload2(0, input + 2 * y * WIDTH + 2 * x);
+    uchar2 line_1 = vload2(0, input + (2 * y + 1) * WIDTH + 2 * x);
+
+#if BAYER_PHASE == 3
+    ushort red = line_1.y;
+    ushort green = hadd(line_0.y, line_1.x);
+    ushort blue = line_0.x;
+#else
+    ushort red = line_0.x;
+    ushort green = hadd(line_0.y, line_1.x);
+    ushort blue = line_1.y;
+#endif
+
+    segmented[y * (WIDTH / 2) + x] = lookup[LUT_INDEX(red, green, blue)];
+}
+
+// Tile mask bit of a class, classes without a bit mark the tile as mixed
+uint classBit(uchar color) {
+    return color < 32 ? 1u << color : ~0u;
+}
+
+// Bit mask of the classes in each 16x16 tile of the segmented image, one work group per tile and a row per work item.
+// Segmented size is an argument as it is half the frame size after segmentQuads.
+__kernel __attribute__((reqd_work_group_size(1, 16, 1)))
+void classifyTiles(
+    __global uchar* segmented,
+    __global uint* tileClasses,
+    int segmentedWidth
+) {
+    __local uint classes;
+
+    int tileX = get_group_id(0);
+    int tileY = get_group_id(1);
+    int row = get_local_id(1);
+
+    if (row == 0) {
+        classes = 0;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uchar16 pixels = vload16(0, segmented + (tileY * 16 + row) * segmentedWidth + tileX * 16);
+
+    uint rowClasses = classBit(pixels.s0) | classBit(pixels.s1) | classBit(pixels.s2) | classBit(pixels.s3)
+        | classBit(pixels.s4) | classBit(pixels.s5) | classBit(pixels.s6) | classBit(pixels.s7)
+        | classBit(pixels.s8) | classBit(pixels.s9) | classBit(pixels.sa) | classBit(pixels.sb)
+        | classBit(pixels.sc) | classBit(pixels.sd) | classBit(pixels.se) | classBit(pixels.sf);
+
+    atomic_or(&classes, rowClasses);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (row == 0) {
+        tileClasses[tileY * get_num_groups(0) + tileX] = classes;
+    }
+}
+
+// Pixel counts of classes firstClass .. firstClass + classCount - 1 in each row and column, work items below
+// the height count a row and the rest a column. Counts are stored class by class.
+__kernel void projectClasses(
+    __global uchar* segmented,
+    __global ushort* rowCounts,
+    __global ushort* columnCounts,
+    int segmentedWidth,
+    int segmentedHeight,
+    int firstClass,
+    int classCount
+) {
+    int id = get_global_id(0);
+    ushort counts[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    if (id < segmentedHeight) {
+        __global uchar* row = segmented + id * segmentedWidth;
+
+        for (int x = 0; x < segmentedWidth; x++) {
+            uint c = row[x] - firstClass;
+
+            if (c < classCount) {
+                counts[c]++;
+            }
+        }
+
+        for (int c = 0; c < classCount; c++) {
+            rowCounts[c * segmentedHeight + id] = counts[c];
+        }
+    } else if (id < segmentedHeight + segmentedWidth) {
+        int x = id - segmentedHeight;
+
+        for (int y = 0; y < segmentedHeight; y++) {
+            uint c = segmented[y * segmentedWidth + x] - firstClass;
+
+            if (c < classCount) {
+                counts[c]++;
+            }
+        }
+
+        for (int c = 0; c < classCount; c++) {
+            columnCounts[c * segmentedWidth + x] = counts[c];
+        }
+    }
+}
+
+// 1 / scale preview, one work item per preview pixel. BGR is the mean of the Bayer samples in the scale x scale block
+// and the class is the segmented pixel at the block center.
+__kernel void preview(
+    __global uchar* input,
+    __global uchar* segmented,
+    __global uchar* bgrPreview,
+    __global uchar* classPreview,
+    int scale,
+    int segmentedScale
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int previewWidth = WIDTH / scale;
+    // samples of each color in a block, green has twice as many
+    uint samples = scale * scale / 4;
+    uint4 sums = (uint4)(0);
+
+    for (int quadY = 0; quadY < scale / 2; quadY++) {
+        __global uchar* line_0 = input + (y * scale + 2 * quadY) * WIDTH + x * scale;
+        __global uchar* line_1 = line_0 + WIDTH;
+
+        for (int quadX = 0; quadX < scale / 2; quadX++) {
+            uchar2 top = vload2(quadX, line_0);
+            uchar2 bottom = vload2(quadX, line_1);
+
+            sums += convert_uint4((uchar4)(top, bottom));
+        }
+    }
+
+#if BAYER_PHASE == 3
+    uint red = sums.w;
+    uint blue = sums.x;
+#else
+    uint red = sums.x;
+    uint blue = sums.w;
+#endif
+    uint green = sums.y + sums.z;
+
+    vstore3(
+        convert_uchar3((uint3)((blue + samples / 2) / samples, (green + samples) / (2 * samples), (red + samples / 2) / samples)),
+        y * previewWidth + x,
+        bgrPreview
+    );
+
+    int centerX = (x * scale + scale / 2) / segmentedScale;
+    int centerY = (y * scale + scale / 2) / segmentedScale;
+
+    classPreview[y * previewWidth + x] = segmented[centerY * (WIDTH / segmentedScale) + centerX];
+}
+
+#ifdef TILE_WIDTH
+// Tiled versions of debayerAndSegment and segment for interior quad rows, built when OpenCLCompute uses a tiled
+// work group. Each work group is TILE_WIDTH x TILE_HEIGHT quads, it loads the raw block under the tile once into
+// local memory, stages the outputs there and writes them out as whole 16 byte vectors.
+#if TILE_WIDTH % 8 != 0 || (WIDTH / 2) % TILE_WIDTH != 0
+#error "TILE_WIDTH must be a multiple of 8 that divides WIDTH / 2"
+#endif
+
+// raw pixels of the tile with a one pixel border, rows are padded to whole vload16 chunks
+#define BLOCK_WIDTH (2 * TILE_WIDTH + 2)
+#define BLOCK_HEIGHT (2 * TILE_HEIGHT + 2)
+#define BLOCK_CHUNKS ((BLOCK_WIDTH + 15) / 16)
+#define BLOCK_STRIDE (BLOCK_CHUNKS * 16)
+
+#define BGR_TILE_STRIDE (6 * TILE_WIDTH)
+#define SEGMENTED_TILE_STRIDE (2 * TILE_WIDTH)
+#define TILE_ITEMS (TILE_WIDTH * TILE_HEIGHT)
+
+void debayerTile(
+    __global uchar* input,
+    __global uchar* output,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented,
+    bool withBgr,
+    __local uchar* block,
+    __local uchar* bgrTile,
+    __local uchar* segmentedTile
+) {
+    int localX = get_local_id(0);
+    int localY = get_local_id(1);
+    int localId = localY * TILE_WIDTH + localX;
+
+    // quad coordinates of the first tile quad, y starts from 1 as the kernel is launched with offset 1
+    int tileX = get_global_id(0) - localX;
+    int tileY = get_global_id(1) - localY;
+
+    int blockStart = (2 * tileY - 1) * WIDTH + 2 * tileX - 1;
+
+    for (int i = localId; i < BLOCK_HEIGHT * BLOCK_CHUNKS; i += TILE_ITEMS) {
+        int row = i / BLOCK_CHUNKS;
+        int chunk = i - row * BLOCK_CHUNKS;
+
+        // only rows under the padding past the last interior quad row can reach the frame end, those are not written
+        int source = min(blockStart + row * WIDTH + chunk * 16, WIDTH * HEIGHT - 16);
+
+        vstore16(vload16(0, input + source), 0, block + row * BLOCK_STRIDE + chunk * 16);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    ushort4 blue;
+    ushort4 green;
+    ushort4 red;
+
+    __local uchar* source = block + 2 * localY * BLOCK_STRIDE + 2 * localX;
+
+    debayerLines(
+        vload4(0, source),
+        vload4(0, source + BLOCK_STRIDE),
+        vload4(0, source + 2 * BLOCK_STRIDE),
+        vload4(0, source + 3 * BLOCK_STRIDE),
+        &blue, &green, &red
+    );
+
+    __local uchar* segmentedQuad = segmentedTile + 2 * localY * SEGMENTED_TILE_STRIDE + 2 * localX;
+    segmentedQuad[0] = lookup[LUT_INDEX(red.x, green.x, blue.x)];
+    segmentedQuad[1] = lookup[LUT_INDEX(red.y, green.y, blue.y)];
+    segmentedQuad[SEGMENTED_TILE_STRIDE] = lookup[LUT_INDEX(red.z, green.z, blue.z)];
+    segmentedQuad[SEGMENTED_TILE_STRIDE + 1] = lookup[LUT_INDEX(red.w, green.w, blue.w)];
+
+    if (withBgr) {
+        __local uchar* bgrQuad = bgrTile + 2 * localY * BGR_TILE_STRIDE + 6 * localX;
+        vstore3((uchar3)(blue.x, green.x, red.x), 0, bgrQuad);
+        vstore3((uchar3)(blue.y, green.y, red.y), 0, bgrQuad + 3);
+        vstore3((uchar3)(blue.z, green.z, red.z), 0, bgrQuad + BGR_TILE_STRIDE);
+        vstore3((uchar3)(blue.w, green.w, red.w), 0, bgrQuad + BGR_TILE_STRIDE + 3);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // the last tile row may extend past the interior quad rows
+    int pixelRows = 2 * min(TILE_HEIGHT, HEIGHT / 2 - 1 - tileY);
+    int firstPixel = 2 * tileY * WIDTH + 2 * tileX;
+
+    for (int i = localId; i < pixelRows * (SEGMENTED_TILE_STRIDE / 16); i += TILE_ITEMS) {
+        int row = i / (SEGMENTED_TILE_STRIDE / 16);
+        int chunk = i - row * (SEGMENTED_TILE_STRIDE / 16);
+
+        vstore16(
+            vload16(0, segmentedTile + row * SEGMENTED_TILE_STRIDE + chunk * 16),
+            0,
+            segmented + firstPixel + row * WIDTH + chunk * 16
+        );
+    }
+
+    if (withBgr) {
+        for (int i = localId; i < pixelRows * (BGR_TILE_STRIDE / 16); i += TILE_ITEMS) {
+            int row = i / (BGR_TILE_STRIDE / 16);
+            int chunk = i - row * (BGR_TILE_STRIDE / 16);
+
+            vstore16(
+                vload16(0, bgrTile + row * BGR_TILE_STRIDE + chunk * 16),
+                0,
+                output + 3 * (firstPixel + row * WIDTH) + chunk * 16
+            );
+        }
+    }
+}
+
+// Global size is WIDTH / 2 x interior quad rows rounded up to TILE_HEIGHT, offset 1 in y
+__kernel __attribute__((reqd_work_group_size(TILE_WIDTH, TILE_HEIGHT, 1)))
+void debayerAndSegmentTiled(
+    __global uchar* input,
+    __global uchar* output,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    __local uchar block[BLOCK_HEIGHT * BLOCK_STRIDE];
+    __local uchar bgrTile[2 * TILE_HEIGHT * BGR_TILE_STRIDE];
+    __local uchar segmentedTile[2 * TILE_HEIGHT * SEGMENTED_TILE_STRIDE];
+
+    debayerTile(input, output, lookup, segmented, true, block, bgrTile, segmentedTile);
+}
+
+__kernel __attribute__((reqd_work_group_size(TILE_WIDTH, TILE_HEIGHT, 1)))
+void segmentTiled(
+    __global uchar* input,
+    LUT_SPACE uchar* lookup,
+    __global uchar* segmented
+) {
+    __local uchar block[BLOCK_HEIGHT * BLOCK_STRIDE];
+    __local uchar segmentedTile[2 * TILE_HEIGHT * SEGMENTED_TILE_STRIDE];
+
+    debayerTile(input, 0, lookup, segmented, false, block, 0, segmentedTile);
+}
+#endif
@@ -0,0 +1,118 @@
+// Run length encoding of the segmented image, same output as Blobber::segEncodeRuns.
+// A run is emitted if its color is tracked or it is the last run of the row.
+// Each row is handled by one work item: countRuns, scanRunCounts and encodeRuns are enqueued in order.
+
+typedef struct {
+    short x, y, width;
+    uchar color;
+    int parent, next;
+} BlobberRun;
+
+bool isRunEmitted(uchar color, uint trackedColors, int x, int width) {
+    return (color < 32 && ((trackedColors >> color) & 1)) || x >= width;
+}
+
+__kernel void countRuns(
+    __global uchar* segmented,
+    __global int* rowRunCounts,
+    int width,
+    uint trackedColors
+) {
+    int y = get_global_id(0);
+
+    __global uchar* row = segmented + y * width;
+    int count = 0;
+    int x = 0;
+
+    while (x < width) {
+        uchar color = row[x];
+
+        while (x < width && row[x] == color) x++;
+
+        if (isRunEmitted(color, trackedColors, x, width)) {
+            count++;
+        }
+    }
+
+    rowRunCounts[y] = count;
+}
+
+// Single work group for any row count, each work item sums a block of ceil(rowCount / groupSize) rows before the
+// local scan, so the group size only limits the parallelism.
+// rowRunOffsets[rowCount] is the total run count.
+__kernel void scanRunCounts(
+    __global int* rowRunCounts,
+    __global int* rowRunOffsets,
+    int rowCount,
+    __local int* partialSums
+) {
+    int id = get_local_id(0);
+    int groupSize = get_local_size(0);
+    int rowsPerItem = (rowCount + groupSize - 1) / groupSize;
+    int start = min(id * rowsPerItem, rowCount);
+    int end = min(start + rowsPerItem, rowCount);
+    int sum = 0;
+
+    for (int y = start; y < end; y++) {
+        sum += rowRunCounts[y];
+    }
+
+    partialSums[id] = sum;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int step = 1; step < groupSize; step <<= 1) {
+        int value = id >= step ? partialSums[id - step] : 0;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        partialSums[id] += value;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    int offset = partialSums[id] - sum;
+
+    for (int y = start; y < end; y++) {
+        rowRunOffsets[y] = offset;
+        offset += rowRunCounts[y];
+    }
+
+    if (id == groupSize - 1) {
+        rowRunOffsets[rowCount] = partialSums[id];
+    }
+}
+
+__kernel void encodeRuns(
+    __global uchar* segmented,
+    __global int* rowRunOffsets,
+    __global BlobberRun* runs,
+    int width,
+    uint trackedColors,
+    int maxRuns
+) {
+    int y = get_global_id(0);
+
+    __global uchar* row = segmented + y * width;
+    int j = rowRunOffsets[y];
+    int x = 0;
+
+    while (x < width && j < maxRuns) {
+        uchar color = row[x];
+        int start = x;
+
+        while (x < width && row[x] == color) x++;
+
+        if (isRunEmitted(color, trackedColors, x, width)) {
+            BlobberRun run;
+            run.x = start;
+            run.y = y;
+            run.width = x - start;
+            run.color = color;
+            run.parent = j;
+            run.next = 0;
+
+            runs[j++] = run;
+        }
+    }
+}
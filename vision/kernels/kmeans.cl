@@ -33,4 +33,106 @@ __kernel void kMeans(
     }
 
     output[p] = closestCentroid;
-}
\ No newline at end of file
+}
+
+// Adds the colors of every sampleStep'th pixel of every sampleStep'th row to the sums of their closest centroid,
+// sums are blue, green, red and pixel count of each centroid. Does nothing once state[0] is set.
+__kernel void kMeansAccumulate(
+    __global uchar* input,
+    __global uchar* centroids,
+    __global uint* sums,
+    __global uint* state,
+    __const int centroidCount,
+    __const int width,
+    __const int sampleStep,
+    __const int sampleColumns,
+    __const int sampleCount,
+    __local uint* localSums
+) {
+    if (state[0] != 0) {
+        return;
+    }
+
+    int i = get_global_id(0);
+    int localId = get_local_id(0);
+    int localSize = get_local_size(0);
+
+    for (int j = localId; j < centroidCount * 4; j += localSize) {
+        localSums[j] = 0;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // global size is rounded up to whole work groups
+    if (i < sampleCount) {
+        int p = ((i / sampleColumns) * width + i % sampleColumns) * sampleStep * 3;
+        int b = input[p + 0];
+        int g = input[p + 1];
+        int r = input[p + 2];
+        int minDist = 0;
+        int closestCentroid = 0;
+
+        for (int c = 0; c < centroidCount; ++c) {
+            int db = b - centroids[0 + c*3];
+            int dg = g - centroids[1 + c*3];
+            int dr = r - centroids[2 + c*3];
+            int dist = db*db + dg*dg + dr*dr;
+
+            if (c == 0 || dist < minDist) {
+                minDist = dist;
+                closestCentroid = c;
+            }
+        }
+
+        atomic_add(&localSums[closestCentroid * 4 + 0], b);
+        atomic_add(&localSums[closestCentroid * 4 + 1], g);
+        atomic_add(&localSums[closestCentroid * 4 + 2], r);
+        atomic_inc(&localSums[closestCentroid * 4 + 3]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int j = localId; j < centroidCount * 4; j += localSize) {
+        if (localSums[j] != 0) {
+            atomic_add(&sums[j], localSums[j]);
+        }
+    }
+}
+
+// Run as a single work item after kMeansAccumulate, moves the centroids to the rounded means and clears the sums.
+// state[0] is set when no centroid moved and state[1] counts the rounds.
+__kernel void kMeansUpdate(
+    __global uchar* centroids,
+    __global uint* sums,
+    __global uint* state,
+    __const int centroidCount
+) {
+    if (state[0] != 0) {
+        return;
+    }
+
+    int moved = 0;
+
+    for (int c = 0; c < centroidCount; ++c) {
+        uint count = sums[c * 4 + 3];
+
+        if (count != 0) {
+            for (int channel = 0; channel < 3; ++channel) {
+                uchar mean = (uchar)((sums[c * 4 + channel] + count / 2) / count);
+
+                moved |= mean != centroids[c * 3 + channel];
+                centroids[c * 3 + channel] = mean;
+            }
+        }
+
+        for (int j = 0; j < 4; ++j) {
+            sums[c * 4 + j] = 0;
+        }
+    }
+
+    state[1]++;
+
+    if (!moved) {
+        state[0] = 1;
+    }
+}
@@ -0,0 +1,241 @@
+// Connected component labelling of the run list, same regions as Blobber::segConnectComponents and
+// Blobber::segExtractRegions. Runs of the same tracked color on adjacent rows are connected when they overlap.
+// Labels are merged with atomic_min, so the root of a region is its first run and regions are numbered in the
+// order of their first runs like on the CPU.
+// findRowStarts, mergeRuns, flattenLabels, numberRegions and accumulateRegions are enqueued in order.
+
+typedef struct {
+    short x, y, width;
+    uchar color;
+    int parent, next;
+} BlobberRun;
+
+typedef struct {
+    int color;
+    int x1, y1, x2, y2;
+    int area;
+    int sumX, sumY;
+    int runStart;
+} Region;
+
+bool isTracked(uchar color, uint trackedColors) {
+    return color < 32 && ((trackedColors >> color) & 1);
+}
+
+int findRoot(__global volatile int* labels, int i) {
+    int parent = labels[i];
+
+    while (parent != i) {
+        i = parent;
+        parent = labels[i];
+    }
+
+    return i;
+}
+
+void unite(__global volatile int* labels, int a, int b) {
+    for (;;) {
+        a = findRoot(labels, a);
+        b = findRoot(labels, b);
+
+        if (a == b) {
+            return;
+        }
+
+        if (a > b) {
+            int swap = a;
+            a = b;
+            b = swap;
+        }
+
+        int previous = atomic_min(&labels[b], a);
+
+        // b was still a root, otherwise its previous parent has to be joined too
+        if (previous == b) {
+            return;
+        }
+
+        b = previous;
+    }
+}
+
+__kernel void findRowStarts(
+    __global BlobberRun* runs,
+    __global int* rowStarts,
+    __global int* labels,
+    int runCount
+) {
+    int i = get_global_id(0);
+
+    if (i >= runCount) {
+        return;
+    }
+
+    if (i == 0 || runs[i - 1].y != runs[i].y) {
+        rowStarts[runs[i].y] = i;
+    }
+
+    labels[i] = i;
+}
+
+// Every row has at least its last run, so the runs of the row above are between its start and the start of this row
+__kernel void mergeRuns(
+    __global BlobberRun* runs,
+    __global int* rowStarts,
+    __global volatile int* labels,
+    int runCount,
+    uint trackedColors
+) {
+    int i = get_global_id(0);
+
+    if (i >= runCount) {
+        return;
+    }
+
+    BlobberRun run = runs[i];
+
+    if (run.y == 0 || !isTracked(run.color, trackedColors)) {
+        return;
+    }
+
+    int low = rowStarts[run.y - 1];
+    int end = rowStarts[run.y];
+    int high = end;
+
+    // first run above that ends after the start of this one
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (runs[middle].x + runs[middle].width <= run.x) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (int j = low; j < end && runs[j].x < run.x + run.width; j++) {
+        if (runs[j].color == run.color) {
+            unite(labels, i, j);
+        }
+    }
+}
+
+__kernel void flattenLabels(
+    __global volatile int* labels,
+    int runCount
+) {
+    int i = get_global_id(0);
+
+    if (i < runCount) {
+        labels[i] = findRoot(labels, i);
+    }
+}
+
+// Single work group, each work item numbers the roots in a block of runs after the local scan.
+// regionCount[0] is the total region count, only maxRegions regions are written.
+__kernel void numberRegions(
+    __global BlobberRun* runs,
+    __global int* labels,
+    __global int* regionIds,
+    __global Region* regions,
+    __global int* regionCount,
+    int runCount,
+    uint trackedColors,
+    int maxRegions,
+    __local int* partialSums
+) {
+    int id = get_local_id(0);
+    int groupSize = get_local_size(0);
+    int runsPerItem = (runCount + groupSize - 1) / groupSize;
+    int start = min(id * runsPerItem, runCount);
+    int end = min(start + runsPerItem, runCount);
+    int sum = 0;
+
+    for (int i = start; i < end; i++) {
+        sum += isTracked(runs[i].color, trackedColors) && labels[i] == i;
+    }
+
+    partialSums[id] = sum;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int step = 1; step < groupSize; step <<= 1) {
+        int value = id >= step ? partialSums[id - step] : 0;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        partialSums[id] += value;
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    int regionId = partialSums[id] - sum;
+
+    for (int i = start; i < end; i++) {
+        BlobberRun run = runs[i];
+
+        if (!isTracked(run.color, trackedColors) || labels[i] != i) {
+            continue;
+        }
+
+        regionIds[i] = regionId;
+
+        if (regionId < maxRegions) {
+            Region region;
+            region.color = run.color;
+            region.x1 = run.x;
+            region.y1 = run.y;
+            region.x2 = run.x + run.width - 1;
+            region.y2 = run.y;
+            region.area = 0;
+            region.sumX = 0;
+            region.sumY = 0;
+            region.runStart = i;
+
+            regions[regionId] = region;
+        }
+
+        regionId++;
+    }
+
+    if (id == groupSize - 1) {
+        regionCount[0] = partialSums[id];
+    }
+}
+
+__kernel void accumulateRegions(
+    __global BlobberRun* runs,
+    __global int* labels,
+    __global int* regionIds,
+    __global Region* regions,
+    int runCount,
+    uint trackedColors,
+    int maxRegions
+) {
+    int i = get_global_id(0);
+
+    if (i >= runCount) {
+        return;
+    }
+
+    BlobberRun run = runs[i];
+
+    if (!isTracked(run.color, trackedColors)) {
+        return;
+    }
+
+    int regionId = regionIds[labels[i]];
+
+    if (regionId >= maxRegions) {
+        return;
+    }
+
+    __global Region* region = regions + regionId;
+
+    atomic_add(&region->area, run.width);
+    atomic_min(&region->x1, run.x);
+    atomic_max(&region->x2, run.x + run.width - 1);
+    atomic_max(&region->y2, run.y);
+    atomic_add(&region->sumX, run.width * (2 * run.x + run.width - 1) / 2);
+    atomic_add(&region->sumY, run.y * run.width);
+}
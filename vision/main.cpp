@@ -2,6 +2,7 @@
 #include <iostream>
 #include <chrono>
 #include "VisionManager.h"
+#include "ComputeBenchmark.h"
 
 /** Use to init the clock */
 #define TIMER_INIT \
@@ -21,6 +22,9 @@
 
 int main(int argc, char* argv[]) {
     bool showGui = false;
+    bool benchmark = false;
+    bool tune = false;
+    std::string benchmarkFrame;
 
     if (argc > 0) {
         std::cout << "! Parsing command line options" << std::endl;
@@ -30,6 +34,22 @@ int main(int argc, char* argv[]) {
                 showGui = true;
 
                 std::cout << "  > Showing the GUI" << std::endl;
+            } else if (strcmp(argv[i], "benchmark") == 0) {
+                benchmark = true;
+
+                if (i + 1 < argc) {
+                    benchmarkFrame = argv[++i];
+                }
+
+                std::cout << "  > Benchmarking compute backends" << std::endl;
+            } else if (strcmp(argv[i], "tune") == 0) {
+                tune = true;
+
+                if (i + 1 < argc) {
+                    benchmarkFrame = argv[++i];
+                }
+
+                std::cout << "  > Tuning compute backends" << std::endl;
             } else {
                 std::cout << "  > Unknown command line option: " << argv[i] << std::endl;
 
@@ -38,6 +58,18 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (benchmark) {
+        ComputeBenchmark::run(benchmarkFrame);
+
+        return 0;
+    }
+
+    if (tune) {
+        ComputeBenchmark::tune(benchmarkFrame);
+
+        return 0;
+    }
+
     auto* visionManager = new VisionManager();
 
     visionManager->showGui = showGui;
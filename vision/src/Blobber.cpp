@@ -3,30 +3,51 @@
 #include <cstdlib>
 #include <cmath>
 #include <iostream>
+#include <algorithm>
+#include <memory>
 #include <Blobber.h>
 #include <Util.h>
 #include <Config.h>
 #include <Maths.h>
-#include <boost/geometry.hpp>
+#include <LargeBuffers.h>
+#include <LookupFile.h>
 
 const int Blobber::COLORS_LOOKUP_SIZE = 0x1000000;
 
-Blobber::Blobber() {
+Blobber::Blobber(ComputeBackend* computeBackend) : computeBackend(computeBackend) {
 	bpp = 1;
 	width = 1280;
 	height = 1024;
+	segmentedScale = 1;
+	segmentedWidth = width;
+	segmentedHeight = height;
 	segmented = nullptr;
 	bgr = nullptr;
+	tileClasses = nullptr;
+	tileColumns = segmentedWidth / ComputeBackend::TILE_SIZE;
+	rowCounts = nullptr;
+	columnCounts = nullptr;
+
+	bgrConsumerCount = 0;
+	deviceRunEncoding = false;
+	deviceRegionLabelling = false;
 	pout = (unsigned short *) malloc(10000 * 9 * sizeof(unsigned short));
 	run_c = 0;
 	region_c = 0;
 	max_area = 0;
 
 	//https://software.intel.com/en-us/articles/getting-the-most-from-opencl-12-how-to-increase-performance-by-minimizing-buffer-copies-on-intel-processor-graphics
-	colors_lookup = (unsigned char*)_aligned_malloc((size_t) COLORS_LOOKUP_SIZE, 4096);
-	prev_colors_lookup = (unsigned char*)_aligned_malloc((size_t) COLORS_LOOKUP_SIZE, 4096);
-
-	hasLookupChanged = false;
+	colors_lookup = (unsigned char*)LargeBuffers::allocate((size_t) COLORS_LOOKUP_SIZE, "colors lookup");
+	standbyLookup = (unsigned char*)LargeBuffers::allocate((size_t) COLORS_LOOKUP_SIZE, "standby lookup");
+	standbyState = STANDBY_IDLE;
+	standbyLoader = nullptr;
+	compactLookup = (unsigned char*)_aligned_malloc((size_t) COMPACT_LOOKUP_SIZE, 4096);
+	memset(compactLookup, 0, (size_t) COMPACT_LOOKUP_SIZE);
+	lookupBits = 8;
+	compactLookupStale = true;
+
+	historyMemory = 0;
+	pendingBlockMarks.resize((size_t) LOOKUP_BLOCK_COUNT, false);
 
 	int i;
 	for (i = 0; i < COLOR_COUNT; i++) {
@@ -81,17 +102,40 @@ Blobber::Blobber() {
 
 	int size = width * width;
 
-	segmented = (unsigned char *)_aligned_malloc(size * sizeof(unsigned char), 4096);
+	segmented = (unsigned char *)LargeBuffers::allocate(size * sizeof(unsigned char), "segmented 0");
 	memset(segmented, 0, size * sizeof(unsigned char));
 
-	bgr = (unsigned char *)_aligned_malloc(size * sizeof(unsigned char) * 3, 4096);
+	bgr = (unsigned char *)LargeBuffers::allocate(size * sizeof(unsigned char) * 3, "bgr 0");
+
+	int tileCount = size / (ComputeBackend::TILE_SIZE * ComputeBackend::TILE_SIZE);
+
+	tileClasses = (unsigned int *)_aligned_malloc(tileCount * sizeof(unsigned int), 4096);
+	memset(tileClasses, 0, tileCount * sizeof(unsigned int));
 
-	//openCLCompute = new OpenCLCompute();
-	//openCLCompute->setup();
+	rowCounts = (unsigned short *)_aligned_malloc(PROJECTED_COLOR_COUNT * width * sizeof(unsigned short), 4096);
+	columnCounts = (unsigned short *)_aligned_malloc(PROJECTED_COLOR_COUNT * width * sizeof(unsigned short), 4096);
+	memset(rowCounts, 0, PROJECTED_COLOR_COUNT * width * sizeof(unsigned short));
+	memset(columnCounts, 0, PROJECTED_COLOR_COUNT * width * sizeof(unsigned short));
 
-	openCLCompute = &OpenCLCompute::getInstance();
+	segmentedSets.push_back(segmented);
+	bgrSets.push_back(bgr);
+	tileClassesSets.push_back(tileClasses);
+	rowCountsSets.push_back(rowCounts);
+	columnCountsSets.push_back(columnCounts);
+	addPreviewSet();
+	previewSet = 0;
+	pipelineDepth = 1;
+	queuedSet = -1;
+	frameBufferCount = 1;
 
-	createFillerOffsetPairs();
+	// aligned so the compute backend can write runs without copying
+	rle = (BlobberRun*)LargeBuffers::allocate(MAX_RUNS * sizeof(BlobberRun), "runs");
+	memset(rle, 0, MAX_RUNS * sizeof(BlobberRun));
+
+	regions = (BlobberRegion*)LargeBuffers::allocate(MAX_REG * sizeof(BlobberRegion), "regions");
+	memset(regions, 0, MAX_REG * sizeof(BlobberRegion));
+
+	deviceRegions = (DeviceRegion*)LargeBuffers::allocate(MAX_REG * sizeof(DeviceRegion), "device regions");
 }
 
 Blobber::~Blobber() {
@@ -100,29 +144,66 @@ Blobber::~Blobber() {
         colorBlobInfoCache = nullptr;
 	}
 
+	if (standbyLoader != nullptr) {
+		standbyLoader->join();
+		delete standbyLoader;
+	}
+
 	//exit, free resources
-    if (saveColors("colors.dat")) {
+    if (saveColors("colors.lut")) {
         std::cout << "! Colors saved" << std::endl;
     } else {
         std::cout << "! Colors not saved" << std::endl;
     }
 
-    if (segmented != nullptr) {
-		_aligned_free(segmented);
-    }
+	for (auto segmentedSet : segmentedSets) {
+		LargeBuffers::release(segmentedSet);
+	}
 
-    if (bgr != nullptr) {
-		_aligned_free(bgr);
-    }
+	for (auto bgrSet : bgrSets) {
+		LargeBuffers::release(bgrSet);
+	}
+
+	for (auto tileClassesSet : tileClassesSets) {
+		_aligned_free(tileClassesSet);
+	}
+
+	for (auto rowCountsSet : rowCountsSets) {
+		_aligned_free(rowCountsSet);
+	}
+
+	for (auto columnCountsSet : columnCountsSets) {
+		_aligned_free(columnCountsSet);
+	}
+
+	for (int i = 0; i < PREVIEW_SCALE_COUNT; i++) {
+		for (auto bgrPreviewSet : bgrPreviewSets[i]) {
+			_aligned_free(bgrPreviewSet);
+		}
+
+		for (auto classPreviewSet : classPreviewSets[i]) {
+			_aligned_free(classPreviewSet);
+		}
+	}
+
+	segmented = nullptr;
+	bgr = nullptr;
+	tileClasses = nullptr;
+	rowCounts = nullptr;
+	columnCounts = nullptr;
 
     if (pout != nullptr) {
         free(pout);
     }
 
-	_aligned_free(colors_lookup);
-	_aligned_free(prev_colors_lookup);
+	LargeBuffers::release(colors_lookup);
+	_aligned_free(compactLookup);
+	LargeBuffers::release(standbyLookup);
+	LargeBuffers::release(rle);
+	LargeBuffers::release(regions);
+	LargeBuffers::release(deviceRegions);
 
-	delete openCLCompute;
+	computeBackend = nullptr;
 }
 
 void Blobber::setColorMinArea(int color, int min_area) {
@@ -133,8 +214,90 @@ void Blobber::setColorMinArea(int color, int min_area) {
 	}
 }
 
+void Blobber::setHalfResolution(bool enabled) {
+	segmentedScale = enabled ? 2 : 1;
+	segmentedWidth = width / segmentedScale;
+	segmentedHeight = height / segmentedScale;
+	tileColumns = segmentedWidth / ComputeBackend::TILE_SIZE;
+
+	std::cout << "! Blobber segmenting at " << segmentedWidth << "x" << segmentedHeight << std::endl;
+}
+
 void Blobber::setColors(unsigned char *data) {
+	unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+	unsigned char newBlockColors[LOOKUP_BLOCK_SIZE];
+
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		readBlock(colors_lookup, block, blockColors);
+		readBlock(data, block, newBlockColors);
+
+		if (memcmp(blockColors, newBlockColors, LOOKUP_BLOCK_SIZE) != 0) {
+			journalBlock(block);
+		}
+	}
+
 	memcpy(colors_lookup, data, COLORS_LOOKUP_SIZE);
+
+	compactLookupStale = true;
+}
+
+bool Blobber::setLookupBits(int bits) {
+	if (bits != 8 && bits != 6 && bits != 5) {
+		std::cout << "- Blobber lookup can not have " << bits << " bits per channel" << std::endl;
+
+		return false;
+	}
+
+	lookupBits = bits;
+	compactLookupStale = true;
+
+	std::cout << "! Blobber lookup " << lookupBits << " bits per channel" << std::endl;
+
+	if (lookupBits < 8) {
+		updateCompactLookup(true);
+	}
+
+	return true;
+}
+
+// Frames queued earlier may still read the compact lookup
+void Blobber::updateCompactLookup(bool report) {
+	if (pipelineDepth > 1 && queuedSet != -1) {
+		computeBackend->finish(segmentedSets[queuedSet]);
+	}
+
+	int changedByColor[256];
+	int changedCount = ComputeBackend::quantizeLookup(colors_lookup, lookupBits, compactLookup, changedByColor);
+
+	compactLookupStale = false;
+
+	if (!report) {
+		return;
+	}
+
+	if (changedCount == 0) {
+		std::cout << "! Blobber " << lookupBits << " bit lookup is lossless" << std::endl;
+
+		return;
+	}
+
+	std::cout << "! Blobber " << lookupBits << " bit lookup changes " << changedCount << " of " << COLORS_LOOKUP_SIZE << " entries:";
+
+	for (int i = 0; i < 256; i++) {
+		if (changedByColor[i] == 0) {
+			continue;
+		}
+
+		if (i < COLOR_COUNT && colors[i].name != nullptr) {
+			std::cout << " " << colors[i].name;
+		} else {
+			std::cout << " color " << i;
+		}
+
+		std::cout << " " << changedByColor[i];
+	}
+
+	std::cout << std::endl;
 }
 
 void Blobber::setPixelColor(unsigned char r, unsigned char g, unsigned char b, unsigned char color) {
@@ -143,6 +306,8 @@ void Blobber::setPixelColor(unsigned char r, unsigned char g, unsigned char b, u
     unsigned char firstG = (g / blockSize) * blockSize;
     unsigned char firstB = (b / blockSize) * blockSize;
 
+    journalBlock(getLookupBlock(r, g, b));
+
     for (unsigned int ri = firstR; ri < firstR + blockSize ; ri++) {
         for (unsigned int gi = firstG; gi < firstG + blockSize; gi++) {
             for (unsigned int bi = firstB; bi < firstB + blockSize; bi++) {
@@ -151,10 +316,18 @@ void Blobber::setPixelColor(unsigned char r, unsigned char g, unsigned char b, u
         }
     }
 
-    hasLookupChanged = true;
+    compactLookupStale = true;
 }
 
 void Blobber::setPixelColorRange(ImageProcessor::RGBRange rgbRange, unsigned char color) {
+	for (unsigned int r = rgbRange.minR & ~3u; r <= rgbRange.maxR; r += 4) {
+		for (unsigned int g = rgbRange.minG & ~3u; g <= rgbRange.maxG; g += 4) {
+			for (unsigned int b = rgbRange.minB & ~3u; b <= rgbRange.maxB; b += 4) {
+				journalBlock(getLookupBlock(r, g, b));
+			}
+		}
+	}
+
 	for (unsigned int r = rgbRange.minR; r < rgbRange.maxR + 1 ; r++) {
 		for (unsigned int g = rgbRange.minG; g < rgbRange.maxG + 1; g++) {
 			for (unsigned int b = rgbRange.minB; b < rgbRange.maxB + 1; b++) {
@@ -163,135 +336,134 @@ void Blobber::setPixelColorRange(ImageProcessor::RGBRange rgbRange, unsigned cha
 		}
 	}
 
-    hasLookupChanged = true;
+    compactLookupStale = true;
 }
 
 void Blobber::setPixelClusterRange(unsigned char *centroids, int centroidIndex, int centroidCount, unsigned char color) {
-	openCLCompute->generateLookupTable(centroids, colors_lookup, centroidIndex, centroidCount, color);
-}
+	unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+	unsigned char clusterColors[LOOKUP_BLOCK_SIZE];
+	bool changed = false;
 
-void Blobber::createFillerOffsetPairs() {
-    fillerOffsetPairs.clear();
+	updateClusterPartition(centroids, centroidCount);
 
-    int maxOffset = 1;
+	memset(clusterColors, color, LOOKUP_BLOCK_SIZE);
 
-    int sideLength = maxOffset * 2 + 1;
-    int pointCount = sideLength * sideLength * sideLength;
-    char* processedLinesMap = new char[pointCount * pointCount];
-    memset(processedLinesMap, 0, pointCount * pointCount);
-    int processedLinesCount = 0;
-    int totalLineCount = pointCount * pointCount + 1; // zero point line will be duplicated
+	// blocks colored on an earlier frame of the same click are left alone
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		if (clusterPartition[block] != centroidIndex) {
+			continue;
+		}
 
-    int count = 0;
-    int point1Index = -1;
-    int point2Index = -1;
+		readBlock(colors_lookup, block, blockColors);
 
-    typedef boost::geometry::model::point<int, 3, boost::geometry::cs::cartesian> point_t;
-    typedef boost::geometry::model::segment<point_t> segment_t;
+		if (memcmp(blockColors, clusterColors, LOOKUP_BLOCK_SIZE) != 0) {
+			journalBlock(block);
+			writeBlock(colors_lookup, block, clusterColors);
+			changed = true;
+		}
+	}
 
-    point_t point(0, 0, 0);
+	if (changed) {
+		compactLookupStale = true;
+	}
+}
 
-    for (int x1 = -maxOffset; x1 <= maxOffset; x1++) {
-        for (int y1 = -maxOffset; y1 <= maxOffset; y1++) {
-            for (int z1 = -maxOffset; z1 <= maxOffset; z1++) {
-                point1Index++;
+void Blobber::updateClusterPartition(const unsigned char* centroids, int centroidCount) {
+	if (
+		partitionCentroids.size() == (size_t)(3 * centroidCount)
+		&& std::equal(partitionCentroids.begin(), partitionCentroids.end(), centroids)
+	) {
+		return;
+	}
 
-                point2Index = -1;
+	partitionCentroids.assign(centroids, centroids + 3 * centroidCount);
+	clusterPartition.resize((size_t) LOOKUP_BLOCK_COUNT);
 
-                for (int x2 = -maxOffset; x2 <= maxOffset; x2++) {
-                    for (int y2 = -maxOffset; y2 <= maxOffset; y2++) {
-                        for (int z2 = -maxOffset; z2 <= maxOffset; z2++) {
-                            point2Index++;
+	computeBackend->generateClusterPartition(centroids, centroidCount, clusterPartition.data());
+}
 
-                            if (
-                                !processedLinesMap[point1Index * pointCount + point2Index] &&
-                                !(x1 == 0 && y1 == 0 && z1 == 0) &&
-                                !(x2 == 0 && y2 == 0 && z2 == 0)
-                            ) {
-                                segment_t segment(point_t(x1, y1, z1), point_t(x2, y2, z2));
+void Blobber::fillColorGaps(unsigned char color) {
+	enum BlockState : unsigned char {
+		OTHER_COLORS,
+		OPEN,
+		FILLED
+	};
+
+	static constexpr Offset3Pair offsetPairs[] = {
+			getFillerOffsetPair(0), getFillerOffsetPair(1), getFillerOffsetPair(2), getFillerOffsetPair(3),
+			getFillerOffsetPair(4), getFillerOffsetPair(5), getFillerOffsetPair(6), getFillerOffsetPair(7),
+			getFillerOffsetPair(8), getFillerOffsetPair(9), getFillerOffsetPair(10), getFillerOffsetPair(11),
+			getFillerOffsetPair(12)
+	};
+	const int side = 64;
+
+	std::vector<unsigned char> states((size_t) LOOKUP_BLOCK_COUNT);
+	std::vector<unsigned char> fills((size_t) LOOKUP_BLOCK_COUNT);
+
+	#pragma omp parallel for
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+		int colorCount = 0;
+		bool otherColors = false;
+
+		readBlock(colors_lookup, block, blockColors);
+
+		for (unsigned char blockColor : blockColors) {
+			if (blockColor == color) {
+				colorCount++;
+			} else if (blockColor != 0) {
+				otherColors = true;
+			}
+		}
 
-                                double distance = boost::geometry::distance(point, segment);
+		states[block] = otherColors ? OTHER_COLORS : colorCount == LOOKUP_BLOCK_SIZE ? FILLED : OPEN;
+	}
 
-                                if (distance < 0.3) {
-                                    std::cout << (++count) << "; " << x1 << " " << y1 << " " << z1 << "; "
-                                        << x2 << " " << y2 << " " << z2 << "; " << distance << std::endl;
+	// blocks outside the lookup are never filled, like getLookupColor returning 0 for them
+	auto isFilled = [&states, side](int r, int g, int b) {
+		return r >= 0 && r < side && g >= 0 && g < side && b >= 0 && b < side
+			&& states[b + (g << 6) + (r << 12)] == FILLED;
+	};
+
+	#pragma omp parallel for
+	for (int r = 0; r < side; r++) {
+		for (int g = 0; g < side; g++) {
+			for (int b = 0; b < side; b++) {
+				if (states[b + (g << 6) + (r << 12)] != OPEN) {
+					continue;
+				}
 
-                                    fillerOffsetPairs.push_back(Offset3Pair{
-                                        .a = Offset3(x1, y1, z1),
-                                        .b = Offset3(x2, y2, z2)
-                                    });
-                                }
-                            }
+				for (const Offset3Pair& pair : offsetPairs) {
+					if (
+						isFilled(r + pair.a.x, g + pair.a.y, b + pair.a.z)
+						&& isFilled(r + pair.b.x, g + pair.b.y, b + pair.b.z)
+					) {
+						fills[b + (g << 6) + (r << 12)] = 1;
+						break;
+					}
+				}
+			}
+		}
+	}
 
-                            processedLinesMap[point1Index * pointCount + point2Index] = 1;
-                            processedLinesMap[point2Index * pointCount + point1Index] = 1;
-                            processedLinesCount += 2;
+	unsigned char filledColors[LOOKUP_BLOCK_SIZE];
+	int filledCount = 0;
 
-                            if (processedLinesCount >= totalLineCount) {
-                                return;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-}
+	memset(filledColors, color, LOOKUP_BLOCK_SIZE);
 
-void Blobber::fillAdjacentColorPixels(unsigned char r, unsigned char g, unsigned char b, unsigned char color) {
-    /*int offsetPairs[13][2][3] = {
-            {{-1, -1, -1}, {1, 1, 1}},
-            {{-1, -1, 0}, {1, 1, 0}},
-            {{-1, -1, 1}, {1, 1, -1}},
-            {{-1, 0, -1}, {1, 0, 1}},
-            {{-1, 0, 0}, {1, 0, 0}},
-            {{-1, 0, 1}, {1, 0, -1}},
-            {{-1, 1, -1}, {1, -1, 1}},
-            {{-1, 1, 0}, {1, -1, 0}},
-            {{-1, 1, 1}, {1, -1, -1}},
-            {{0, -1, -1}, {0, 1, 1}},
-            {{0, -1, 0}, {0, 1, 0}},
-            {{0, -1, 1}, {0, 1, -1}},
-            {{0, 0, -1}, {0, 0, 1}}
-    };*/
-
-    int maxOffset = 1;
-
-    for (int ri = Math::max<int>(-maxOffset, 0); ri <= Math::min<int>(maxOffset, 255); ri++) {
-        for (int gi = Math::max<int>(-maxOffset, 0); gi <= Math::min<int>(maxOffset, 255); gi++) {
-            for (int bi = Math::max<int>(-maxOffset, 0); bi <= Math::min<int>(maxOffset, 255); bi++) {
-                unsigned char currentColor = getLookupColor(ri, gi, bi);
-
-                if (currentColor == color) {
-                    // Already same color
-                    continue;
-                }
-
-                for (auto pair : fillerOffsetPairs) {
-                    auto offset1 = pair.a;
-                    unsigned char color1 = getLookupColor(ri + offset1.x, gi + offset1.y, bi + offset1.z);
-
-                    if (color1 != color) {
-                        continue;
-                    }
-
-                    auto offset2 = pair.b;
-                    unsigned char color2 = getLookupColor(ri + offset2.x, gi + offset2.y, bi + offset2.z);
-
-                    if (color1 != color) {
-                        continue;
-                    }
-
-                    if (color1 == color2) {
-                        setPixelColor(r, g, b, color);
-                        //std::cout << "filled " << +r << " " << +g << " " << +b << std::endl;
-                        hasLookupChanged = true;
-                        break;
-                    }
-                }
-            }
-        }
-    }
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		if (!fills[block]) {
+			continue;
+		}
+
+		journalBlock(block);
+		writeBlock(colors_lookup, block, filledColors);
+		filledCount++;
+	}
+
+	if (filledCount > 0) {
+		compactLookupStale = true;
+	}
 }
 
 unsigned char Blobber::getLookupColor(int r, int g, int b) {
@@ -302,61 +474,167 @@ unsigned char Blobber::getLookupColor(int r, int g, int b) {
     return colors_lookup[b + (g << 8) + (r << 16)];
 }
 
+void Blobber::readBlock(const unsigned char* lookup, unsigned int block, unsigned char* colorsOut) {
+	const unsigned char* first = lookup + ((block & 63) << 2) + (((block >> 6) & 63) << 10) + ((block >> 12) << 18);
+
+	// 4 rows of 4 green values for each red value, blue values of a row are adjacent
+	for (int ri = 0; ri < 4; ri++) {
+		for (int gi = 0; gi < 4; gi++) {
+			memcpy(colorsOut + ri * 16 + gi * 4, first + (gi << 8) + (ri << 16), 4);
+		}
+	}
+}
+
+void Blobber::writeBlock(unsigned char* lookup, unsigned int block, const unsigned char* colors) {
+	unsigned char* first = lookup + ((block & 63) << 2) + (((block >> 6) & 63) << 10) + ((block >> 12) << 18);
+
+	for (int ri = 0; ri < 4; ri++) {
+		for (int gi = 0; gi < 4; gi++) {
+			memcpy(first + (gi << 8) + (ri << 16), colors + ri * 16 + gi * 4, 4);
+		}
+	}
+}
+
+// Must be called before the block is written, its colors are kept until the next history entry
+void Blobber::journalBlock(unsigned int block) {
+	if (pendingBlockMarks[block]) {
+		return;
+	}
+
+	pendingBlockMarks[block] = true;
+	pendingBlocks.push_back(block);
+	pendingColors.resize(pendingColors.size() + LOOKUP_BLOCK_SIZE);
+
+	readBlock(colors_lookup, block, pendingColors.data() + pendingColors.size() - LOOKUP_BLOCK_SIZE);
+}
+
+void Blobber::applyEdit(const LookupEdit& edit, bool undo) {
+	unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+	size_t offset = 0;
+
+	for (unsigned int flaggedBlock : edit.blocks) {
+		size_t beforeSize = (flaggedBlock & UNIFORM_BEFORE) != 0 ? 1 : LOOKUP_BLOCK_SIZE;
+		size_t afterSize = (flaggedBlock & UNIFORM_AFTER) != 0 ? 1 : LOOKUP_BLOCK_SIZE;
+		const unsigned char* colors = edit.colors.data() + offset + (undo ? 0 : beforeSize);
+
+		if ((undo ? beforeSize : afterSize) == 1) {
+			memset(blockColors, colors[0], LOOKUP_BLOCK_SIZE);
+			colors = blockColors;
+		}
+
+		writeBlock(colors_lookup, flaggedBlock & (LOOKUP_BLOCK_COUNT - 1), colors);
+
+		offset += beforeSize + afterSize;
+	}
+
+	compactLookupStale = true;
+}
+
+void Blobber::clearHistory() {
+	for (unsigned int block : pendingBlocks) {
+		pendingBlockMarks[block] = false;
+	}
+
+	pendingBlocks.clear();
+	pendingColors.clear();
+	lookupHistory.clear();
+	lookupRedoHistory.clear();
+	historyMemory = 0;
+}
+
 void Blobber::undo() {
-    if (lookupChangeHistory.empty()) {
+	createHistoryEntry();
+
+    if (lookupHistory.empty()) {
         return;
     }
 
     __int64 startTime = Util::timerStart();
 
-    auto changes = lookupChangeHistory.back();
+    applyEdit(lookupHistory.back(), true);
+
+    lookupRedoHistory.push_back(std::move(lookupHistory.back()));
+    lookupHistory.pop_back();
+
+    std::cout << "! undo time: " << Util::timerEnd(startTime) << "; changed blocks:" << lookupRedoHistory.back().blocks.size() << std::endl;
+}
+
+void Blobber::redo() {
+	createHistoryEntry();
 
-    for (auto change: changes) {
-        colors_lookup[change.index] = change.prevColor;
+    if (lookupRedoHistory.empty()) {
+        return;
     }
 
-    lookupChangeHistory.pop_back();
+    __int64 startTime = Util::timerStart();
+
+    applyEdit(lookupRedoHistory.back(), false);
 
-    memcpy(prev_colors_lookup, colors_lookup, COLORS_LOOKUP_SIZE);
+    lookupHistory.push_back(std::move(lookupRedoHistory.back()));
+    lookupRedoHistory.pop_back();
 
-    std::cout << "! undo time: " << Util::timerEnd(startTime) << "; change count:" << + changes.size() << std::endl;
+    std::cout << "! redo time: " << Util::timerEnd(startTime) << "; changed blocks:" << lookupHistory.back().blocks.size() << std::endl;
 }
 
 void Blobber::createHistoryEntry() {
-    if (!hasLookupChanged) {
+    if (pendingBlocks.empty()) {
         return;
     }
 
-    hasLookupChanged = false;
-
     __int64 startTime = Util::timerStart();
 
-    std::vector<Blobber::LookupPixelChange> changes;
-
-    for (unsigned int r = 0; r < 256 ; r++) {
-        for (unsigned int g = 0; g < 256; g++) {
-            for (unsigned int b = 0; b < 256; b++) {
-                unsigned int index = b + (g << 8) + (r << 16);
-                unsigned char prev = prev_colors_lookup[index];
-                unsigned char current = colors_lookup[index];
-
-                if (prev != current) {
-                    changes.push_back(Blobber::LookupPixelChange{
-                        .index = index,
-                        .prevColor = prev,
-                        .newColor = current
-                    });
-                }
-            }
+    LookupEdit edit;
+    unsigned char after[LOOKUP_BLOCK_SIZE];
+
+    for (size_t i = 0; i < pendingBlocks.size(); i++) {
+        unsigned int block = pendingBlocks[i];
+        const unsigned char* before = pendingColors.data() + i * LOOKUP_BLOCK_SIZE;
+
+        pendingBlockMarks[block] = false;
+        readBlock(colors_lookup, block, after);
+
+        if (memcmp(before, after, LOOKUP_BLOCK_SIZE) == 0) {
+            continue;
         }
+
+        bool uniformBefore = std::all_of(before, before + LOOKUP_BLOCK_SIZE, [before](unsigned char c) { return c == before[0]; });
+        bool uniformAfter = std::all_of(after, after + LOOKUP_BLOCK_SIZE, [&after](unsigned char c) { return c == after[0]; });
+
+        edit.blocks.push_back(block | (uniformBefore ? UNIFORM_BEFORE : 0) | (uniformAfter ? UNIFORM_AFTER : 0));
+        edit.colors.insert(edit.colors.end(), before, before + (uniformBefore ? 1 : LOOKUP_BLOCK_SIZE));
+        edit.colors.insert(edit.colors.end(), after, after + (uniformAfter ? 1 : LOOKUP_BLOCK_SIZE));
+    }
+
+    pendingBlocks.clear();
+    pendingColors.clear();
+
+    if (edit.blocks.empty()) {
+        return;
+    }
+
+    // edits after an undo replace the undone ones
+    for (const auto& redoEdit : lookupRedoHistory) {
+        historyMemory -= getEditMemory(redoEdit);
+    }
+
+    lookupRedoHistory.clear();
+
+    size_t editMemory = getEditMemory(edit);
+    size_t changedBlocks = edit.blocks.size();
+
+    historyMemory += editMemory;
+    lookupHistory.push_back(std::move(edit));
+
+    while (historyMemory > HISTORY_MEMORY_BUDGET && !lookupHistory.empty()) {
+        historyMemory -= getEditMemory(lookupHistory.front());
+        lookupHistory.pop_front();
     }
 
-    if (!changes.empty()) {
-        lookupChangeHistory.push_back(changes);
-        memcpy(prev_colors_lookup, colors_lookup, COLORS_LOOKUP_SIZE);
+    if (lookupHistory.empty()) {
+        std::cout << "- Lookup edit of " << editMemory << " bytes does not fit the history, it can not be undone" << std::endl;
     }
 
-    std::cout << "! create history entry time: " << Util::timerEnd(startTime) << "; change count:" << + changes.size() << std::endl;
+    std::cout << "! create history entry time: " << Util::timerEnd(startTime) << "; changed blocks:" << changedBlocks << std::endl;
 }
 
 void Blobber::setActivePixels(unsigned char *data) {
@@ -367,60 +645,122 @@ void Blobber::setActivePixels(unsigned char *data) {
 }
 
 void Blobber::segEncodeRuns() {
+	run_c = encodeRuns(segmented, segmentedWidth, segmentedHeight, tileClasses, getTrackedColors(), rle, MAX_RUNS, runStripes);
+}
+
 // Changes the flat array version of the thresholded image into a run
 // length encoded version, which speeds up later processing since we
 // only have to look at the points where values change.
-	unsigned char m, save;
-	unsigned char *row = nullptr;
-	int x, y, j, l;
-	BlobberRun r;
-	unsigned char *map = segmented;
-	BlobberRun *rle = this->rle;
+int Blobber::encodeRunRows(
+		const unsigned char* segmented,
+		int width,
+		int firstRow,
+		int lastRow,
+		const unsigned int* tileClasses,
+		unsigned int trackedColors,
+		std::vector<BlobberRun>& runsOut,
+		int maxRuns
+) {
+	int tileColumns = width / ComputeBackend::TILE_SIZE;
+	BlobberRun run{};
+
+	runsOut.clear();
+
+	for (int y = firstRow; y < lastRow; y++) {
+		const unsigned char* row = segmented + y * width;
+		const unsigned int* tileRow = tileClasses + (y / ComputeBackend::TILE_SIZE) * tileColumns;
+
+		run.y = (short)y;
+
+		int x = 0;
+
+		while (x < width) {
+			unsigned char m = row[x];
+			// classes without a tile mask bit never match a tile
+			unsigned int single = m < 32 ? 1u << m : 0u;
+			int l = x;
+
+			for (;;) {
+				// whole tile of the run color
+				if ((x & (ComputeBackend::TILE_SIZE - 1)) == 0 && x < width && tileRow[x / ComputeBackend::TILE_SIZE] == single) {
+					x += ComputeBackend::TILE_SIZE;
+				} else if (x < width && row[x] == m) {
+					x++;
+				} else {
+					break;
+				}
+			}
 
-	int w = width;
-	int h = height;
-
-	r.next = 0;
-
-	// initialize terminator restore
-	save = map[0];
-
-	j = 0;
-	for(y = 0; y < h; y++){
-		row = &map[y * w];
-
-		// restore previous terminator and store next
-		// one in the first pixel on the next row
-		row[0] = save;
-		save = row[w];
-		row[w] = 255;
-		
-		r.y = y;
-
-		x = 0;
-		while(x < w){
-			m = row[x];
-			r.x = x;
-
-			l = x;
-			while(row[x] == m) x++;
-
-			if(colors[m].min_area < MAX_INT || x >= w ) {
-				r.color = m;
-				r.width = x - l;
-				r.parent = j;
-				rle[j++] = r;
-
-				if(j >= MAX_RUNS) {
-					row[w] = save;
-					run_c = j;
-					return;
+			// runs of untracked colors only end rows
+			if ((m < 32 && ((trackedColors >> m) & 1) != 0) || x >= width) {
+				run.x = (short)l;
+				run.color = m;
+				run.width = (short)(x - l);
+				runsOut.push_back(run);
+
+				if ((int)runsOut.size() >= maxRuns) {
+					return maxRuns;
 				}
 			}
 		}
 	}
 
-	run_c = j;
+	return (int)runsOut.size();
+}
+
+int Blobber::encodeRuns(
+		const unsigned char* segmented,
+		int width,
+		int height,
+		const unsigned int* tileClasses,
+		unsigned int trackedColors,
+		BlobberRun* runsOut,
+		int maxRuns,
+		std::vector<std::vector<BlobberRun>>& stripes
+) {
+	int stripeCount = (height + RUN_STRIPE_HEIGHT - 1) / RUN_STRIPE_HEIGHT;
+	std::vector<int> stripeOffsets((size_t)stripeCount + 1, 0);
+
+	stripes.resize((size_t)stripeCount);
+
+	// stripes are encoded apart, runs past maxRuns in a stripe would be dropped anyway
+	#pragma omp parallel for schedule(dynamic)
+	for (int stripe = 0; stripe < stripeCount; stripe++) {
+		encodeRunRows(
+				segmented, width, stripe * RUN_STRIPE_HEIGHT, std::min((stripe + 1) * RUN_STRIPE_HEIGHT, height),
+				tileClasses, trackedColors, stripes[stripe], maxRuns
+		);
+	}
+
+	for (int stripe = 0; stripe < stripeCount; stripe++) {
+		stripeOffsets[stripe + 1] = std::min(stripeOffsets[stripe] + (int)stripes[stripe].size(), maxRuns);
+	}
+
+	// each run is its own parent until runs are connected
+	#pragma omp parallel for schedule(dynamic)
+	for (int stripe = 0; stripe < stripeCount; stripe++) {
+		int offset = stripeOffsets[stripe];
+		int count = stripeOffsets[stripe + 1] - offset;
+
+		for (int i = 0; i < count; i++) {
+			runsOut[offset + i] = stripes[stripe][i];
+			runsOut[offset + i].parent = offset + i;
+		}
+	}
+
+	return stripeOffsets[stripeCount];
+}
+
+unsigned int Blobber::getTrackedColors() {
+	unsigned int trackedColors = 0;
+
+	for (int i = 0; i < COLOR_COUNT; i++) {
+		if (colors[i].min_area < MAX_INT) {
+			trackedColors |= 1u << i;
+		}
+	}
+
+	return trackedColors;
 }
 
 void Blobber::segConnectComponents() {
@@ -516,8 +856,8 @@ void Blobber::segExtractRegions() {
 				reg[b].y1 = r.y;
 				reg[b].x2 = r.x + r.width;
 				reg[b].y2 = r.y;
-				reg[b].cen_x = rangeSum(r.x,r.width);
-				reg[b].cen_y = r.y * r.width;
+				reg[b].sum_x = rangeSum(r.x,r.width);
+				reg[b].sum_y = r.y * r.width;
 				reg[b].run_start = i;
 				reg[b].iterator_id = i; // temporarily use to store last run
 				n++;
@@ -534,8 +874,8 @@ void Blobber::segExtractRegions() {
 				reg[b].x2 = max2(r.x + r.width,reg[b].x2);
 				reg[b].x1 = min2((int)r.x,reg[b].x1);
 				reg[b].y2 = r.y; // last set by lowest run
-				reg[b].cen_x += rangeSum(r.x,r.width);
-				reg[b].cen_y += r.y * r.width;
+				reg[b].sum_x += rangeSum(r.x,r.width);
+				reg[b].sum_y += r.y * r.width;
 				// set previous run to point to this one as next
 				rmap[reg[b].iterator_id].next = i;
 				reg[b].iterator_id = i;
@@ -546,8 +886,8 @@ void Blobber::segExtractRegions() {
 	// calculate centroids from stored sums
 	for(i=0; i<n; i++){
 		a = reg[i].area;
-		reg[i].cen_x = (float)reg[i].cen_x / a;
-		reg[i].cen_y = (float)reg[i].cen_y / a;
+		reg[i].cen_x = (float)reg[i].sum_x / a;
+		reg[i].cen_y = (float)reg[i].sum_y / a;
 		rmap[reg[i].iterator_id].next = 0; // -1;
 		reg[i].iterator_id = 0;
 		reg[i].x2--; // change to inclusive range
@@ -581,7 +921,8 @@ void Blobber::segSeparateRegions() {
 		c = p->color;
 		area = p->area;
 
-		if(area >= color[c].min_area){
+		// min_area is in full frame pixels
+		if(area * segmentedScale * segmentedScale >= color[c].min_area){
 			if(area > max_area) max_area = area;
 			color[c].num++;
 			p->next = color[c].list;
@@ -635,7 +976,7 @@ Blobber::BlobberRegion* Blobber::segSortRegions(BlobberRegion *list, int passes)
 void Blobber::getSegmentedRgb(unsigned char* out) {
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
-			unsigned char colorIndex = *(segmented + (y * width + x));
+			unsigned char colorIndex = *(segmented + (y / segmentedScale * segmentedWidth + x / segmentedScale));
 
 			if (colorIndex > getColorCount()) {
 				continue;
@@ -652,14 +993,274 @@ void Blobber::getSegmentedRgb(unsigned char* out) {
 	}
 }
 
+bool Blobber::getClassPreviewRgb(int scale, unsigned char* out) {
+	unsigned char* classPreview = getClassPreview(scale);
+
+	if (classPreview == nullptr) {
+		return false;
+	}
+
+	int size = getPreviewWidth(scale) * getPreviewHeight(scale);
+
+	for (int i = 0; i < size; i++) {
+		unsigned char colorIndex = classPreview[i];
+
+		if (colorIndex > getColorCount()) {
+			continue;
+		}
+
+		out[i * 3] = colors[colorIndex].b;
+		out[i * 3 + 1] = colors[colorIndex].g;
+		out[i * 3 + 2] = colors[colorIndex].r;
+	}
+
+	return true;
+}
+
+void Blobber::addBgrConsumer() {
+	if (bgrConsumerCount++ == 0) {
+		std::cout << "! Blobber producing BGR frames" << std::endl;
+	}
+}
+
+void Blobber::removeBgrConsumer() {
+	if (bgrConsumerCount > 0 && --bgrConsumerCount == 0) {
+		std::cout << "! Blobber producing only segmented frames" << std::endl;
+	}
+}
+
+int Blobber::getPreviewScaleIndex(int scale) {
+	switch (scale) {
+		case 2: return 0;
+		case 4: return 1;
+		case 8: return 2;
+		default: return -1;
+	}
+}
+
+void Blobber::addPreviewSet() {
+	for (int i = 0; i < PREVIEW_SCALE_COUNT; i++) {
+		int scale = 2 << i;
+		int size = (width / scale) * (height / scale);
+
+		auto* bgrPreviewSet = (unsigned char *)_aligned_malloc(size * sizeof(unsigned char) * 3, 4096);
+		auto* classPreviewSet = (unsigned char *)_aligned_malloc(size * sizeof(unsigned char), 4096);
+		memset(bgrPreviewSet, 0, size * sizeof(unsigned char) * 3);
+		memset(classPreviewSet, 0, size * sizeof(unsigned char));
+
+		bgrPreviewSets[i].push_back(bgrPreviewSet);
+		classPreviewSets[i].push_back(classPreviewSet);
+	}
+}
+
+bool Blobber::addPreviewConsumer(int scale) {
+	int index = getPreviewScaleIndex(scale);
+
+	if (index == -1) {
+		std::cout << "- Blobber has no 1/" << scale << " preview" << std::endl;
+
+		return false;
+	}
+
+	if (previewConsumerCounts[index]++ == 0) {
+		std::cout << "! Blobber producing 1/" << scale << " previews" << std::endl;
+	}
+
+	return true;
+}
+
+void Blobber::removePreviewConsumer(int scale) {
+	int index = getPreviewScaleIndex(scale);
+
+	if (index != -1 && previewConsumerCounts[index] > 0 && --previewConsumerCounts[index] == 0) {
+		std::cout << "! Blobber stopped 1/" << scale << " previews" << std::endl;
+	}
+}
+
+unsigned char* Blobber::getBgrPreview(int scale) {
+	int index = getPreviewScaleIndex(scale);
+
+	if (index == -1 || previewConsumerCounts[index] == 0) {
+		return nullptr;
+	}
+
+	return bgrPreviewSets[index][previewSet];
+}
+
+unsigned char* Blobber::getClassPreview(int scale) {
+	int index = getPreviewScaleIndex(scale);
+
+	if (index == -1 || previewConsumerCounts[index] == 0) {
+		return nullptr;
+	}
+
+	return classPreviewSets[index][previewSet];
+}
+
+void Blobber::setPipelineDepth(int depth) {
+	pipelineDepth = std::max(depth, 1);
+
+	int size = width * width;
+	int tileCount = size / (ComputeBackend::TILE_SIZE * ComputeBackend::TILE_SIZE);
+
+	while ((int)segmentedSets.size() < pipelineDepth) {
+		std::string setName = std::to_string(segmentedSets.size());
+		auto* segmentedSet = (unsigned char *)LargeBuffers::allocate(size * sizeof(unsigned char), "segmented " + setName);
+		memset(segmentedSet, 0, size * sizeof(unsigned char));
+
+		auto* tileClassesSet = (unsigned int *)_aligned_malloc(tileCount * sizeof(unsigned int), 4096);
+		memset(tileClassesSet, 0, tileCount * sizeof(unsigned int));
+
+		// rows fit as the height is at most the width
+		auto* rowCountsSet = (unsigned short *)_aligned_malloc(PROJECTED_COLOR_COUNT * width * sizeof(unsigned short), 4096);
+		auto* columnCountsSet = (unsigned short *)_aligned_malloc(PROJECTED_COLOR_COUNT * width * sizeof(unsigned short), 4096);
+		memset(rowCountsSet, 0, PROJECTED_COLOR_COUNT * width * sizeof(unsigned short));
+		memset(columnCountsSet, 0, PROJECTED_COLOR_COUNT * width * sizeof(unsigned short));
+
+		segmentedSets.push_back(segmentedSet);
+		bgrSets.push_back((unsigned char *)LargeBuffers::allocate(size * sizeof(unsigned char) * 3, "bgr " + setName));
+		tileClassesSets.push_back(tileClassesSet);
+		rowCountsSets.push_back(rowCountsSet);
+		columnCountsSets.push_back(columnCountsSet);
+		addPreviewSet();
+	}
+
+	std::cout << "! Blobber pipeline depth " << pipelineDepth << std::endl;
+}
+
+void Blobber::enqueueSegmentation(unsigned char *frame, int set) {
+	unsigned char* segmentedOut = segmentedSets[set];
+	unsigned char* bgrOut = hasBgrConsumers() ? bgrSets[set] : nullptr;
+	unsigned char* lookup = lookupBits < 8 ? compactLookup : colors_lookup;
+	int lookupSize = 1 << (3 * lookupBits);
+
+	if (segmentedScale == 1) {
+		computeBackend->enqueueDeBayer(frame, bgrOut, lookup, segmentedOut, width, height, lookupSize);
+	} else {
+		if (bgrOut != nullptr) {
+			// the full resolution segmented image is overwritten by segmentQuads
+			computeBackend->enqueueDeBayer(frame, bgrOut, lookup, segmentedOut, width, height, lookupSize);
+		}
+
+		computeBackend->enqueueSegmentQuads(frame, lookup, segmentedOut, width, height, lookupSize);
+	}
+
+	computeBackend->enqueueClassifyTiles(segmentedOut, segmentedWidth, segmentedHeight, tileClassesSets[set]);
+	computeBackend->enqueueProjectClasses(
+			segmentedOut, segmentedWidth, segmentedHeight, blue, PROJECTED_COLOR_COUNT, rowCountsSets[set], columnCountsSets[set]
+	);
+
+	for (int i = 0; i < PREVIEW_SCALE_COUNT; i++) {
+		if (previewConsumerCounts[i] > 0) {
+			computeBackend->enqueuePreview(
+					frame, segmentedOut, width, height, segmentedScale, 2 << i, bgrPreviewSets[i][set], classPreviewSets[i][set]
+			);
+		}
+	}
+}
+
 void Blobber::analyse(unsigned char *frame) {
 	//get new frame and find blobs
 
-	openCLCompute->deBayer(frame, bgr, colors_lookup, segmented, width, height, COLORS_LOOKUP_SIZE);
-	
-	segEncodeRuns();
-	segConnectComponents();
-	segExtractRegions();
+	// frames queued from now on use the loaded lookup, the previous one is free again once they are processed
+	if (standbyState == STANDBY_READY) {
+		activateStandbyLookup();
+	}
+
+	if (lookupBits < 8 && compactLookupStale) {
+		updateCompactLookup(false);
+	}
+
+	if (pipelineDepth == 1) {
+		segmented = segmentedSets[0];
+		bgr = bgrSets[0];
+		tileClasses = tileClassesSets[0];
+		rowCounts = rowCountsSets[0];
+		columnCounts = columnCountsSets[0];
+		previewSet = 0;
+
+		enqueueSegmentation(frame, 0);
+		computeBackend->finish(segmented);
+
+		processSegmented();
+
+		return;
+	}
+
+	// segmentation of this frame runs while the previous one is processed,
+	// so the blobs and segmented image are always one frame behind
+	int set = (queuedSet + 1) % pipelineDepth;
+	int previousSet = queuedSet;
+
+	enqueueSegmentation(frame, set);
+	queuedSet = set;
+
+	if (previousSet != -1) {
+		segmented = segmentedSets[previousSet];
+		bgr = bgrSets[previousSet];
+		tileClasses = tileClassesSets[previousSet];
+		rowCounts = rowCountsSets[previousSet];
+		columnCounts = columnCountsSets[previousSet];
+		previewSet = previousSet;
+
+		computeBackend->finish(segmented);
+
+		processSegmented();
+	}
+
+	// frame must be consumed before the camera writes the next one into the same buffer
+	if (frameBufferCount < 2) {
+		computeBackend->finish(segmentedSets[set]);
+	}
+}
+
+void Blobber::processSegmented() {
+	int runCount = -1;
+
+	// queued segmentation of the next frame would delay run encoding on the device
+	if (deviceRunEncoding && pipelineDepth == 1) {
+		runCount = computeBackend->encodeRuns(segmented, segmentedWidth, segmentedHeight, getTrackedColors(), rle, MAX_RUNS);
+	}
+
+	if (runCount >= 0) {
+		run_c = runCount;
+	} else {
+		segEncodeRuns();
+	}
+
+	int regionCount = -1;
+
+	if (deviceRegionLabelling && pipelineDepth == 1) {
+		regionCount = computeBackend->labelRegions(
+				rle, run_c, MAX_RUNS, segmentedHeight, getTrackedColors(), deviceRegions, MAX_REG
+		);
+	}
+
+	if (regionCount >= 0) {
+		for (int i = 0; i < regionCount; i++) {
+			DeviceRegion& deviceRegion = deviceRegions[i];
+			BlobberRegion& region = regions[i];
+
+			region.color = deviceRegion.color;
+			region.x1 = deviceRegion.x1;
+			region.y1 = deviceRegion.y1;
+			region.x2 = deviceRegion.x2;
+			region.y2 = deviceRegion.y2;
+			region.area = deviceRegion.area;
+			region.sum_x = deviceRegion.sumX;
+			region.sum_y = deviceRegion.sumY;
+			region.cen_x = (float)deviceRegion.sumX / deviceRegion.area;
+			region.cen_y = (float)deviceRegion.sumY / deviceRegion.area;
+			region.run_start = deviceRegion.runStart;
+			region.iterator_id = 0;
+		}
+
+		region_c = regionCount;
+	} else {
+		segConnectComponents();
+		segExtractRegions();
+	}
+
 	segSeparateRegions();
 
 	// do minimal number of passes sufficient to touch all set bits
@@ -689,6 +1290,7 @@ Blobber::BlobInfo* Blobber::getBlobs(BlobColor colorIndex) {
 	//int n = 0;
 	int w = width;
 	//int xy;
+	int scale = segmentedScale;
 	unsigned short cen_x, cen_y;
 	//unsigned short *pout = (unsigned short *) malloc(rows * cols * sizeof(unsigned short));
     Blob* blobs = new Blob[rows];
@@ -702,17 +1304,19 @@ Blobber::BlobInfo* Blobber::getBlobs(BlobColor colorIndex) {
 	}*/
 
 	while (list != nullptr) {
-        cen_x = (unsigned short)round(list->cen_x);
-		cen_y = (unsigned short)round(list->cen_y);
+		// scale back to full frame pixels, quad centers are between the pixels
+        cen_x = (unsigned short)round(list->cen_x * scale + (scale - 1) * 0.5f);
+		cen_y = (unsigned short)round(list->cen_y * scale + (scale - 1) * 0.5f);
 		//xy = cen_y * w + cen_x;
 
-        blobs[i].area = (unsigned short)min2(65535 , list->area);
+        blobs[i].area = (unsigned short)min2(65535 , list->area * scale * scale);
         blobs[i].centerX = cen_x;
         blobs[i].centerY = cen_y;
-        blobs[i].x1 = (unsigned short)list->x1;
-        blobs[i].x2 = (unsigned short)list->x2;
-        blobs[i].y1 = (unsigned short)list->y1;
-        blobs[i].y2 = (unsigned short)list->y2;
+        // x2 and y2 are inclusive, the last quad covers scale pixels
+        blobs[i].x1 = (unsigned short)(list->x1 * scale);
+        blobs[i].x2 = (unsigned short)(list->x2 * scale + scale - 1);
+        blobs[i].y1 = (unsigned short)(list->y1 * scale);
+        blobs[i].y2 = (unsigned short)(list->y2 * scale + scale - 1);
 
         list = list->next;
         i++;
@@ -724,15 +1328,17 @@ Blobber::BlobInfo* Blobber::getBlobs(BlobColor colorIndex) {
 }
 
 bool Blobber::saveColors(const std::string& filename) {
-    FILE* file = fopen(filename.c_str(), "wb");
+    std::vector<LookupFile::ClassInfo> classes;
 
-    if (!file) {
-        return false;
+    for (auto& color : colors) {
+        if (color.name != nullptr) {
+            classes.push_back({color.name, color.color, color.r, color.g, color.b});
+        }
     }
 
-    fwrite(colors_lookup, sizeof(char), COLORS_LOOKUP_SIZE, file);
-
-    fclose(file);
+    if (!LookupFile::save(filename, colors_lookup, classes)) {
+        return false;
+    }
 
     std::cout << "! Colors lookup saved" << std::endl;
 
@@ -740,27 +1346,99 @@ bool Blobber::saveColors(const std::string& filename) {
 }
 
 bool Blobber::loadColors(const std::string& filename) {
-    FILE* file = fopen(filename.c_str(), "rb");
+    std::vector<LookupFile::ClassInfo> classes;
 
-    if (!file) {
+    if (!LookupFile::load(filename, colors_lookup, &classes)) {
         return false;
     }
 
-    // obtain file size:
-    fseek(file, 0, SEEK_END);
-    long fileSize = ftell (file);
-    rewind(file);
+    clearHistory();
+    compactLookupStale = true;
 
-    if (fileSize != COLORS_LOOKUP_SIZE) {
-        return false;
+    for (const auto& info : classes) {
+        const char* name = info.color < COLOR_COUNT ? colors[info.color].name : nullptr;
+
+        if (name == nullptr || info.name != name) {
+            std::cout << "- Colors lookup class " << +info.color << " is " << info.name << " in " << filename
+                << " but " << (name != nullptr ? name : "unused") << " here" << std::endl;
+        }
     }
 
-    fread(colors_lookup, sizeof(char), COLORS_LOOKUP_SIZE, file);
-    memcpy(prev_colors_lookup, colors_lookup, COLORS_LOOKUP_SIZE);
+    return true;
+}
+
+bool Blobber::loadStandbyColors(const std::string& filename) {
+	return startStandbyLoader([this, filename]() {
+		return LookupFile::load(filename, standbyLookup, nullptr);
+	}, filename);
+}
 
-    fclose(file);
+bool Blobber::loadStandbyColors(std::vector<unsigned char> data) {
+	auto sharedData = std::make_shared<std::vector<unsigned char>>(std::move(data));
 
-    return true;
+	return startStandbyLoader([this, sharedData]() {
+		return LookupFile::decode(sharedData->data(), sharedData->size(), standbyLookup, nullptr);
+	}, "received colors lookup");
+}
+
+bool Blobber::startStandbyLoader(std::function<bool()> load, const std::string& name) {
+	if (standbyState != STANDBY_IDLE) {
+		std::cout << "- Blobber is still loading a colors lookup, " << name << " is ignored" << std::endl;
+
+		return false;
+	}
+
+	if (standbyLoader != nullptr) {
+		standbyLoader->join();
+		delete standbyLoader;
+	}
+
+	// no queued frame reads the standby buffer anymore, dropping its device buffer makes the compute backend create
+	// a new one with the loaded colors when it is swapped in
+	computeBackend->releaseBuffer(standbyLookup);
+
+	standbyState = STANDBY_LOADING;
+	standbyLoader = new std::thread([this, load, name]() {
+		if (load()) {
+			std::cout << "! Blobber loaded " << name << ", it is used from the next frame" << std::endl;
+
+			standbyState = STANDBY_READY;
+		} else {
+			std::cout << "- Blobber could not load " << name << std::endl;
+
+			standbyState = STANDBY_IDLE;
+		}
+	});
+
+	return true;
+}
+
+// Frames queued before the swap still read the previous lookup, they are finished before analyse returns
+void Blobber::activateStandbyLookup() {
+	unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+	unsigned char standbyBlockColors[LOOKUP_BLOCK_SIZE];
+
+	standbyLoader->join();
+	delete standbyLoader;
+	standbyLoader = nullptr;
+
+	// the swap is undone on its own, apart from the edits made before it
+	createHistoryEntry();
+
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		readBlock(colors_lookup, block, blockColors);
+		readBlock(standbyLookup, block, standbyBlockColors);
+
+		if (memcmp(blockColors, standbyBlockColors, LOOKUP_BLOCK_SIZE) != 0) {
+			journalBlock(block);
+		}
+	}
+
+	std::swap(colors_lookup, standbyLookup);
+	compactLookupStale = true;
+	standbyState = STANDBY_IDLE;
+
+	createHistoryEntry();
 }
 
 int Blobber::getColorCount() {
@@ -786,24 +1464,94 @@ Blobber::BlobColor Blobber::getColorAt(int x, int y) {
         return Blobber::BlobColor::unknown;
     }
 
-    unsigned char colorIndex = *(segmented + (Config::cameraWidth * y + x));
+    unsigned char colorIndex = *(segmented + (segmentedWidth * (y / segmentedScale) + x / segmentedScale));
     return Blobber::BlobColor(colorIndex);
 }
 
+unsigned int Blobber::getTileClasses(int x, int y) {
+	if (x < 0 || y < 0 || x >= Config::cameraWidth || y >= Config::cameraHeight) {
+		return 0;
+	}
+
+	int tileSize = getTileSize();
+
+	return tileClasses[(y / tileSize) * tileColumns + x / tileSize];
+}
+
+int Blobber::getRowColorCount(BlobColor color, int y) {
+	return getRowsColorCount(color, y, y);
+}
+
+int Blobber::getColumnColorCount(BlobColor color, int x) {
+	return getColumnsColorCount(color, x, x);
+}
+
+int Blobber::getRowsColorCount(BlobColor color, int y1, int y2) {
+	if (!isProjectedColor(color)) {
+		return -1;
+	}
+
+	unsigned short* counts = rowCounts + (color - blue) * segmentedHeight;
+	int first = std::max(std::min(y1, y2), 0) / segmentedScale;
+	int last = std::min(std::max(y1, y2) / segmentedScale, segmentedHeight - 1);
+	int sum = 0;
+
+	for (int y = first; y <= last; y++) {
+		sum += counts[y];
+	}
+
+	return sum;
+}
+
+int Blobber::getColumnsColorCount(BlobColor color, int x1, int x2) {
+	if (!isProjectedColor(color)) {
+		return -1;
+	}
+
+	unsigned short* counts = columnCounts + (color - blue) * segmentedWidth;
+	int first = std::max(std::min(x1, x2), 0) / segmentedScale;
+	int last = std::min(std::max(x1, x2) / segmentedScale, segmentedWidth - 1);
+	int sum = 0;
+
+	for (int x = first; x <= last; x++) {
+		sum += counts[x];
+	}
+
+	return sum;
+}
+
 void Blobber::clearColors() {
+	unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		readBlock(colors_lookup, block, blockColors);
+
+		if (std::any_of(blockColors, blockColors + LOOKUP_BLOCK_SIZE, [](unsigned char c) { return c != 0; })) {
+			journalBlock(block);
+		}
+	}
+
 	memset(colors_lookup, 0, COLORS_LOOKUP_SIZE);
 
-    hasLookupChanged = true;
+    compactLookupStale = true;
 }
 
 void Blobber::clearColor(unsigned char colorIndex) {
-    for (int i = 0; i < COLORS_LOOKUP_SIZE; i++) {
-        if (colors_lookup[i] == colorIndex) {
-			colors_lookup[i] = 0;
-        }
-    }
+	unsigned char blockColors[LOOKUP_BLOCK_SIZE];
+
+	for (unsigned int block = 0; block < LOOKUP_BLOCK_COUNT; block++) {
+		readBlock(colors_lookup, block, blockColors);
+
+		if (std::find(blockColors, blockColors + LOOKUP_BLOCK_SIZE, colorIndex) == blockColors + LOOKUP_BLOCK_SIZE) {
+			continue;
+		}
 
-    hasLookupChanged = true;
+		journalBlock(block);
+		std::replace(blockColors, blockColors + LOOKUP_BLOCK_SIZE, colorIndex, (unsigned char)0);
+		writeBlock(colors_lookup, block, blockColors);
+	}
+
+    compactLookupStale = true;
 }
 
 void Blobber::clearColor(std::string colorName) {
@@ -813,12 +1561,6 @@ void Blobber::clearColor(std::string colorName) {
         return;
     }
 
-	for (int i = 0; i < COLORS_LOOKUP_SIZE; i++) {
-		if (colors_lookup[i] == color->color) {
-			colors_lookup[i] = 0;
-		}
-	}
-
-    hasLookupChanged = true;
+    clearColor(color->color);
 }
 
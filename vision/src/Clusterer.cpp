@@ -2,56 +2,69 @@
 // Created by Gutnar on 08/08/2018.
 //
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 #include "Clusterer.h"
 #include "Config.h"
+#include "LargeBuffers.h"
 
-Clusterer::Clusterer() {
-    openCLCompute = &OpenCLCompute::getInstance();
+Clusterer::Clusterer(ComputeBackend* computeBackend) : computeBackend(computeBackend) {
+    int size = Config::cameraWidth * Config::cameraHeight;
 
-    clustered = (unsigned char *)_aligned_malloc(Config::cameraWidth * Config::cameraHeight * sizeof(unsigned char), 4096);
+    clustered = (unsigned char *)LargeBuffers::allocate(size * sizeof(unsigned char), "clustered");
+    queuedClustered = (unsigned char *)LargeBuffers::allocate(size * sizeof(unsigned char), "queued clustered");
+    queuedFrame = (unsigned char *)LargeBuffers::allocate(3 * size * sizeof(unsigned char), "queued clustering frame");
+    memset(clustered, 0, size * sizeof(unsigned char));
+    queued = false;
+    centroids = nullptr;
+    queuedCentroids = nullptr;
 
     setCentroidCount(20);
 }
 
 Clusterer::~Clusterer() {
-    openCLCompute = nullptr;
+    computeBackend->finishCalibration();
+    computeBackend->releaseBuffer(clustered);
+    computeBackend->releaseBuffer(queuedClustered);
+    computeBackend->releaseBuffer(queuedFrame);
+    LargeBuffers::release(clustered);
+    LargeBuffers::release(queuedClustered);
+    LargeBuffers::release(queuedFrame);
+    _aligned_free(centroids);
+    _aligned_free(queuedCentroids);
+
+    computeBackend = nullptr;
     clustered = nullptr;
     centroids = nullptr;
 }
 
+// kMeans runs in the background on a copy of the frame, clustered and centroids are updated once it is done
 void Clusterer::processFrame(unsigned char *bgr) {
-    openCLCompute->kMeans(bgr, clustered, centroids, centroidCount, Config::cameraWidth, Config::cameraHeight);
-
-    // Calculate new centroids
-    int b[centroidCount] = {0};
-    int g[centroidCount] = {0};
-    int r[centroidCount] = {0};
-    int n[centroidCount] = {0};
+    if (queued) {
+        if (!computeBackend->isCalibrationDone()) {
+            return;
+        }
 
-    int size = 1280 * 1024;
-    for (int p = 0; p < size; ++p) {
-        int cluster = *(clustered + p);
-        b[cluster] += *(bgr + p*3 + 0);
-        g[cluster] += *(bgr + p*3 + 1);
-        r[cluster] += *(bgr + p*3 + 2);
-        n[cluster] += 1;
+        std::swap(clustered, queuedClustered);
+        memcpy(centroids, queuedCentroids, 3 * centroidCount * sizeof(unsigned char));
+        queued = false;
     }
 
-    for (int cluster = 0; cluster < centroidCount; ++cluster) {
-        if (n[cluster] == 0) {
-            continue;
-        }
+    memcpy(queuedFrame, bgr, 3 * Config::cameraWidth * Config::cameraHeight * sizeof(unsigned char));
+    memcpy(queuedCentroids, centroids, 3 * centroidCount * sizeof(unsigned char));
 
-        *(centroids + cluster*3 + 0) = b[cluster] / n[cluster];
-        *(centroids + cluster*3 + 1) = g[cluster] / n[cluster];
-        *(centroids + cluster*3 + 2) = r[cluster] / n[cluster];
-    }
+    computeBackend->enqueueKMeansIterations(
+            queuedFrame, queuedClustered, queuedCentroids, centroidCount,
+            Config::cameraWidth, Config::cameraHeight, SAMPLE_STEP, MAX_ITERATIONS
+    );
+    queued = true;
 }
 
 // Get clustered image
 void Clusterer::getSegmentedRgb(unsigned char* out) {
-    int size = 1280 * 1024;
+    int size = Config::cameraWidth * Config::cameraHeight;
 
+    #pragma omp parallel for
     for (int p = 0; p < size; ++p) {
         int cluster = *(clustered + p);
 
@@ -76,10 +89,22 @@ int Clusterer::getCentroidIndexAt(int x, int y) {
 }
 
 void Clusterer::setCentroidCount(int newCentroidCount) {
-    centroidCount = newCentroidCount;
+    // queued result and the current one are for the old centroids
+    if (queued) {
+        computeBackend->finishCalibration();
+        queued = false;
+    }
+
+    memset(clustered, 0, Config::cameraWidth * Config::cameraHeight * sizeof(unsigned char));
+    _aligned_free(centroids);
+    _aligned_free(queuedCentroids);
+
+    // clustered has a byte per pixel
+    centroidCount = std::min(newCentroidCount, (int) ComputeBackend::MAX_KMEANS_CENTROIDS);
 
     // Generate initial random centroids
     centroids = (unsigned char *)_aligned_malloc(3 * centroidCount * sizeof(unsigned char), 4096);
+    queuedCentroids = (unsigned char *)_aligned_malloc(3 * centroidCount * sizeof(unsigned char), 4096);
 
     for (int i = 0; i < 3 * centroidCount; ++i) {
         *(centroids + i) = rand() % 256;
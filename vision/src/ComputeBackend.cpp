@@ -0,0 +1,477 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include "ComputeBackend.h"
+#include "OpenCLCompute.h"
+#include "CpuCompute.h"
+#include "NullCompute.h"
+
+ComputeBackend* ComputeBackend::create(const std::string& spec) {
+	std::vector<std::string> parts;
+	std::stringstream stream(spec);
+	std::string part;
+
+	while (std::getline(stream, part, ':')) {
+		parts.push_back(part);
+	}
+
+	if (parts.empty()) {
+		return nullptr;
+	}
+
+	if (parts[0] == "opencl") {
+		std::string platformName = parts.size() > 1 ? parts[1] : "";
+		cl_device_type deviceType = CL_DEVICE_TYPE_ALL;
+
+		if (parts.size() > 2 && parts[2] == "gpu") {
+			deviceType = CL_DEVICE_TYPE_GPU;
+		} else if (parts.size() > 2 && parts[2] == "cpu") {
+			deviceType = CL_DEVICE_TYPE_CPU;
+		}
+
+		return new OpenCLCompute(platformName, deviceType);
+	} else if (parts[0] == "cpu") {
+		return new CpuCompute();
+	} else if (parts[0] == "null") {
+		return new NullCompute();
+	}
+
+	std::cout << "- Unknown compute backend: " << spec << std::endl;
+
+	return nullptr;
+}
+
+ComputeBackend* ComputeBackend::createFirstAvailable(const std::vector<std::string>& specs) {
+	for (const auto& spec : specs) {
+		std::cout << "! Trying compute backend " << spec << std::endl;
+
+		ComputeBackend* backend = create(spec);
+
+		if (backend == nullptr) {
+			continue;
+		}
+
+		if (backend->setup()) {
+			std::cout << "! Using compute backend " << backend->getName() << std::endl;
+
+			return backend;
+		}
+
+		std::cout << "- Compute backend " << spec << " is not available" << std::endl;
+
+		delete backend;
+	}
+
+	return nullptr;
+}
+
+std::vector<std::string> ComputeBackend::getAvailableSpecs() {
+	std::vector<std::string> specs = OpenCLCompute::getAvailableSpecs();
+
+	specs.emplace_back("cpu");
+	specs.emplace_back("null");
+
+	return specs;
+}
+
+int ComputeBackend::getLookupBits(int colorsLookupSize) {
+	int bits = 0;
+
+	while (1 << (3 * (bits + 1)) <= colorsLookupSize && bits < 8) {
+		bits++;
+	}
+
+	return bits;
+}
+
+int ComputeBackend::quantizeLookup(const unsigned char* lookup, int bits, unsigned char* compactOut, int* changedByColor) {
+	int shift = 8 - bits;
+	int side = 1 << bits;
+	int blockSide = 1 << shift;
+	int changedCount = 0;
+
+	if (changedByColor != nullptr) {
+		memset(changedByColor, 0, 256 * sizeof(int));
+	}
+
+	#pragma omp parallel
+	{
+		std::vector<int> counts(256, 0);
+		std::vector<int> changed(256, 0);
+
+		#pragma omp for reduction(+:changedCount)
+		for (int r = 0; r < side; r++) {
+			for (int g = 0; g < side; g++) {
+				for (int b = 0; b < side; b++) {
+					int mostCommon = 0;
+
+					for (int ri = r << shift; ri < (r + 1) << shift; ri++) {
+						for (int gi = g << shift; gi < (g + 1) << shift; gi++) {
+							const unsigned char* entries = lookup + (b << shift) + (gi << 8) + (ri << 16);
+
+							for (int bi = 0; bi < blockSide; bi++) {
+								int count = ++counts[entries[bi]];
+
+								if (count > counts[mostCommon] || (count == counts[mostCommon] && entries[bi] < mostCommon)) {
+									mostCommon = entries[bi];
+								}
+							}
+						}
+					}
+
+					compactOut[b + (g << bits) + (r << (2 * bits))] = (unsigned char)mostCommon;
+
+					// only the counted colors are reset
+					for (int ri = r << shift; ri < (r + 1) << shift; ri++) {
+						for (int gi = g << shift; gi < (g + 1) << shift; gi++) {
+							const unsigned char* entries = lookup + (b << shift) + (gi << 8) + (ri << 16);
+
+							for (int bi = 0; bi < blockSide; bi++) {
+								if (entries[bi] != mostCommon) {
+									changed[entries[bi]]++;
+									changedCount++;
+								}
+
+								counts[entries[bi]] = 0;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		if (changedByColor != nullptr) {
+			#pragma omp critical
+			for (int c = 0; c < 256; c++) {
+				changedByColor[c] += changed[c];
+			}
+		}
+	}
+
+	return changedCount;
+}
+
+void ComputeBackend::enqueueClassifyTiles(unsigned char* segmented, int width, int height, unsigned int* tileClassesOut) {
+	int tileColumns = width / TILE_SIZE;
+	int tileRows = height / TILE_SIZE;
+
+	#pragma omp parallel for
+	for (int tileY = 0; tileY < tileRows; tileY++) {
+		for (int tileX = 0; tileX < tileColumns; tileX++) {
+			unsigned int classes = 0;
+
+			for (int y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; y++) {
+				unsigned char* row = segmented + y * width + tileX * TILE_SIZE;
+
+				for (int x = 0; x < TILE_SIZE; x++) {
+					classes |= row[x] < 32 ? 1u << row[x] : ~0u;
+				}
+			}
+
+			tileClassesOut[tileY * tileColumns + tileX] = classes;
+		}
+	}
+}
+
+void ComputeBackend::enqueueProjectClasses(
+		unsigned char* segmented,
+		int width,
+		int height,
+		int firstClass,
+		int classCount,
+		unsigned short* rowCountsOut,
+		unsigned short* columnCountsOut
+) {
+	const int stripeWidth = 64;
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++) {
+		unsigned short counts[MAX_PROJECTED_CLASSES] = {};
+		unsigned char* row = segmented + y * width;
+
+		for (int x = 0; x < width; x++) {
+			auto c = (unsigned int)(row[x] - firstClass);
+
+			if (c < (unsigned int)classCount) {
+				counts[c]++;
+			}
+		}
+
+		for (int c = 0; c < classCount; c++) {
+			rowCountsOut[c * height + y] = counts[c];
+		}
+	}
+
+	// column stripes keep reading whole cache lines
+	#pragma omp parallel for
+	for (int stripeX = 0; stripeX < width; stripeX += stripeWidth) {
+		int stripeEnd = std::min(stripeX + stripeWidth, width);
+
+		for (int c = 0; c < classCount; c++) {
+			memset(columnCountsOut + c * width + stripeX, 0, (stripeEnd - stripeX) * sizeof(unsigned short));
+		}
+
+		for (int y = 0; y < height; y++) {
+			unsigned char* row = segmented + y * width;
+
+			for (int x = stripeX; x < stripeEnd; x++) {
+				auto c = (unsigned int)(row[x] - firstClass);
+
+				if (c < (unsigned int)classCount) {
+					columnCountsOut[c * width + x]++;
+				}
+			}
+		}
+	}
+}
+
+void ComputeBackend::enqueuePreview(
+		unsigned char* frame,
+		unsigned char* segmented,
+		int width,
+		int height,
+		int segmentedScale,
+		int scale,
+		unsigned char* bgrOut,
+		unsigned char* classesOut
+) {
+	int previewWidth = width / scale;
+	int previewHeight = height / scale;
+	int segmentedWidth = width / segmentedScale;
+	// samples of each color in a block, green has twice as many
+	int samples = scale * scale / 4;
+
+	// RGGB like the CPU debayer
+	#pragma omp parallel for
+	for (int y = 0; y < previewHeight; y++) {
+		for (int x = 0; x < previewWidth; x++) {
+			int red = 0;
+			int green = 0;
+			int blue = 0;
+
+			for (int by = 0; by < scale; by += 2) {
+				unsigned char* row0 = frame + (y * scale + by) * width + x * scale;
+				unsigned char* row1 = row0 + width;
+
+				for (int bx = 0; bx < scale; bx += 2) {
+					red += row0[bx];
+					green += row0[bx + 1] + row1[bx];
+					blue += row1[bx + 1];
+				}
+			}
+
+			unsigned char* pixel = bgrOut + (y * previewWidth + x) * 3;
+
+			pixel[0] = (unsigned char)((blue + samples / 2) / samples);
+			pixel[1] = (unsigned char)((green + samples) / (2 * samples));
+			pixel[2] = (unsigned char)((red + samples / 2) / samples);
+
+			int centerX = (x * scale + scale / 2) / segmentedScale;
+			int centerY = (y * scale + scale / 2) / segmentedScale;
+
+			classesOut[y * previewWidth + x] = segmented[centerY * segmentedWidth + centerX];
+		}
+	}
+}
+
+void ComputeBackend::enqueueKMeansIterations(
+		unsigned char* bgr,
+		unsigned char* clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height,
+		int sampleStep,
+		int maxIterations
+) {
+	int sampleColumns = (width + sampleStep - 1) / sampleStep;
+	int sampleRows = (height + sampleStep - 1) / sampleStep;
+	// blue, green and red sums and the pixel count of each centroid
+	std::vector<int> sums(4 * centroidCount);
+
+	for (int iteration = 0; iteration < maxIterations; iteration++) {
+		std::fill(sums.begin(), sums.end(), 0);
+
+		#pragma omp parallel
+		{
+			std::vector<int> threadSums(4 * centroidCount, 0);
+
+			#pragma omp for
+			for (int sampleY = 0; sampleY < sampleRows; sampleY++) {
+				const unsigned char* row = bgr + sampleY * sampleStep * width * 3;
+
+				for (int sampleX = 0; sampleX < sampleColumns; sampleX++) {
+					const unsigned char* pixel = row + sampleX * sampleStep * 3;
+					int minDistance = 0;
+					int closestCentroid = 0;
+
+					for (int c = 0; c < centroidCount; c++) {
+						int db = pixel[0] - centroids[c * 3];
+						int dg = pixel[1] - centroids[c * 3 + 1];
+						int dr = pixel[2] - centroids[c * 3 + 2];
+						int distance = db * db + dg * dg + dr * dr;
+
+						if (c == 0 || distance < minDistance) {
+							minDistance = distance;
+							closestCentroid = c;
+						}
+					}
+
+					int* centroidSums = threadSums.data() + closestCentroid * 4;
+
+					centroidSums[0] += pixel[0];
+					centroidSums[1] += pixel[1];
+					centroidSums[2] += pixel[2];
+					centroidSums[3]++;
+				}
+			}
+
+			#pragma omp critical
+			for (int i = 0; i < 4 * centroidCount; i++) {
+				sums[i] += threadSums[i];
+			}
+		}
+
+		bool moved = false;
+
+		for (int c = 0; c < centroidCount; c++) {
+			int count = sums[c * 4 + 3];
+
+			if (count == 0) {
+				continue;
+			}
+
+			for (int channel = 0; channel < 3; channel++) {
+				auto mean = (unsigned char)((sums[c * 4 + channel] + count / 2) / count);
+
+				moved = moved || mean != centroids[c * 3 + channel];
+				centroids[c * 3 + channel] = mean;
+			}
+		}
+
+		if (!moved) {
+			break;
+		}
+	}
+
+	kMeans(bgr, clustered, centroids, centroidCount, width, height);
+}
+
+void ComputeBackend::generateClusterPartition(
+		const unsigned char* centroids,
+		int centroidCount,
+		unsigned short* partitionOut
+) {
+	const int side = 64;
+
+	#pragma omp parallel for
+	for (int r = 0; r < side; r++) {
+		for (int g = 0; g < side; g++) {
+			for (int b = 0; b < side; b++) {
+				// block centers are between entries, distances are in half entries to stay in integers
+				int centerB = 8 * b + 3;
+				int centerG = 8 * g + 3;
+				int centerR = 8 * r + 3;
+				int minDistance = 0;
+				int closestCentroid = 0;
+
+				for (int c = 0; c < centroidCount; c++) {
+					int db = centerB - 2 * centroids[c * 3];
+					int dg = centerG - 2 * centroids[c * 3 + 1];
+					int dr = centerR - 2 * centroids[c * 3 + 2];
+					int distance = db * db + dg * dg + dr * dr;
+
+					if (c == 0 || distance < minDistance) {
+						minDistance = distance;
+						closestCentroid = c;
+					}
+				}
+
+				partitionOut[b + (g << 6) + (r << 12)] = (unsigned short)closestCentroid;
+			}
+		}
+	}
+}
+
+int ComputeBackend::labelRegions(
+		Run* runs,
+		int runCount,
+		int maxRuns,
+		int height,
+		unsigned int trackedColors,
+		Region* regionsOut,
+		int maxRegions
+) {
+	std::vector<int> labels(runCount);
+	std::vector<int> rowStarts(height + 1, runCount);
+
+	auto isTracked = [trackedColors](unsigned char color) {
+		return color < 32 && ((trackedColors >> color) & 1);
+	};
+
+	auto findRoot = [&labels](int i) {
+		while (labels[i] != i) i = labels[i];
+
+		return i;
+	};
+
+	for (int i = runCount - 1; i >= 0; i--) {
+		rowStarts[runs[i].y] = i;
+		labels[i] = i;
+	}
+
+	// join with the overlapping runs of the row above, smaller index stays the root
+	for (int i = 0; i < runCount; i++) {
+		Run& run = runs[i];
+
+		if (run.y == 0 || !isTracked(run.color)) {
+			continue;
+		}
+
+		for (int j = rowStarts[run.y - 1]; j < rowStarts[run.y] && runs[j].x < run.x + run.width; j++) {
+			if (runs[j].x + runs[j].width <= run.x || runs[j].color != run.color) {
+				continue;
+			}
+
+			int a = findRoot(i);
+			int b = findRoot(j);
+
+			labels[std::max(a, b)] = std::min(a, b);
+		}
+	}
+
+	std::vector<int> regionIds(runCount);
+	int regionCount = 0;
+
+	for (int i = 0; i < runCount; i++) {
+		Run& run = runs[i];
+
+		if (!isTracked(run.color)) {
+			continue;
+		}
+
+		int root = findRoot(i);
+		labels[i] = root;
+
+		if (root == i) {
+			if (regionCount >= maxRegions - 1) {
+				return -1;
+			}
+
+			regionIds[i] = regionCount;
+			regionsOut[regionCount++] = {run.color, run.x, run.y, run.x + run.width - 1, run.y, 0, 0, 0, i};
+		}
+
+		Region& region = regionsOut[regionIds[root]];
+
+		region.area += run.width;
+		region.x1 = std::min(region.x1, (int)run.x);
+		region.x2 = std::max(region.x2, run.x + run.width - 1);
+		region.y2 = std::max(region.y2, (int)run.y);
+		region.sumX += run.width * (2 * run.x + run.width - 1) / 2;
+		region.sumY += run.y * run.width;
+	}
+
+	return regionCount;
+}
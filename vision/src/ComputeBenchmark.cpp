@@ -0,0 +1,512 @@
+#include "ComputeBenchmark.h"
+#include "ComputeBackend.h"
+#include "CpuCompute.h"
+#include "OpenCLCompute.h"
+#include "Config.h"
+#include "Util.h"
+#include "LookupFile.h"
+#include "Clusterer.h"
+#include "Blobber.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <omp.h>
+
+bool ComputeBenchmark::loadFile(const std::string& filename, unsigned char* buffer, long size) {
+	FILE* file = fopen(filename.c_str(), "rb");
+
+	if (!file) {
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	rewind(file);
+
+	bool result = fileSize == size && fread(buffer, sizeof(char), size, file) == static_cast<size_t>(size);
+
+	fclose(file);
+
+	return result;
+}
+
+void ComputeBenchmark::tune(const std::string& frameFilename) {
+	const int width = Config::cameraWidth;
+	const int height = Config::cameraHeight;
+	const int size = width * height;
+	const int colorsLookupSize = 0x1000000;
+
+	auto* frame = (unsigned char *)_aligned_malloc(size, 4096);
+	auto* lookup = (unsigned char *)_aligned_malloc(colorsLookupSize, 4096);
+
+	std::mt19937 random(1);
+
+	if (frameFilename.empty() || !loadFile(frameFilename, frame, size)) {
+		std::cout << "! Using random frame data" << std::endl;
+
+		for (int i = 0; i < size; i++) {
+			frame[i] = static_cast<unsigned char>(random());
+		}
+	}
+
+	if (!LookupFile::load("colors.lut", lookup, nullptr) && !LookupFile::load("colors.dat", lookup, nullptr)) {
+		std::cout << "! Using empty colors lookup" << std::endl;
+
+		memset(lookup, 0, colorsLookupSize);
+	}
+
+	for (const auto& spec : ComputeBackend::getAvailableSpecs()) {
+		ComputeBackend* backend = ComputeBackend::create(spec);
+
+		if (backend != nullptr && backend->setup()) {
+			backend->tune(frame, lookup, width, height, colorsLookupSize, true);
+		}
+
+		delete backend;
+	}
+
+	_aligned_free(frame);
+	_aligned_free(lookup);
+}
+
+// Times the interior debayer kernels with every work group the device accepts, outputs must not change
+void ComputeBenchmark::benchmarkWorkGroups(
+		OpenCLCompute* backend,
+		unsigned char* frame,
+		unsigned char* lookup,
+		unsigned char* bgr,
+		unsigned char* segmented,
+		unsigned char* expectedBgr,
+		unsigned char* expectedSegmented,
+		int iterations
+) {
+	const int width = Config::cameraWidth;
+	const int height = Config::cameraHeight;
+	const int size = width * height;
+	const int colorsLookupSize = 0x1000000;
+
+	OpenCLCompute::WorkGroup initialWorkGroup = backend->getDeBayerWorkGroup();
+
+	for (const auto& workGroup : OpenCLCompute::getDeBayerWorkGroups()) {
+		if (!backend->setDeBayerWorkGroup(workGroup)) {
+			continue;
+		}
+
+		memset(bgr, 0, size * 3);
+		memset(segmented, 0, size);
+
+		for (int i = 0; i < 3; i++) {
+			backend->deBayer(frame, bgr, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		__int64 startTime = Util::timerStart();
+
+		for (int i = 0; i < iterations; i++) {
+			backend->deBayer(frame, bgr, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		double deBayerTime = Util::timerEnd(startTime) / iterations;
+
+		bool identical = memcmp(bgr, expectedBgr, size * 3) == 0 && memcmp(segmented, expectedSegmented, size) == 0;
+
+		startTime = Util::timerStart();
+
+		for (int i = 0; i < iterations; i++) {
+			backend->deBayer(frame, nullptr, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		double segmentTime = Util::timerEnd(startTime) / iterations;
+
+		identical = identical && memcmp(segmented, expectedSegmented, size) == 0;
+
+		std::cout << "  work group ";
+
+		if (workGroup.width == 0) {
+			std::cout << "driver";
+		} else {
+			std::cout << workGroup.width << "x" << workGroup.height << (workGroup.tiled ? " tiled" : "");
+		}
+
+		std::cout << ": deBayer " << deBayerTime << " ms, segment only " << segmentTime << " ms"
+				  << (identical ? "" : ", output differs") << std::endl;
+	}
+
+	backend->setDeBayerWorkGroup(initialWorkGroup);
+}
+
+// Times Blobber::encodeRuns on the reference segmentation with 1, 2, 4 and 8 threads, the runs must not depend on the
+// thread count.
+void ComputeBenchmark::benchmarkRunEncoding(unsigned char* segmented, int width, int height, int iterations) {
+	const int threadCounts[] = {1, 2, 4, 8};
+	// balls, goals and field lines like a typical game configuration
+	const unsigned int trackedColors = 0x7e;
+	const int maxRuns = width * height / 4;
+
+	std::vector<unsigned int> tileClasses((size_t)(width / ComputeBackend::TILE_SIZE) * (height / ComputeBackend::TILE_SIZE));
+	std::vector<ComputeBackend::Run> expectedRuns((size_t)maxRuns);
+	std::vector<ComputeBackend::Run> runs((size_t)maxRuns);
+	std::vector<std::vector<ComputeBackend::Run>> stripes;
+	int initialThreadCount = omp_get_max_threads();
+	double singleThreadTime = 0.0;
+	int expectedCount = 0;
+
+	CpuCompute reference;
+	reference.enqueueClassifyTiles(segmented, width, height, tileClasses.data());
+
+	for (int threadCount : threadCounts) {
+		omp_set_num_threads(threadCount);
+
+		int runCount = Blobber::encodeRuns(segmented, width, height, tileClasses.data(), trackedColors, runs.data(), maxRuns, stripes);
+
+		__int64 startTime = Util::timerStart();
+
+		for (int i = 0; i < iterations; i++) {
+			Blobber::encodeRuns(segmented, width, height, tileClasses.data(), trackedColors, runs.data(), maxRuns, stripes);
+		}
+
+		double encodeTime = Util::timerEnd(startTime) / iterations;
+
+		if (threadCount == 1) {
+			singleThreadTime = encodeTime;
+			expectedCount = runCount;
+			expectedRuns = runs;
+		}
+
+		bool identical = runCount == expectedCount
+			&& memcmp(runs.data(), expectedRuns.data(), runCount * sizeof(ComputeBackend::Run)) == 0;
+
+		std::cout << "! Run encoding with " << threadCount << " threads: " << encodeTime << " ms, "
+				  << runCount << " runs, speedup " << (encodeTime > 0.0 ? singleThreadTime / encodeTime : 0.0) << "x, "
+				  << (identical ? "output identical" : "output differs") << std::endl;
+	}
+
+	omp_set_num_threads(initialThreadCount);
+}
+
+// Labels the runs of the backend's segmented frame with the backend and with the reference, returns the number of
+// regions that differ. Only backends that encode runs themselves are compared.
+int ComputeBenchmark::compareRegions(
+		ComputeBackend* reference,
+		ComputeBackend* backend,
+		unsigned char* frame,
+		unsigned char* lookup,
+		unsigned char* segmented,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	const int maxRuns = width * height / 4;
+	const int maxRegions = width * height / 16;
+	const unsigned int trackedColors = (1u << 10) - 1;
+
+	auto* runs = (ComputeBackend::Run *)_aligned_malloc(maxRuns * sizeof(ComputeBackend::Run), 4096);
+	auto* expectedRegions = (ComputeBackend::Region *)_aligned_malloc(maxRegions * sizeof(ComputeBackend::Region), 4096);
+	auto* regions = (ComputeBackend::Region *)_aligned_malloc(maxRegions * sizeof(ComputeBackend::Region), 4096);
+
+	backend->deBayer(frame, nullptr, lookup, segmented, width, height, colorsLookupSize);
+
+	int runCount = backend->encodeRuns(segmented, width, height, trackedColors, runs, maxRuns);
+	int mismatches = 0;
+
+	if (runCount >= 0) {
+		int expectedCount = reference->labelRegions(runs, runCount, maxRuns, height, trackedColors, expectedRegions, maxRegions);
+		int regionCount = backend->labelRegions(runs, runCount, maxRuns, height, trackedColors, regions, maxRegions);
+
+		// -1 means the Blobber falls back to the CPU path, nothing to compare
+		if (regionCount >= 0 && regionCount != expectedCount) {
+			mismatches = std::abs(regionCount - expectedCount);
+		}
+
+		for (int i = 0; i < std::min(regionCount, expectedCount); i++) {
+			mismatches += memcmp(&regions[i], &expectedRegions[i], sizeof(ComputeBackend::Region)) != 0;
+		}
+	}
+
+	backend->releaseBuffer(runs);
+	backend->releaseBuffer(regions);
+
+	_aligned_free(runs);
+	_aligned_free(expectedRegions);
+	_aligned_free(regions);
+
+	return mismatches;
+}
+
+void ComputeBenchmark::run(const std::string& frameFilename, int iterations) {
+	const int width = Config::cameraWidth;
+	const int height = Config::cameraHeight;
+	const int size = width * height;
+	const int colorsLookupSize = 0x1000000;
+	const int centroidCount = 16;
+	const int compactLookupCount = 2;
+	const int compactLookupBits[compactLookupCount] = {6, 5};
+
+	auto* frame = (unsigned char *)_aligned_malloc(size, 4096);
+	auto* lookup = (unsigned char *)_aligned_malloc(colorsLookupSize, 4096);
+	auto* expectedBgr = (unsigned char *)_aligned_malloc(size * 3, 4096);
+	auto* expectedSegmented = (unsigned char *)_aligned_malloc(size, 4096);
+	auto* expectedQuads = (unsigned char *)_aligned_malloc(size / 4, 4096);
+	auto* bgr = (unsigned char *)_aligned_malloc(size * 3, 4096);
+	auto* segmented = (unsigned char *)_aligned_malloc(size, 4096);
+	auto* clustered = (unsigned char *)_aligned_malloc(size, 4096);
+	auto* expectedClustered = (unsigned char *)_aligned_malloc(size, 4096);
+	// previews up to 1/2 scale
+	auto* bgrPreview = (unsigned char *)_aligned_malloc(size / 4 * 3, 4096);
+	auto* classPreview = (unsigned char *)_aligned_malloc(size / 4, 4096);
+	auto* expectedBgrPreview = (unsigned char *)_aligned_malloc(size / 4 * 3, 4096);
+	auto* expectedClassPreview = (unsigned char *)_aligned_malloc(size / 4, 4096);
+	unsigned char centroids[centroidCount * 3];
+	unsigned char expectedCentroids[centroidCount * 3];
+
+	std::mt19937 random(1);
+
+	if (frameFilename.empty() || !loadFile(frameFilename, frame, size)) {
+		std::cout << "! Using random frame data" << std::endl;
+
+		for (int i = 0; i < size; i++) {
+			frame[i] = static_cast<unsigned char>(random());
+		}
+	}
+
+	if (!LookupFile::load("colors.lut", lookup, nullptr) && !LookupFile::load("colors.dat", lookup, nullptr)) {
+		std::cout << "! Using empty colors lookup" << std::endl;
+
+		memset(lookup, 0, colorsLookupSize);
+	}
+
+	for (unsigned char& value : centroids) {
+		value = static_cast<unsigned char>(random());
+	}
+
+	CpuCompute reference;
+	reference.setup();
+	reference.deBayer(frame, expectedBgr, lookup, expectedSegmented, width, height, colorsLookupSize);
+	reference.segmentQuads(frame, lookup, expectedQuads, width, height, colorsLookupSize);
+
+	memcpy(expectedCentroids, centroids, sizeof(centroids));
+	reference.enqueueKMeansIterations(
+			expectedBgr, expectedClustered, expectedCentroids, centroidCount, width, height, Clusterer::SAMPLE_STEP, Clusterer::MAX_ITERATIONS
+	);
+
+	unsigned char* compactLookups[compactLookupCount];
+	unsigned char* expectedCompactSegmented[compactLookupCount];
+
+	for (int i = 0; i < compactLookupCount; i++) {
+		int bits = compactLookupBits[i];
+
+		compactLookups[i] = (unsigned char *)_aligned_malloc(1 << (3 * bits), 4096);
+		expectedCompactSegmented[i] = (unsigned char *)_aligned_malloc(size, 4096);
+
+		int changedCount = ComputeBackend::quantizeLookup(lookup, bits, compactLookups[i], nullptr);
+
+		std::cout << "! " << bits << " bit colors lookup changes " << changedCount << " entries" << std::endl;
+
+		reference.deBayer(frame, nullptr, compactLookups[i], expectedCompactSegmented[i], width, height, 1 << (3 * bits));
+	}
+
+	benchmarkRunEncoding(expectedSegmented, width, height, iterations);
+
+	std::string fastestSpec;
+	double fastestTime = 0.0;
+
+	for (const auto& spec : ComputeBackend::getAvailableSpecs()) {
+		ComputeBackend* backend = ComputeBackend::create(spec);
+
+		if (backend == nullptr || !backend->setup()) {
+			std::cout << "- " << spec << ": not available" << std::endl;
+
+			delete backend;
+			continue;
+		}
+
+		// warm up, first runs include buffer creation and driver work
+		for (int i = 0; i < 3; i++) {
+			backend->deBayer(frame, bgr, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		__int64 startTime = Util::timerStart();
+
+		for (int i = 0; i < iterations; i++) {
+			backend->deBayer(frame, bgr, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		double deBayerTime = Util::timerEnd(startTime) / iterations;
+
+		startTime = Util::timerStart();
+
+		for (int i = 0; i < iterations; i++) {
+			backend->deBayer(frame, nullptr, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		double segmentTime = Util::timerEnd(startTime) / iterations;
+
+		int bgrMismatches = 0;
+		int segmentedMismatches = 0;
+
+		for (int i = 0; i < size * 3; i++) {
+			bgrMismatches += bgr[i] != expectedBgr[i];
+		}
+
+		for (int i = 0; i < size; i++) {
+			segmentedMismatches += segmented[i] != expectedSegmented[i];
+		}
+
+		double previewTime = 0.0;
+		int previewMismatches = 0;
+
+		// previews are made from the frame and segmentation the backend just wrote
+		for (int scale = 2; scale <= 8; scale *= 2) {
+			int previewSize = (width / scale) * (height / scale);
+
+			reference.enqueuePreview(frame, expectedSegmented, width, height, 1, scale, expectedBgrPreview, expectedClassPreview);
+
+			startTime = Util::timerStart();
+
+			backend->enqueuePreview(frame, segmented, width, height, 1, scale, bgrPreview, classPreview);
+			backend->finish(segmented);
+
+			previewTime += Util::timerEnd(startTime);
+
+			for (int i = 0; i < previewSize * 3; i++) {
+				previewMismatches += bgrPreview[i] != expectedBgrPreview[i];
+			}
+
+			for (int i = 0; i < previewSize; i++) {
+				previewMismatches += classPreview[i] != expectedClassPreview[i];
+			}
+		}
+
+		startTime = Util::timerStart();
+
+		for (int i = 0; i < iterations; i++) {
+			backend->segmentQuads(frame, lookup, segmented, width, height, colorsLookupSize);
+		}
+
+		double segmentQuadsTime = Util::timerEnd(startTime) / iterations;
+
+		int quadMismatches = 0;
+
+		for (int i = 0; i < size / 4; i++) {
+			quadMismatches += segmented[i] != expectedQuads[i];
+		}
+
+		unsigned char backendCentroids[centroidCount * 3];
+		memcpy(backendCentroids, centroids, sizeof(centroids));
+
+		startTime = Util::timerStart();
+
+		backend->kMeans(bgr, clustered, backendCentroids, centroidCount, width, height);
+
+		double kMeansTime = Util::timerEnd(startTime);
+
+		memcpy(backendCentroids, centroids, sizeof(centroids));
+
+		startTime = Util::timerStart();
+
+		backend->enqueueKMeansIterations(
+				expectedBgr, clustered, backendCentroids, centroidCount, width, height, Clusterer::SAMPLE_STEP, Clusterer::MAX_ITERATIONS
+		);
+		backend->finishCalibration();
+
+		double kMeansIterationsTime = Util::timerEnd(startTime);
+
+		int kMeansMismatches = memcmp(backendCentroids, expectedCentroids, sizeof(centroids)) != 0 ? 1 : 0;
+
+		for (int i = 0; i < size; i++) {
+			kMeansMismatches += clustered[i] != expectedClustered[i];
+		}
+
+		int regionMismatches = compareRegions(&reference, backend, frame, lookup, segmented, width, height, colorsLookupSize);
+
+		double compactTimes[compactLookupCount];
+
+		// compact lookups use a program built for their size, the first run builds it
+		for (int l = 0; l < compactLookupCount; l++) {
+			int compactLookupSize = 1 << (3 * compactLookupBits[l]);
+
+			backend->deBayer(frame, nullptr, compactLookups[l], segmented, width, height, compactLookupSize);
+
+			startTime = Util::timerStart();
+
+			for (int i = 0; i < iterations; i++) {
+				backend->deBayer(frame, nullptr, compactLookups[l], segmented, width, height, compactLookupSize);
+			}
+
+			compactTimes[l] = Util::timerEnd(startTime) / iterations;
+
+			for (int i = 0; i < size; i++) {
+				segmentedMismatches += segmented[i] != expectedCompactSegmented[l][i];
+			}
+		}
+
+		std::cout << "! " << spec << " (" << backend->getName() << "): "
+				  << "deBayer " << deBayerTime << " ms, "
+				  << "segment only " << segmentTime << " ms, "
+				  << "half resolution " << segmentQuadsTime << " ms, "
+				  << "previews " << previewTime << " ms, "
+				  << "kMeans " << kMeansTime << " ms, "
+				  << "kMeans iterations " << kMeansIterationsTime << " ms, ";
+
+		for (int l = 0; l < compactLookupCount; l++) {
+			std::cout << compactLookupBits[l] << " bit lookup " << compactTimes[l] << " ms, ";
+		}
+
+		if (bgrMismatches == 0 && segmentedMismatches == 0 && quadMismatches == 0 && regionMismatches == 0 && kMeansMismatches == 0
+				&& previewMismatches == 0) {
+			std::cout << "output identical" << std::endl;
+		} else {
+			std::cout << "output differs in " << bgrMismatches << " bgr bytes, "
+					  << segmentedMismatches << " segmented pixels, "
+					  << quadMismatches << " quads, "
+					  << previewMismatches << " preview bytes, "
+					  << regionMismatches << " regions and "
+					  << kMeansMismatches << " clustered pixels or centroids" << std::endl;
+		}
+
+		if (spec != "null") {
+			double frameRate = deBayerTime > 0.0 ? 1000.0 / deBayerTime : 0.0;
+
+			std::cout << (frameRate >= Config::cameraFrameRate ? "! " : "- ") << spec << ": " << frameRate << " fps at "
+					  << width << "x" << height << ", " << (frameRate >= Config::cameraFrameRate ? "keeps up with" : "slower than")
+					  << " the " << Config::cameraFrameRate << " fps camera" << std::endl;
+		}
+
+		auto* openCLCompute = dynamic_cast<OpenCLCompute*>(backend);
+
+		if (openCLCompute != nullptr) {
+			benchmarkWorkGroups(openCLCompute, frame, lookup, bgr, segmented, expectedBgr, expectedSegmented, iterations);
+		}
+
+		if (spec != "null" && (fastestSpec.empty() || deBayerTime < fastestTime)) {
+			fastestSpec = spec;
+			fastestTime = deBayerTime;
+		}
+
+		delete backend;
+	}
+
+	if (!fastestSpec.empty()) {
+		std::cout << "! Fastest compute backend: " << fastestSpec << " (" << fastestTime << " ms)" << std::endl;
+	}
+
+	_aligned_free(frame);
+	_aligned_free(lookup);
+	_aligned_free(expectedBgr);
+	_aligned_free(expectedSegmented);
+	_aligned_free(expectedQuads);
+	_aligned_free(bgr);
+	_aligned_free(segmented);
+	_aligned_free(clustered);
+	_aligned_free(expectedClustered);
+	_aligned_free(bgrPreview);
+	_aligned_free(classPreview);
+	_aligned_free(expectedBgrPreview);
+	_aligned_free(expectedClassPreview);
+
+	for (int i = 0; i < compactLookupCount; i++) {
+		_aligned_free(compactLookups[i]);
+		_aligned_free(expectedCompactSegmented[i]);
+	}
+}
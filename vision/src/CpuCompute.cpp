@@ -0,0 +1,353 @@
+#include <iostream>
+#include <vector>
+#include <immintrin.h>
+#include "CpuCompute.h"
+
+// Row pair buffers written by deBayerQuadRow, in order:
+// blue, green, red of the first line followed by blue, green, red of the second line.
+#define PLANE_COUNT 6
+
+namespace {
+	inline int clampIndex(int index, int maxIndex) {
+		return index < 0 ? 0 : (index > maxIndex ? maxIndex : index);
+	}
+
+	inline int hadd(int a, int b) {
+		return (a + b) >> 1;
+	}
+
+	// Same as debayerAndSegment in debayer.cl, including clamping of the flat source index
+	void deBayerQuad(const unsigned char* input, int width, int maxIndex, int quadX, int quadY, unsigned char* planes) {
+		int destX = 2 * quadX;
+		int sourcePixelIndex = 2 * quadY * width + destX - width;
+		int line[4][4];
+
+		for (auto &row : line) {
+			for (int i = 0; i < 4; i++) {
+				row[i] = input[clampIndex(sourcePixelIndex + i - 1, maxIndex)];
+			}
+
+			sourcePixelIndex += width;
+		}
+
+		unsigned char* blue0 = planes;
+		unsigned char* green0 = planes + width;
+		unsigned char* red0 = planes + 2 * width;
+		unsigned char* blue1 = planes + 3 * width;
+		unsigned char* green1 = planes + 4 * width;
+		unsigned char* red1 = planes + 5 * width;
+
+		blue0[destX] = static_cast<unsigned char>((line[0][0] + line[0][2] + line[2][0] + line[2][2]) / 4);
+		green0[destX] = static_cast<unsigned char>((line[0][1] + line[1][0] + line[1][2] + line[2][1]) / 4);
+		red0[destX] = static_cast<unsigned char>(line[1][1]);
+
+		blue0[destX + 1] = static_cast<unsigned char>(hadd(line[0][2], line[2][2]));
+		green0[destX + 1] = static_cast<unsigned char>(line[1][2]);
+		red0[destX + 1] = static_cast<unsigned char>(hadd(line[1][1], line[1][3]));
+
+		blue1[destX] = static_cast<unsigned char>(hadd(line[2][0], line[2][2]));
+		green1[destX] = static_cast<unsigned char>(line[2][1]);
+		red1[destX] = static_cast<unsigned char>(hadd(line[1][1], line[3][1]));
+
+		blue1[destX + 1] = static_cast<unsigned char>(line[2][2]);
+		green1[destX + 1] = static_cast<unsigned char>((line[1][2] + line[2][1] + line[2][3] + line[3][2]) / 4);
+		red1[destX + 1] = static_cast<unsigned char>((line[1][1] + line[1][3] + line[3][1] + line[3][3]) / 4);
+	}
+
+	// Same as the centroid search in kmeans.cl, first closest centroid wins
+	inline int findClosestCentroid(int c0, int c1, int c2, const unsigned char* centroids, int centroidCount) {
+		int minDist = 0;
+		int closestCentroid = -1;
+
+		for (int c = 0; c < centroidCount; ++c) {
+			int d0 = c0 - centroids[c * 3];
+			int d1 = c1 - centroids[c * 3 + 1];
+			int d2 = c2 - centroids[c * 3 + 2];
+			int dist = d0 * d0 + d1 * d1 + d2 * d2;
+
+			if (closestCentroid == -1 || dist < minDist) {
+				minDist = dist;
+				closestCentroid = c;
+			}
+		}
+
+		return closestCentroid;
+	}
+
+	// Vector versions work on 16 bit lanes, one lane per quad. Loading the 4 source columns of a quad
+	// line from offsets -1 and +1 gives .x/.y and .z/.w as the low and high bytes of each lane.
+	// Two output pixels of a line are then packed back into one lane as low and high byte.
+	// Only used for quad rows that do not touch the first or last line, so no clamping is needed.
+	__attribute__((target("sse4.1")))
+	int deBayerQuadRowSse41(const unsigned char* input, int width, int quadY, unsigned char* planes) {
+		const unsigned char* line0 = input + (2 * quadY - 1) * width;
+		const unsigned char* line1 = line0 + width;
+		const unsigned char* line2 = line1 + width;
+		const unsigned char* line3 = line2 + width;
+		const __m128i lowMask = _mm_set1_epi16(0x00FF);
+		int quadCount = width / 2;
+		int quadX = 0;
+
+		for (; quadX + 8 <= quadCount; quadX += 8) {
+			int destX = 2 * quadX;
+
+			__m128i xy = _mm_loadu_si128((const __m128i*)(line0 + destX - 1));
+			__m128i zw = _mm_loadu_si128((const __m128i*)(line0 + destX + 1));
+			__m128i line0x = _mm_and_si128(xy, lowMask);
+			__m128i line0y = _mm_srli_epi16(xy, 8);
+			__m128i line0z = _mm_and_si128(zw, lowMask);
+
+			xy = _mm_loadu_si128((const __m128i*)(line1 + destX - 1));
+			zw = _mm_loadu_si128((const __m128i*)(line1 + destX + 1));
+			__m128i line1x = _mm_and_si128(xy, lowMask);
+			__m128i line1y = _mm_srli_epi16(xy, 8);
+			__m128i line1z = _mm_and_si128(zw, lowMask);
+			__m128i line1w = _mm_srli_epi16(zw, 8);
+
+			xy = _mm_loadu_si128((const __m128i*)(line2 + destX - 1));
+			zw = _mm_loadu_si128((const __m128i*)(line2 + destX + 1));
+			__m128i line2x = _mm_and_si128(xy, lowMask);
+			__m128i line2y = _mm_srli_epi16(xy, 8);
+			__m128i line2z = _mm_and_si128(zw, lowMask);
+			__m128i line2w = _mm_srli_epi16(zw, 8);
+
+			xy = _mm_loadu_si128((const __m128i*)(line3 + destX - 1));
+			zw = _mm_loadu_si128((const __m128i*)(line3 + destX + 1));
+			__m128i line3y = _mm_srli_epi16(xy, 8);
+			__m128i line3z = _mm_and_si128(zw, lowMask);
+			__m128i line3w = _mm_srli_epi16(zw, 8);
+
+			__m128i blue00 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(line0x, line0z), _mm_add_epi16(line2x, line2z)), 2);
+			__m128i green00 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(line0y, line1x), _mm_add_epi16(line1z, line2y)), 2);
+			__m128i red00 = line1y;
+
+			__m128i blue01 = _mm_srli_epi16(_mm_add_epi16(line0z, line2z), 1);
+			__m128i green01 = line1z;
+			__m128i red01 = _mm_srli_epi16(_mm_add_epi16(line1y, line1w), 1);
+
+			__m128i blue10 = _mm_srli_epi16(_mm_add_epi16(line2x, line2z), 1);
+			__m128i green10 = line2y;
+			__m128i red10 = _mm_srli_epi16(_mm_add_epi16(line1y, line3y), 1);
+
+			__m128i blue11 = line2z;
+			__m128i green11 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(line1z, line2y), _mm_add_epi16(line2w, line3z)), 2);
+			__m128i red11 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(line1y, line1w), _mm_add_epi16(line3y, line3w)), 2);
+
+			_mm_storeu_si128((__m128i*)(planes + destX), _mm_or_si128(blue00, _mm_slli_epi16(blue01, 8)));
+			_mm_storeu_si128((__m128i*)(planes + width + destX), _mm_or_si128(green00, _mm_slli_epi16(green01, 8)));
+			_mm_storeu_si128((__m128i*)(planes + 2 * width + destX), _mm_or_si128(red00, _mm_slli_epi16(red01, 8)));
+			_mm_storeu_si128((__m128i*)(planes + 3 * width + destX), _mm_or_si128(blue10, _mm_slli_epi16(blue11, 8)));
+			_mm_storeu_si128((__m128i*)(planes + 4 * width + destX), _mm_or_si128(green10, _mm_slli_epi16(green11, 8)));
+			_mm_storeu_si128((__m128i*)(planes + 5 * width + destX), _mm_or_si128(red10, _mm_slli_epi16(red11, 8)));
+		}
+
+		return quadX;
+	}
+
+	__attribute__((target("avx2")))
+	int deBayerQuadRowAvx2(const unsigned char* input, int width, int quadY, unsigned char* planes) {
+		const unsigned char* line0 = input + (2 * quadY - 1) * width;
+		const unsigned char* line1 = line0 + width;
+		const unsigned char* line2 = line1 + width;
+		const unsigned char* line3 = line2 + width;
+		const __m256i lowMask = _mm256_set1_epi16(0x00FF);
+		int quadCount = width / 2;
+		int quadX = 0;
+
+		for (; quadX + 16 <= quadCount; quadX += 16) {
+			int destX = 2 * quadX;
+
+			__m256i xy = _mm256_loadu_si256((const __m256i*)(line0 + destX - 1));
+			__m256i zw = _mm256_loadu_si256((const __m256i*)(line0 + destX + 1));
+			__m256i line0x = _mm256_and_si256(xy, lowMask);
+			__m256i line0y = _mm256_srli_epi16(xy, 8);
+			__m256i line0z = _mm256_and_si256(zw, lowMask);
+
+			xy = _mm256_loadu_si256((const __m256i*)(line1 + destX - 1));
+			zw = _mm256_loadu_si256((const __m256i*)(line1 + destX + 1));
+			__m256i line1x = _mm256_and_si256(xy, lowMask);
+			__m256i line1y = _mm256_srli_epi16(xy, 8);
+			__m256i line1z = _mm256_and_si256(zw, lowMask);
+			__m256i line1w = _mm256_srli_epi16(zw, 8);
+
+			xy = _mm256_loadu_si256((const __m256i*)(line2 + destX - 1));
+			zw = _mm256_loadu_si256((const __m256i*)(line2 + destX + 1));
+			__m256i line2x = _mm256_and_si256(xy, lowMask);
+			__m256i line2y = _mm256_srli_epi16(xy, 8);
+			__m256i line2z = _mm256_and_si256(zw, lowMask);
+			__m256i line2w = _mm256_srli_epi16(zw, 8);
+
+			xy = _mm256_loadu_si256((const __m256i*)(line3 + destX - 1));
+			zw = _mm256_loadu_si256((const __m256i*)(line3 + destX + 1));
+			__m256i line3y = _mm256_srli_epi16(xy, 8);
+			__m256i line3z = _mm256_and_si256(zw, lowMask);
+			__m256i line3w = _mm256_srli_epi16(zw, 8);
+
+			__m256i blue00 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(line0x, line0z), _mm256_add_epi16(line2x, line2z)), 2);
+			__m256i green00 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(line0y, line1x), _mm256_add_epi16(line1z, line2y)), 2);
+			__m256i red00 = line1y;
+
+			__m256i blue01 = _mm256_srli_epi16(_mm256_add_epi16(line0z, line2z), 1);
+			__m256i green01 = line1z;
+			__m256i red01 = _mm256_srli_epi16(_mm256_add_epi16(line1y, line1w), 1);
+
+			__m256i blue10 = _mm256_srli_epi16(_mm256_add_epi16(line2x, line2z), 1);
+			__m256i green10 = line2y;
+			__m256i red10 = _mm256_srli_epi16(_mm256_add_epi16(line1y, line3y), 1);
+
+			__m256i blue11 = line2z;
+			__m256i green11 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(line1z, line2y), _mm256_add_epi16(line2w, line3z)), 2);
+			__m256i red11 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(line1y, line1w), _mm256_add_epi16(line3y, line3w)), 2);
+
+			_mm256_storeu_si256((__m256i*)(planes + destX), _mm256_or_si256(blue00, _mm256_slli_epi16(blue01, 8)));
+			_mm256_storeu_si256((__m256i*)(planes + width + destX), _mm256_or_si256(green00, _mm256_slli_epi16(green01, 8)));
+			_mm256_storeu_si256((__m256i*)(planes + 2 * width + destX), _mm256_or_si256(red00, _mm256_slli_epi16(red01, 8)));
+			_mm256_storeu_si256((__m256i*)(planes + 3 * width + destX), _mm256_or_si256(blue10, _mm256_slli_epi16(blue11, 8)));
+			_mm256_storeu_si256((__m256i*)(planes + 4 * width + destX), _mm256_or_si256(green10, _mm256_slli_epi16(green11, 8)));
+			_mm256_storeu_si256((__m256i*)(planes + 5 * width + destX), _mm256_or_si256(red10, _mm256_slli_epi16(red11, 8)));
+		}
+
+		return quadX;
+	}
+}
+
+CpuCompute::CpuCompute() {
+	simdLevel = SCALAR;
+}
+
+CpuCompute::~CpuCompute() = default;
+
+std::string CpuCompute::getName() {
+	return std::string("cpu (") + (simdLevel == AVX2 ? "AVX2" : simdLevel == SSE41 ? "SSE4.1" : "scalar") + ")";
+}
+
+bool CpuCompute::setup() {
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		simdLevel = AVX2;
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		simdLevel = SSE41;
+	} else {
+		simdLevel = SCALAR;
+	}
+
+	std::cout << "! CPU compute: " << getName() << std::endl;
+
+	return true;
+}
+
+void CpuCompute::deBayerQuadRow(const unsigned char* frame, int width, int height, int quadY, unsigned char* planes) {
+	int maxIndex = width * height - 1;
+	int quadCount = width / 2;
+	int quadX = 0;
+
+	// First and last quad rows read outside the frame and rely on clamping
+	bool isInterior = quadY > 0 && quadY < height / 2 - 1;
+
+	if (isInterior && simdLevel == AVX2) {
+		quadX = deBayerQuadRowAvx2(frame, width, quadY, planes);
+	} else if (isInterior && simdLevel == SSE41) {
+		quadX = deBayerQuadRowSse41(frame, width, quadY, planes);
+	}
+
+	for (; quadX < quadCount; quadX++) {
+		deBayerQuad(frame, width, maxIndex, quadX, quadY, planes);
+	}
+}
+
+void CpuCompute::deBayer(
+		unsigned char *frame,
+		unsigned char *rgbOut,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	int quadRowCount = height / 2;
+	int lookupBits = getLookupBits(colorsLookupSize);
+	int lookupShift = 8 - lookupBits;
+
+	#pragma omp parallel
+	{
+		std::vector<unsigned char> planes(static_cast<size_t>(PLANE_COUNT * width));
+
+		#pragma omp for schedule(static)
+		for (int quadY = 0; quadY < quadRowCount; quadY++) {
+			deBayerQuadRow(frame, width, height, quadY, planes.data());
+
+			for (int line = 0; line < 2; line++) {
+				const unsigned char* blue = planes.data() + 3 * line * width;
+				const unsigned char* green = blue + width;
+				const unsigned char* red = green + width;
+				int index = (2 * quadY + line) * width;
+				unsigned char* segmented = segmentedOut + index;
+
+				if (rgbOut != nullptr) {
+					unsigned char* rgb = rgbOut + index * 3;
+
+					for (int x = 0; x < width; x++) {
+						rgb[x * 3] = blue[x];
+						rgb[x * 3 + 1] = green[x];
+						rgb[x * 3 + 2] = red[x];
+					}
+				}
+
+				for (int x = 0; x < width; x++) {
+					segmented[x] = lookup[(blue[x] >> lookupShift) + ((green[x] >> lookupShift) << lookupBits)
+							+ ((red[x] >> lookupShift) << (2 * lookupBits))];
+				}
+			}
+		}
+	}
+}
+
+void CpuCompute::segmentQuads(
+		unsigned char *frame,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	int quadWidth = width / 2;
+	int quadHeight = height / 2;
+	int lookupBits = getLookupBits(colorsLookupSize);
+	int lookupShift = 8 - lookupBits;
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < quadHeight; y++) {
+		const unsigned char* redRow = frame + 2 * y * width;
+		const unsigned char* blueRow = redRow + width;
+		unsigned char* segmented = segmentedOut + y * quadWidth;
+
+		for (int x = 0; x < quadWidth; x++) {
+			int red = redRow[2 * x];
+			int green = (redRow[2 * x + 1] + blueRow[2 * x]) >> 1;
+			int blue = blueRow[2 * x + 1];
+
+			segmented[x] = lookup[(blue >> lookupShift) + ((green >> lookupShift) << lookupBits)
+					+ ((red >> lookupShift) << (2 * lookupBits))];
+		}
+	}
+}
+
+void CpuCompute::kMeans(
+		unsigned char* rgb,
+		unsigned char* clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height
+) {
+	int size = width * height;
+
+	#pragma omp parallel for schedule(static)
+	for (int p = 0; p < size; p++) {
+		const unsigned char* pixel = rgb + p * 3;
+
+		clustered[p] = static_cast<unsigned char>(findClosestCentroid(pixel[0], pixel[1], pixel[2], centroids, centroidCount));
+	}
+}
+
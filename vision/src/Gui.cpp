@@ -41,6 +41,9 @@ Gui::Gui(HINSTANCE instance, Blobber* blobber, int width, int height) : instance
 
 	ZeroMemory(&msg, sizeof(MSG));
 
+	blobber->addBgrConsumer();
+	blobber->addPreviewConsumer(PREVIEW_SCALE);
+
 	addMouseListener(this);
 
 	mouseX = 0;
@@ -49,6 +52,7 @@ Gui::Gui(HINSTANCE instance, Blobber* blobber, int width, int height) : instance
     mouseStartY = -1;
 	mouseDown = false;
 	prevMouseDown = false;
+	strokeColor = -1;
 	mouseBtn = MouseListener::MouseBtn::LEFT;
 	brushRadius = 50;
 
@@ -59,6 +63,14 @@ Gui::Gui(HINSTANCE instance, Blobber* blobber, int width, int height) : instance
 	frontClassification = createWindow(width, height, "Camera 1 classification");
 	frontRGB = createWindow(width, height, "Camera 1 RGB");
 
+	int previewWidth = blobber->getPreviewWidth(PREVIEW_SCALE);
+	int previewHeight = blobber->getPreviewHeight(PREVIEW_SCALE);
+
+	previewRgb = new unsigned char[3 * previewWidth * previewHeight]();
+	previewSegmentedRgb = new unsigned char[3 * previewWidth * previewHeight]();
+	frontPreviewRGB = createWindow(previewWidth, previewHeight, "Camera 1 preview");
+	frontPreviewClassification = createWindow(previewWidth, previewHeight, "Camera 1 preview classification");
+
 	selectedColorName = "";
 
     colorSelectionStdDev = 2.0f;
@@ -80,10 +92,11 @@ Gui::Gui(HINSTANCE instance, Blobber* blobber, int width, int height) : instance
 	createButton("Quit", width - 80, 20, 60, ButtonType::quit);
     createButton("Save", width - 160, 20, 60, ButtonType::save);
     createButton("Undo", width - 240, 20, 60, ButtonType::undo);
+    createButton("Redo", width - 240, 50, 60, ButtonType::redo);
 
 	createButton("Clustering mode", width - 80 - 85, 50, 145, ButtonType::toggleClustering);
 	clustering = false;
-	clusterer = new Clusterer();
+	clusterer = new Clusterer(blobber->getComputeBackend());
 
 	createButton("-", width - 80 - 85, 68, 20, ButtonType::decreaseClusters);
 	centroidCountButton = createButton(std::to_string(clusterer->centroidCount), width - 80 - 85 + 20, 68, 30, ButtonType::unknown);
@@ -95,6 +108,9 @@ Gui::Gui(HINSTANCE instance, Blobber* blobber, int width, int height) : instance
 }
 
 Gui::~Gui() {
+	blobber->removeBgrConsumer();
+	blobber->removePreviewConsumer(PREVIEW_SCALE);
+
 	for (std::vector<DisplayWindow*>::const_iterator i = windows.begin(); i != windows.end(); i++) {
 		delete *i;
 	}
@@ -106,6 +122,9 @@ Gui::~Gui() {
 	}
 
 	elements.clear();
+
+	delete[] previewRgb;
+	delete[] previewSegmentedRgb;
 }
 
 DisplayWindow* Gui::createWindow(int width, int height, std::string name) {
@@ -265,6 +284,23 @@ void Gui::setFrontImages(unsigned char* rgb, unsigned char* rgbData, Vision::Res
 
 	frontClassification->setImage(segmentedRgb, true);
 	frontRGB->setImage(rgb, true);
+
+	setPreviewImages();
+}
+
+void Gui::setPreviewImages() {
+	unsigned char* bgrPreview = blobber->getBgrPreview(PREVIEW_SCALE);
+
+	if (bgrPreview == nullptr) {
+		return;
+	}
+
+	// the preview buffers are reused by the next frames, the windows keep copies
+	memcpy(previewRgb, bgrPreview, static_cast<size_t>(3 * blobber->getPreviewWidth(PREVIEW_SCALE) * blobber->getPreviewHeight(PREVIEW_SCALE)));
+	blobber->getClassPreviewRgb(PREVIEW_SCALE, previewSegmentedRgb);
+
+	frontPreviewRGB->setImage(previewRgb, true);
+	frontPreviewClassification->setImage(previewSegmentedRgb, true);
 }
 
 
@@ -312,10 +348,7 @@ void Gui::handleColorThresholding(unsigned char* rgbData, unsigned char* rgb) {
                         blobber->setPixelColor(pixel.r, pixel.g, pixel.b, selectedColor->color);
                     }
 
-                    for (int i = 0; i < rgbInfo.count; i++) {
-                        ImageProcessor::RGBColor pixel = rgbInfo.pixels[i];
-                        blobber->fillAdjacentColorPixels(pixel.r, pixel.g, pixel.b, selectedColor->color);
-                    }
+                    strokeColor = selectedColor->color;
                 }
             }
 		} else if (mouseBtn == MouseListener::MouseBtn::RIGHT) {
@@ -343,6 +376,13 @@ void Gui::handleColorThresholding(unsigned char* rgbData, unsigned char* rgb) {
 
     if (prevMouseDown && !mouseDown) {
         std::cout << "MOUSE UP" << std::endl;
+
+        // gaps are filled once per stroke and undone with it
+        if (strokeColor >= 0) {
+            blobber->fillColorGaps((unsigned char)strokeColor);
+            strokeColor = -1;
+        }
+
         blobber->createHistoryEntry();
     }
 
@@ -426,9 +466,12 @@ void Gui::onElementClick(Element* element) {
 		} else if (button->type == ButtonType::undo) {
             std::cout << "! UNDO" << std::endl;
             blobber->undo();
+        } else if (button->type == ButtonType::redo) {
+            std::cout << "! REDO" << std::endl;
+            blobber->redo();
         } else if (button->type == ButtonType::save) {
             std::cout << "! Save" << std::endl;
-            blobber->saveColors("colors.dat");
+            blobber->saveColors("colors.lut");
         } else if (button->type == ButtonType::decreaseStdDev) {
             colorSelectionStdDev = std::max(colorSelectionStdDev - 1, 1.0f);
             colorSelectionStdDevButton->text = Util::floatToString(colorSelectionStdDev, 1);
@@ -466,7 +509,10 @@ void Gui::onMouseUp(int x, int y, MouseListener::MouseBtn btn, DisplayWindow* wi
 
 	activeWindow = win;
 
-	handleElements();
+	// buttons are only on the full size windows
+	if (activeWindow == frontRGB || activeWindow == frontClassification) {
+		handleElements();
+	}
 
     mouseStartX = -1;
     mouseStartY = -1;
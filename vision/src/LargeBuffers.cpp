@@ -0,0 +1,261 @@
+#include "LargeBuffers.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace {
+	// Windows large pages count as explicit huge pages
+	enum PageKind {
+		NORMAL_PAGES,
+		TRANSPARENT_HUGE_PAGES,
+		EXPLICIT_HUGE_PAGES
+	};
+
+	typedef struct {
+		std::string name;
+		size_t size;
+		// whole huge or large pages
+		size_t mappedSize;
+		PageKind kind;
+	} Allocation;
+
+	// default huge page size of x86-64 and arm64
+	const size_t hugePageSize = 2 * 1024 * 1024;
+	// inaccessible pages around transparent huge page buffers keep the kernel from merging their mappings with others
+	const size_t guardSize = 4096;
+
+	std::mutex allocationsMutex;
+	std::map<void*, Allocation> allocations;
+
+#ifdef _WIN32
+	// Large pages need the "Lock pages in memory" user right, which is also disabled in the process token by default
+	bool enableLockMemoryPrivilege() {
+		static const bool enabled = [] {
+			HANDLE token = nullptr;
+			TOKEN_PRIVILEGES privileges = {};
+
+			if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+				return false;
+			}
+
+			privileges.PrivilegeCount = 1;
+			privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+			bool result = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)
+				&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+				// succeeds without enabling it when the user does not have the right
+				&& GetLastError() == ERROR_SUCCESS;
+
+			CloseHandle(token);
+
+			if (!result) {
+				std::cout << "! Large pages need the Lock pages in memory user right, using normal pages" << std::endl;
+			}
+
+			return result;
+		}();
+
+		return enabled;
+	}
+#endif
+
+#ifdef __linux__
+	// AnonHugePages of the mapping starting at address, -1 if it is not found
+	long getAnonHugePagesKb(void* address) {
+		std::ifstream smaps("/proc/self/smaps");
+		std::string line;
+		bool inMapping = false;
+
+		while (std::getline(smaps, line)) {
+			uintptr_t start = 0;
+			uintptr_t end = 0;
+			char dash = 0;
+			std::istringstream stream(line);
+
+			// mapping header lines start with the address range, field lines with a name
+			if (stream >> std::hex >> start >> dash >> end && dash == '-') {
+				inMapping = start == reinterpret_cast<uintptr_t>(address);
+				continue;
+			}
+
+			if (inMapping && line.compare(0, 14, "AnonHugePages:") == 0) {
+				return std::stol(line.substr(14));
+			}
+		}
+
+		return -1;
+	}
+#endif
+}
+
+void* LargeBuffers::allocate(size_t size, const std::string& name) {
+	Allocation allocation = {name, size, size, NORMAL_PAGES};
+	void* pointer = nullptr;
+
+#ifdef __linux__
+	allocation.mappedSize = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+
+	pointer = mmap(nullptr, allocation.mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (pointer != MAP_FAILED) {
+		allocation.kind = EXPLICIT_HUGE_PAGES;
+	} else {
+		// no reserved huge pages, map a huge page more to align the buffer for transparent huge pages
+		size_t paddedSize = allocation.mappedSize + hugePageSize + 2 * guardSize;
+		void* mapping = mmap(nullptr, paddedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapping == MAP_FAILED) {
+			std::cout << "- Failed to allocate " << size << " bytes for " << name << std::endl;
+
+			throw std::runtime_error("Could not allocate " + name);
+		}
+
+		auto mappingStart = reinterpret_cast<uintptr_t>(mapping);
+		uintptr_t start = (mappingStart + guardSize + hugePageSize - 1) & ~(uintptr_t)(hugePageSize - 1);
+		size_t head = start - guardSize - mappingStart;
+		size_t tail = paddedSize - head - allocation.mappedSize - 2 * guardSize;
+
+		if (head > 0) {
+			munmap(mapping, head);
+		}
+
+		if (tail > 0) {
+			munmap(reinterpret_cast<void*>(start + allocation.mappedSize + guardSize), tail);
+		}
+
+		pointer = reinterpret_cast<void*>(start);
+
+		if (mprotect(pointer, allocation.mappedSize, PROT_READ | PROT_WRITE) != 0) {
+			std::cout << "- Failed to allocate " << size << " bytes for " << name << std::endl;
+
+			munmap(reinterpret_cast<void*>(start - guardSize), allocation.mappedSize + 2 * guardSize);
+
+			throw std::runtime_error("Could not allocate " + name);
+		}
+
+		if (madvise(pointer, allocation.mappedSize, MADV_HUGEPAGE) == 0) {
+			allocation.kind = TRANSPARENT_HUGE_PAGES;
+		}
+	}
+#else
+#ifdef _WIN32
+	size_t largePageSize = GetLargePageMinimum();
+
+	if (largePageSize > 0 && enableLockMemoryPrivilege()) {
+		allocation.mappedSize = (size + largePageSize - 1) & ~(largePageSize - 1);
+
+		pointer = VirtualAlloc(nullptr, allocation.mappedSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+		if (pointer != nullptr) {
+			allocation.kind = EXPLICIT_HUGE_PAGES;
+		}
+	}
+#endif
+
+	// no large pages or not enough contiguous physical memory for them
+	if (pointer == nullptr) {
+		allocation.mappedSize = size;
+
+		pointer = _aligned_malloc(size, 4096);
+	}
+
+	if (pointer == nullptr) {
+		std::cout << "- Failed to allocate " << size << " bytes for " << name << std::endl;
+
+		throw std::runtime_error("Could not allocate " + name);
+	}
+#endif
+
+	std::lock_guard<std::mutex> lock(allocationsMutex);
+
+	allocations[pointer] = allocation;
+
+	return pointer;
+}
+
+void LargeBuffers::release(void* pointer) {
+	if (pointer == nullptr) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(allocationsMutex);
+
+	auto it = allocations.find(pointer);
+
+	if (it == allocations.end()) {
+		std::cout << "- Releasing unknown large buffer" << std::endl;
+
+		return;
+	}
+
+#ifdef __linux__
+	if (it->second.kind == EXPLICIT_HUGE_PAGES) {
+		munmap(pointer, it->second.mappedSize);
+	} else {
+		munmap(static_cast<char*>(pointer) - guardSize, it->second.mappedSize + 2 * guardSize);
+	}
+#else
+	if (it->second.kind == EXPLICIT_HUGE_PAGES) {
+#ifdef _WIN32
+		VirtualFree(pointer, 0, MEM_RELEASE);
+#endif
+	} else {
+		_aligned_free(pointer);
+	}
+#endif
+
+	allocations.erase(it);
+}
+
+void LargeBuffers::report() {
+	std::lock_guard<std::mutex> lock(allocationsMutex);
+
+	size_t hugeSize = 0;
+	size_t totalSize = 0;
+
+	for (const auto& it : allocations) {
+		const Allocation& allocation = it.second;
+
+		std::cout << "! " << allocation.name << " " << allocation.size / 1024 << " kB: ";
+
+		switch (allocation.kind) {
+			case EXPLICIT_HUGE_PAGES:
+				std::cout << "huge pages";
+				hugeSize += allocation.size;
+				break;
+			case TRANSPARENT_HUGE_PAGES: {
+#ifdef __linux__
+				long hugeKb = getAnonHugePagesKb(it.first);
+
+				std::cout << "transparent huge pages requested, " << (hugeKb < 0 ? 0 : hugeKb) << " kB backed";
+				hugeSize += std::min((size_t)std::max(hugeKb, 0L) * 1024, allocation.size);
+#endif
+				break;
+			}
+			default:
+				std::cout << "normal pages";
+				break;
+		}
+
+		std::cout << std::endl;
+
+		totalSize += allocation.size;
+	}
+
+	std::cout << "! Large buffers " << hugeSize / 1024 << " of " << totalSize / 1024 << " kB on huge pages" << std::endl;
+}
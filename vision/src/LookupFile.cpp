@@ -0,0 +1,379 @@
+#include "LookupFile.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	const unsigned char magic[4] = {'B', 'L', 'U', 'T'};
+	const size_t headerSize = 16;
+	const int channelBits = 8;
+	const int blockBits = 2;
+	const int blockSize = 64;
+	const unsigned int blockCount = 1u << 18;
+
+	enum RecordType : unsigned char {
+		UNIFORM_RUN = 0,
+		RAW_BLOCK = 1
+	};
+
+	// offset of the first entry of the block in the full lookup, same as Blobber::readBlock
+	size_t getBlockOffset(unsigned int block) {
+		return ((block & 63) << 2) + (((block >> 6) & 63) << 10) + ((block >> 12) << 18);
+	}
+
+	void putUint(std::vector<unsigned char>& out, unsigned int value, int bytes) {
+		for (int i = 0; i < bytes; i++) {
+			out.push_back((unsigned char)(value >> (8 * i)));
+		}
+	}
+
+	unsigned int getUint(const unsigned char* data, int bytes) {
+		unsigned int value = 0;
+
+		for (int i = 0; i < bytes; i++) {
+			value |= (unsigned int)data[i] << (8 * i);
+		}
+
+		return value;
+	}
+
+	void putVarint(std::vector<unsigned char>& out, unsigned int value) {
+		while (value >= 0x80) {
+			out.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+
+		out.push_back((unsigned char)value);
+	}
+
+	bool getVarint(const unsigned char*& data, const unsigned char* end, unsigned int& value) {
+		value = 0;
+
+		for (int shift = 0; shift < 32 && data < end; shift += 7) {
+			unsigned char byte = *data++;
+
+			value |= (unsigned int)(byte & 0x7f) << shift;
+
+			if ((byte & 0x80) == 0) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Returns false if the records do not cover exactly every block, they are also written to lookupOut if it is not nullptr
+	bool decodeBlocks(const unsigned char* data, const unsigned char* end, unsigned char* lookupOut) {
+		unsigned int block = 0;
+
+		while (data < end) {
+			unsigned char type = *data++;
+
+			if (type == UNIFORM_RUN) {
+				unsigned int count;
+
+				if (data >= end) {
+					return false;
+				}
+
+				unsigned char color = *data++;
+
+				if (!getVarint(data, end, count) || count == 0 || count > blockCount - block) {
+					return false;
+				}
+
+				if (lookupOut != nullptr) {
+					for (unsigned int i = block; i < block + count; i++) {
+						unsigned char* first = lookupOut + getBlockOffset(i);
+
+						for (int ri = 0; ri < 4; ri++) {
+							for (int gi = 0; gi < 4; gi++) {
+								memset(first + (gi << 8) + (ri << 16), color, 4);
+							}
+						}
+					}
+				}
+
+				block += count;
+			} else if (type == RAW_BLOCK) {
+				if (end - data < blockSize || block >= blockCount) {
+					return false;
+				}
+
+				if (lookupOut != nullptr) {
+					unsigned char* first = lookupOut + getBlockOffset(block);
+
+					for (int ri = 0; ri < 4; ri++) {
+						for (int gi = 0; gi < 4; gi++) {
+							memcpy(first + (gi << 8) + (ri << 16), data + ri * 16 + gi * 4, 4);
+						}
+					}
+				}
+
+				data += blockSize;
+				block++;
+			} else {
+				return false;
+			}
+		}
+
+		return block == blockCount;
+	}
+}
+
+unsigned int LookupFile::crc32(const unsigned char* data, size_t size) {
+	struct Table {
+		unsigned int values[256];
+
+		Table() {
+			for (unsigned int i = 0; i < 256; i++) {
+				unsigned int value = i;
+
+				for (int bit = 0; bit < 8; bit++) {
+					value = (value & 1) != 0 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+				}
+
+				values[i] = value;
+			}
+		}
+	};
+
+	static const Table table;
+
+	unsigned int crc = 0xffffffffu;
+
+	for (size_t i = 0; i < size; i++) {
+		crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xffffffffu;
+}
+
+std::vector<unsigned char> LookupFile::encode(const unsigned char* lookup, const std::vector<ClassInfo>& classes) {
+	std::vector<unsigned char> out(magic, magic + sizeof(magic));
+
+	putUint(out, VERSION, 2);
+	putUint(out, channelBits, 1);
+	putUint(out, blockBits, 1);
+	// payload size and checksum are filled in at the end
+	putUint(out, 0, 4);
+	putUint(out, 0, 4);
+
+	putUint(out, (unsigned int)classes.size(), 1);
+
+	for (const auto& info : classes) {
+		size_t nameLength = std::min(info.name.size(), (size_t)255);
+
+		out.push_back(info.color);
+		out.push_back(info.r);
+		out.push_back(info.g);
+		out.push_back(info.b);
+		out.push_back((unsigned char)nameLength);
+		out.insert(out.end(), info.name.begin(), info.name.begin() + nameLength);
+	}
+
+	unsigned char blockColors[blockSize];
+	int runColor = -1;
+	unsigned int runLength = 0;
+
+	for (unsigned int block = 0; block < blockCount; block++) {
+		const unsigned char* first = lookup + getBlockOffset(block);
+		bool uniform = true;
+
+		for (int ri = 0; ri < 4; ri++) {
+			for (int gi = 0; gi < 4; gi++) {
+				memcpy(blockColors + ri * 16 + gi * 4, first + (gi << 8) + (ri << 16), 4);
+			}
+		}
+
+		for (int i = 1; i < blockSize && uniform; i++) {
+			uniform = blockColors[i] == blockColors[0];
+		}
+
+		if (uniform && blockColors[0] == runColor) {
+			runLength++;
+
+			continue;
+		}
+
+		if (runLength > 0) {
+			out.push_back(UNIFORM_RUN);
+			out.push_back((unsigned char)runColor);
+			putVarint(out, runLength);
+		}
+
+		if (uniform) {
+			runColor = blockColors[0];
+			runLength = 1;
+		} else {
+			runColor = -1;
+			runLength = 0;
+
+			out.push_back(RAW_BLOCK);
+			out.insert(out.end(), blockColors, blockColors + blockSize);
+		}
+	}
+
+	if (runLength > 0) {
+		out.push_back(UNIFORM_RUN);
+		out.push_back((unsigned char)runColor);
+		putVarint(out, runLength);
+	}
+
+	auto payloadSize = (unsigned int)(out.size() - headerSize);
+	unsigned int checksum = crc32(out.data() + headerSize, payloadSize);
+
+	for (int i = 0; i < 4; i++) {
+		out[8 + i] = (unsigned char)(payloadSize >> (8 * i));
+		out[12 + i] = (unsigned char)(checksum >> (8 * i));
+	}
+
+	return out;
+}
+
+bool LookupFile::decode(const unsigned char* data, size_t size, unsigned char* lookupOut, std::vector<ClassInfo>* classesOut) {
+	if (size < headerSize || memcmp(data, magic, sizeof(magic)) != 0) {
+		return false;
+	}
+
+	unsigned int version = getUint(data + 4, 2);
+
+	if (version != VERSION || data[6] != channelBits || data[7] != blockBits) {
+		std::cout << "- Unsupported colors lookup version " << version << std::endl;
+
+		return false;
+	}
+
+	unsigned int payloadSize = getUint(data + 8, 4);
+
+	if (payloadSize != size - headerSize || crc32(data + headerSize, payloadSize) != getUint(data + 12, 4)) {
+		std::cout << "- Colors lookup is truncated or corrupt" << std::endl;
+
+		return false;
+	}
+
+	const unsigned char* position = data + headerSize;
+	const unsigned char* end = data + size;
+	std::vector<ClassInfo> classes;
+
+	if (position >= end) {
+		return false;
+	}
+
+	int classCount = *position++;
+
+	for (int i = 0; i < classCount; i++) {
+		if (end - position < 5 || end - position < 5 + position[4]) {
+			return false;
+		}
+
+		ClassInfo info;
+
+		info.color = position[0];
+		info.r = position[1];
+		info.g = position[2];
+		info.b = position[3];
+		info.name.assign(reinterpret_cast<const char*>(position + 5), position[4]);
+		classes.push_back(info);
+
+		position += 5 + position[4];
+	}
+
+	if (!decodeBlocks(position, end, nullptr)) {
+		std::cout << "- Colors lookup blocks are invalid" << std::endl;
+
+		return false;
+	}
+
+	decodeBlocks(position, end, lookupOut);
+
+	if (classesOut != nullptr) {
+		*classesOut = classes;
+	}
+
+	return true;
+}
+
+bool LookupFile::save(const std::string& filename, const unsigned char* lookup, const std::vector<ClassInfo>& classes) {
+	std::vector<unsigned char> data = encode(lookup, classes);
+	std::string temporaryFilename = filename + ".tmp";
+	FILE* file = fopen(temporaryFilename.c_str(), "wb");
+
+	if (!file) {
+		return false;
+	}
+
+	bool written = fwrite(data.data(), sizeof(char), data.size(), file) == data.size() && fflush(file) == 0;
+
+	// the data must be on disk before the rename replaces the old file
+#ifdef _WIN32
+	written = written && _commit(_fileno(file)) == 0;
+#else
+	written = written && fsync(fileno(file)) == 0;
+#endif
+
+	written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+	bool renamed = written && MoveFileExA(temporaryFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	bool renamed = written && rename(temporaryFilename.c_str(), filename.c_str()) == 0;
+#endif
+
+	if (!renamed) {
+		remove(temporaryFilename.c_str());
+
+		return false;
+	}
+
+	return true;
+}
+
+bool LookupFile::load(const std::string& filename, unsigned char* lookupOut, std::vector<ClassInfo>* classesOut) {
+	FILE* file = fopen(filename.c_str(), "rb");
+
+	if (!file) {
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	rewind(file);
+
+	unsigned char fileMagic[sizeof(magic)] = {};
+	bool hasMagic = fread(fileMagic, sizeof(char), sizeof(fileMagic), file) == sizeof(fileMagic)
+		&& memcmp(fileMagic, magic, sizeof(magic)) == 0;
+
+	rewind(file);
+
+	bool result = false;
+
+	// a lookup file of the legacy size is still decoded, so a damaged one is not taken for a raw lookup
+	if (!hasMagic && fileSize == LOOKUP_SIZE) {
+		// legacy lookups are read straight into place
+		result = fread(lookupOut, sizeof(char), LOOKUP_SIZE, file) == LOOKUP_SIZE;
+
+		if (result && classesOut != nullptr) {
+			classesOut->clear();
+		}
+	} else if (hasMagic) {
+		std::vector<unsigned char> data((size_t)fileSize);
+
+		result = fread(data.data(), sizeof(char), data.size(), file) == data.size()
+			&& decode(data.data(), data.size(), lookupOut, classesOut);
+	} else {
+		std::cout << "- " << filename << " is not a colors lookup" << std::endl;
+	}
+
+	fclose(file);
+
+	return result;
+}
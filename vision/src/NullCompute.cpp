@@ -0,0 +1,53 @@
+#include <cstring>
+#include "NullCompute.h"
+
+void NullCompute::deBayer(
+		unsigned char *frame,
+		unsigned char *rgbOut,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	if (rgbOut != nullptr) {
+		memset(rgbOut, 0, static_cast<size_t>(3 * width * height));
+	}
+
+	memset(segmentedOut, 0, static_cast<size_t>(width * height));
+}
+
+void NullCompute::segmentQuads(
+		unsigned char *frame,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	memset(segmentedOut, 0, static_cast<size_t>(width / 2 * height / 2));
+}
+
+void NullCompute::kMeans(
+		unsigned char* rgb,
+		unsigned char* clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height
+) {
+	memset(clustered, 0, static_cast<size_t>(width * height));
+}
+
+void NullCompute::enqueueKMeansIterations(
+		unsigned char* bgr,
+		unsigned char* clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height,
+		int sampleStep,
+		int maxIterations
+) {
+	memset(clustered, 0, static_cast<size_t>(width * height));
+}
@@ -1,37 +1,136 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <Util.h>
 #include "OpenCLCompute.h"
-
-OpenCLCompute::OpenCLCompute() {
-	inputBuffer = nullptr;
-	rgbOutBuffer = nullptr;
-	lookupBuffer = nullptr;
-	segmentedBuffer = nullptr;
+#include "Config.h"
+#include "EmbeddedKernels.h"
+#include <json.hpp>
+
+#ifndef CL_QUEUE_PRIORITY_KHR
+// cl_khr_priority_hints, missing from older headers
+#define CL_QUEUE_PRIORITY_KHR 0x1096
+#define CL_QUEUE_PRIORITY_HIGH_KHR (1 << 0)
+#define CL_QUEUE_PRIORITY_LOW_KHR (1 << 2)
+#endif
+
+// Color of the first frame pixel, 0 for RGGB, 3 for BGGR. CpuCompute only handles RGGB.
+static const int bayerPhase = 0;
+
+// Tuned work groups of every device this has run on, see tune
+static const char* workGroupsFilename = "work-groups.json";
+
+OpenCLCompute::OpenCLCompute(std::string platformName, cl_device_type deviceType) :
+	platformName(std::move(platformName)),
+	deviceType(deviceType)
+{
+	rowRunCountsBuffer = nullptr;
+	rowRunOffsetsBuffer = nullptr;
+	rowRunBufferRows = 0;
+	rowStartsBuffer = nullptr;
+	labelsBuffer = nullptr;
+	regionIdsBuffer = nullptr;
+	regionCountBuffer = nullptr;
+	labelRowCapacity = 0;
+	labelRunCapacity = 0;
+
+	clContext = nullptr;
+	clQueue = nullptr;
+	calibrationQueue = nullptr;
+	calibrationEvent = nullptr;
+
+	deBayerProgram = nullptr;
+	deBayerKernel = nullptr;
+	deBayerBorderKernel = nullptr;
+	segmentKernel = nullptr;
+	segmentBorderKernel = nullptr;
+	segmentQuadsKernel = nullptr;
+	classifyTilesKernel = nullptr;
+	projectClassesKernel = nullptr;
+	previewKernel = nullptr;
+	deBayerWidth = 0;
+	deBayerHeight = 0;
+	deBayerLookupSize = 0;
+	deBayerWorkGroup = {0, 0, false};
+	segmentQuadsWorkGroup = {0, 0, false};
+	kMeansWorkGroup = {0, 0, false};
+	workGroupsLoaded = false;
+	encodeRunsProgram = nullptr;
+	countRunsKernel = nullptr;
+	scanRunCountsKernel = nullptr;
+	encodeRunsKernel = nullptr;
+	labelRegionsProgram = nullptr;
+	findRowStartsKernel = nullptr;
+	mergeRunsKernel = nullptr;
+	flattenLabelsKernel = nullptr;
+	numberRegionsKernel = nullptr;
+	accumulateRegionsKernel = nullptr;
+	kMeansProgram = nullptr;
+	kMeansKernel = nullptr;
+	kMeansAccumulateKernel = nullptr;
+	kMeansUpdateKernel = nullptr;
+	kMeansCentroidsBuffer = nullptr;
+	kMeansSumsBuffer = nullptr;
+	kMeansStateBuffer = nullptr;
 }
 
 OpenCLCompute::~OpenCLCompute() {
-	clReleaseMemObject(rgbOutBuffer);
-	clReleaseMemObject(inputBuffer);
-	clReleaseMemObject(lookupBuffer);
-	clReleaseMemObject(segmentedBuffer);
+	if (clQueue != nullptr) clFinish(clQueue);
+	if (calibrationQueue != nullptr) clFinish(calibrationQueue);
+	if (calibrationEvent != nullptr) clReleaseEvent(calibrationEvent);
+
+	for (auto& frameEvent : frameEvents) {
+		if (frameEvent.second != nullptr) clReleaseEvent(frameEvent.second);
+	}
+
+	for (auto& hostBuffer : hostBuffers) {
+		clReleaseMemObject(hostBuffer.second.buffer);
+	}
+
+	if (rowRunCountsBuffer != nullptr) clReleaseMemObject(rowRunCountsBuffer);
+	if (rowRunOffsetsBuffer != nullptr) clReleaseMemObject(rowRunOffsetsBuffer);
+	if (rowStartsBuffer != nullptr) clReleaseMemObject(rowStartsBuffer);
+	if (labelsBuffer != nullptr) clReleaseMemObject(labelsBuffer);
+	if (regionIdsBuffer != nullptr) clReleaseMemObject(regionIdsBuffer);
+	if (regionCountBuffer != nullptr) clReleaseMemObject(regionCountBuffer);
+
+	releaseDeBayer();
+
+	releaseEncodeRuns();
 
-	clReleaseKernel(deBayerKernel);
-	clReleaseProgram(deBayerProgram);
+	releaseLabelRegions();
 
-	clReleaseKernel(kMeansKernel);
-	clReleaseProgram(kMeansProgram);
+	if (kMeansCentroidsBuffer != nullptr) clReleaseMemObject(kMeansCentroidsBuffer);
+	if (kMeansSumsBuffer != nullptr) clReleaseMemObject(kMeansSumsBuffer);
+	if (kMeansStateBuffer != nullptr) clReleaseMemObject(kMeansStateBuffer);
+	if (kMeansKernel != nullptr) clReleaseKernel(kMeansKernel);
+	if (kMeansAccumulateKernel != nullptr) clReleaseKernel(kMeansAccumulateKernel);
+	if (kMeansUpdateKernel != nullptr) clReleaseKernel(kMeansUpdateKernel);
+	if (kMeansProgram != nullptr) clReleaseProgram(kMeansProgram);
 
-	clReleaseKernel(generateLookupTableKernel);
-	clReleaseProgram(generateLookupTableProgram);
 
-	clReleaseCommandQueue(clQueue);
-	clReleaseContext(clContext);
+	if (clQueue != nullptr) clReleaseCommandQueue(clQueue);
+	if (calibrationQueue != nullptr) clReleaseCommandQueue(calibrationQueue);
+	if (clContext != nullptr) clReleaseContext(clContext);
 }
 
-void OpenCLCompute::setup() {
-	bool isDeviceFound = findDevice("Intel(R) OpenCL", "Intel");
+std::string OpenCLCompute::getName() {
+	if (selectedDeviceIds.empty()) {
+		return "opencl";
+	}
+
+	return "opencl (" + GetPlatformName(selectedPlatformIds[0]) + ", " + GetDeviceName(selectedDeviceIds[0]) + ")";
+}
+
+bool OpenCLCompute::setup() {
+	if (!findDevice(platformName, deviceType)) {
+		return false;
+	}
 
 	const cl_context_properties contextProperties[] = {
 			CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties> (selectedPlatformIds[0]),
@@ -48,16 +147,99 @@ void OpenCLCompute::setup() {
 			&error
 	);
 
-	setupDeBayer();
-	setupKMeans();
-	setupGenerateLookupTable();
+	if (!CheckError(error, "Create context")) {
+		return false;
+	}
+
+	if (!setupDeBayer(Config::cameraWidth, Config::cameraHeight, 0x1000000) || !setupKMeans()) {
+		return false;
+	}
+
+	// optional, the Blobber encodes runs on the CPU when encodeRuns returns -1
+	if (!setupEncodeRuns()) {
+		std::cout << "- Device run encoding not available, using the CPU" << std::endl;
+
+		releaseEncodeRuns();
+	}
+
+	// optional, the Blobber extracts regions on the CPU when labelRegions returns -1
+	if (!setupLabelRegions()) {
+		std::cout << "- Device region labeling not available, using the CPU" << std::endl;
+
+		releaseLabelRegions();
+	}
+
+	clQueue = createCommandQueue(true);
+	calibrationQueue = createCommandQueue(false);
+
+	if (clQueue == nullptr || calibrationQueue == nullptr) {
+		return false;
+	}
+
+	workGroupsLoaded = loadWorkGroups();
+
+	return true;
+}
+
+// Queue with a priority hint when the device supports cl_khr_priority_hints, a plain queue otherwise
+cl_command_queue OpenCLCompute::createCommandQueue(bool highPriority) {
+	cl_int error = CL_SUCCESS;
+	cl_command_queue queue = nullptr;
+
+#ifdef CL_VERSION_2_0
+	if (GetDeviceInfoString(selectedDeviceIds[0], CL_DEVICE_EXTENSIONS).find("cl_khr_priority_hints") != std::string::npos) {
+		const cl_queue_properties properties[] = {
+				CL_QUEUE_PRIORITY_KHR, highPriority ? CL_QUEUE_PRIORITY_HIGH_KHR : CL_QUEUE_PRIORITY_LOW_KHR,
+				0
+		};
+
+		queue = clCreateCommandQueueWithProperties(clContext, selectedDeviceIds[0], properties, &error);
+
+		if (queue != nullptr) {
+			return queue;
+		}
+	}
+#endif
+
+	queue = clCreateCommandQueue(clContext, selectedDeviceIds[0], 0, &error);
+
+	if (!CheckError(error, "Create command queue")) {
+		return nullptr;
+	}
+
+	return queue;
+}
+
+std::vector<std::string> OpenCLCompute::getAvailableSpecs() {
+	std::vector<std::string> specs;
+
+	cl_uint platformIdCount = 0;
+	clGetPlatformIDs(0, nullptr, &platformIdCount);
+
+	if (platformIdCount == 0) {
+		return specs;
+	}
+
+	std::vector<cl_platform_id> platformIds(platformIdCount);
+	clGetPlatformIDs(platformIdCount, platformIds.data(), nullptr);
 
-	const cl_queue_properties queueProperties[] = {0};
-	clQueue = clCreateCommandQueue(clContext, selectedDeviceIds[0], 0, &error);
-	CheckError(error, "Create command queue");
+	for (cl_platform_id platformId : platformIds) {
+		std::string platform = GetPlatformName(platformId);
+
+		for (cl_device_type type : {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU}) {
+			cl_uint deviceIdCount = 0;
+			clGetDeviceIDs(platformId, type, 0, nullptr, &deviceIdCount);
+
+			if (deviceIdCount > 0) {
+				specs.push_back("opencl:" + platform + (type == CL_DEVICE_TYPE_GPU ? ":gpu" : ":cpu"));
+			}
+		}
+	}
+
+	return specs;
 }
 
-bool OpenCLCompute::findDevice(std::string platformName, std::string deviceVendor) {
+bool OpenCLCompute::findDevice(std::string platformName, cl_device_type deviceType) {
 	cl_uint platformIdCount = 0;
 	clGetPlatformIDs(0, nullptr, &platformIdCount);
 
@@ -71,58 +253,66 @@ bool OpenCLCompute::findDevice(std::string platformName, std::string deviceVendo
 	std::vector<cl_platform_id> platformIds(platformIdCount);
 	clGetPlatformIDs(platformIdCount, platformIds.data(), nullptr);
 
-	for (cl_uint i = 0; i < platformIdCount; ++i) {
-		std::string platform = GetPlatformName(platformIds[i]);
+	// When any device type is allowed, GPU devices on all matching platforms are tried first
+	std::vector<cl_device_type> searchTypes;
+
+	if (deviceType == CL_DEVICE_TYPE_ALL) {
+		searchTypes = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+	} else {
+		searchTypes = {deviceType};
+	}
 
-		std::cout << "Platform: " << platform << std::endl;
+	for (cl_device_type searchType : searchTypes) {
+		for (cl_uint i = 0; i < platformIdCount; ++i) {
+			std::string platform = GetPlatformName(platformIds[i]);
 
-		if (platform.find(platformName) != std::string::npos) {
-			selectedPlatformIds.push_back(platformIds[i]);
-			//matchingPlatformIds[0] = platformIds[i];
-			std::cout << "\tMatch" << std::endl;
+			std::cout << "Platform: " << platform << std::endl;
+
+			if (platform.find(platformName) == std::string::npos) {
+				continue;
+			}
 
 			cl_uint deviceIdCount = 0;
 			clGetDeviceIDs(platformIds[i], CL_DEVICE_TYPE_ALL, 0, nullptr, &deviceIdCount);
 
 			if (deviceIdCount == 0) {
-				break;
+				continue;
 			}
 
 			std::vector<cl_device_id> deviceIds(deviceIdCount);
 			clGetDeviceIDs(platformIds[i], CL_DEVICE_TYPE_ALL, deviceIdCount, deviceIds.data(), nullptr);
 
 			for (cl_uint j = 0; j < deviceIdCount; ++j) {
-				std::string vendor = GetDeviceVendor(deviceIds[j]);
-				int type = GetDeviceType(deviceIds[j]);
+				cl_device_type type = GetDeviceType(deviceIds[j]);
 
-				std::cout << "Device: " << GetDeviceName(deviceIds[j]) << std::endl;
+				std::cout << "Device: " << GetDeviceName(deviceIds[j]) << " (" << GetDeviceVendor(deviceIds[j]) << ")" << std::endl;
 
-				if (
-						platform.find(platformName) != std::string::npos &&
-						vendor.find(deviceVendor) != std::string::npos &&
-						type == CL_DEVICE_TYPE_GPU
-				) {
+				if ((type & searchType) != 0) {
+					cl_bool hostUnifiedMemory = CL_FALSE;
+					clGetDeviceInfo(deviceIds[j], CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &hostUnifiedMemory, nullptr);
+
+					// host buffers are shared without mapping, see getHostBuffer
+					if (hostUnifiedMemory != CL_TRUE) {
+						std::cout << "\tSkipped, no host unified memory" << std::endl;
+
+						continue;
+					}
+
+					selectedPlatformIds.push_back(platformIds[i]);
 					selectedDeviceIds.push_back(deviceIds[j]);
 					std::cout << "\tMatch" << std::endl;
 
 					LogDeviceSVM(deviceIds[j]);
 
-					break;
+					return true;
 				}
 			}
-
-			if (!selectedPlatformIds.empty()) {
-				break;
-			}
 		}
 	}
 
-	if (selectedDeviceIds.empty()) {
-		std::cerr << "No OpenCL devices found" << std::endl;
-		return false;
-	}
+	std::cerr << "No OpenCL devices found" << std::endl;
 
-	return true;
+	return false;
 }
 
 std::string OpenCLCompute::GetPlatformName(cl_platform_id id) {
@@ -134,7 +324,7 @@ std::string OpenCLCompute::GetPlatformName(cl_platform_id id) {
 	clGetPlatformInfo(id, CL_PLATFORM_NAME, size,
 					  const_cast<char *> (result.data()), nullptr);
 
-	return result;
+	return result.c_str();
 }
 
 std::string OpenCLCompute::GetDeviceName(cl_device_id id) {
@@ -146,7 +336,18 @@ std::string OpenCLCompute::GetDeviceName(cl_device_id id) {
 	clGetDeviceInfo(id, CL_DEVICE_NAME, size,
 					const_cast<char *> (result.data()), nullptr);
 
-	return result;
+	return result.c_str();
+}
+
+std::string OpenCLCompute::GetDeviceInfoString(cl_device_id id, cl_device_info param) {
+	size_t size = 0;
+	clGetDeviceInfo(id, param, 0, nullptr, &size);
+
+	std::string result;
+	result.resize(size);
+	clGetDeviceInfo(id, param, size, const_cast<char *> (result.data()), nullptr);
+
+	return result.c_str();
 }
 
 std::string OpenCLCompute::GetDeviceVendor(cl_device_id id) {
@@ -157,15 +358,12 @@ std::string OpenCLCompute::GetDeviceVendor(cl_device_id id) {
 	result.resize(size);
 	clGetDeviceInfo(id, CL_DEVICE_VENDOR, size, const_cast<char *> (result.data()), nullptr);
 
-	return result;
+	return result.c_str();
 }
 
-int OpenCLCompute::GetDeviceType(cl_device_id id) {
-	size_t size = 0;
-	clGetDeviceInfo(id, CL_DEVICE_TYPE, 0, nullptr, &size);
-
-	int deviceType = CL_DEVICE_TYPE_DEFAULT;
-	clGetDeviceInfo(id, CL_DEVICE_TYPE, size, &deviceType, &size);
+cl_device_type OpenCLCompute::GetDeviceType(cl_device_id id) {
+	cl_device_type deviceType = CL_DEVICE_TYPE_DEFAULT;
+	clGetDeviceInfo(id, CL_DEVICE_TYPE, sizeof(cl_device_type), &deviceType, nullptr);
 
 	return deviceType;
 }
@@ -198,19 +396,25 @@ void OpenCLCompute::LogDeviceSVM(cl_device_id id) {
 
 
 
-void OpenCLCompute::CheckError(cl_int error, std::string message) {
+bool OpenCLCompute::CheckError(cl_int error, std::string message) {
 	if (error != CL_SUCCESS) {
 		std::cerr << "OpenCL error " << error << " " << message << std::endl;
 		//std::exit(1);
+		return false;
 	}
+
+	return true;
 }
 
+// Kernel sources are embedded from kernels/*.cl at build time, see CMakeLists.txt
 std::string OpenCLCompute::LoadKernel(const char *name) {
-	std::ifstream in(name);
-	std::string result(
-			(std::istreambuf_iterator<char>(in)),
-			std::istreambuf_iterator<char>());
-	return result;
+	for (const EmbeddedKernel* kernel = embeddedKernels; kernel->name != nullptr; kernel++) {
+		if (strcmp(kernel->name, name) == 0) {
+			return kernel->source;
+		}
+	}
+
+	return "";
 }
 
 cl_program OpenCLCompute::CreateProgram(const std::string &source, cl_context context) {
@@ -224,303 +428,1584 @@ cl_program OpenCLCompute::CreateProgram(const std::string &source, cl_context co
 	return program;
 }
 
-void OpenCLCompute::setupDeBayer() {
-	cl_int error = CL_SUCCESS;
+// Key of a compiled program, binaries are only valid for exactly the same device, driver, options and source
+std::string OpenCLCompute::GetProgramCacheKey(const std::string &source, const std::string &options) {
+	cl_device_id device = selectedDeviceIds[0];
 
-	/*deBayerContext = clCreateContextFromType(
-			contextProperties,
-			CL_DEVICE_TYPE_GPU,
-			nullptr,
-			nullptr,
-			&error
-	);
-	CheckError(error, "Create context");*/
+	std::string key = GetDeviceName(device) + "\n"
+			+ GetDeviceInfoString(device, CL_DRIVER_VERSION) + "\n"
+			+ GetDeviceInfoString(device, CL_DEVICE_VERSION) + "\n"
+			+ options + "\n";
 
-	deBayerProgram = CreateProgram(LoadKernel("../kernels/debayer.cl"), clContext);
+	return key + GetHashText(source);
+}
 
-	CheckError(clBuildProgram(
-			deBayerProgram,
-			static_cast<cl_uint>(selectedDeviceIds.size()),
-			selectedDeviceIds.data(),
-			nullptr,
-			nullptr,
-			nullptr
-	), "Build program");
+// 64 bit FNV-1a as hex
+std::string OpenCLCompute::GetHashText(const std::string &text) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (unsigned char c : text) {
+		hash = (hash ^ c) * 1099511628211ULL;
+	}
 
-	deBayerKernel = clCreateKernel(deBayerProgram, "debayerAndSegment", &error);
-	CheckError(error, "Create kernel");
+	char hashText[17];
+	snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(hash));
 
-	/*
-	const cl_queue_properties queueProperties[] = {0};
+	return hashText;
+}
 
-	clQueue = clCreateCommandQueue(clContext, selectedDeviceIds[0], 0, &error);
-	//clQueue = clCreateCommandQueueWithProperties(deBayerContext, selectedDeviceIds[0], queueProperties, &error);
-	CheckError(error, "Create command queue");
+std::string OpenCLCompute::GetProgramCacheFilename(const char *kernelFile, const std::string &key) {
+	std::string name(kernelFile);
+	size_t nameStart = name.find_last_of("/\\");
 
-	clFinish(clQueue);
-	 */
+	if (nameStart != std::string::npos) {
+		name = name.substr(nameStart + 1);
+	}
+
+	return "kernel-cache-" + name + "-" + GetHashText(key) + ".bin";
 }
 
-void OpenCLCompute::deBayer(
-		unsigned char *frame,
-		unsigned char *rgbOut,
-		unsigned char *lookup,
-		unsigned char *segmentedOut,
-		int width,
-		int height,
-		int colorsLookupSize
-) {
-	__int64 startTime = Util::timerStart();
+// Cache file is the key length, the key and the program binary. The whole key is compared on load
+// so a hash collision or a partly written file never gives a wrong binary.
+cl_program OpenCLCompute::LoadCachedProgram(const std::string &filename, const std::string &key) {
+	std::ifstream in(filename, std::ios::binary);
 
-	cl_int error = CL_SUCCESS;
+	if (!in) {
+		return nullptr;
+	}
+
+	uint32_t keyLength = 0;
+	in.read(reinterpret_cast<char *>(&keyLength), sizeof(keyLength));
+
+	if (!in || keyLength != key.size()) {
+		return nullptr;
+	}
+
+	std::string storedKey(keyLength, '\0');
+	in.read(&storedKey[0], keyLength);
+
+	if (!in || storedKey != key) {
+		return nullptr;
+	}
 
-	if (inputBuffer == nullptr) {
-		inputBuffer = clCreateBuffer(
-				clContext,
-				//CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-				CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-				width * height * sizeof(char),
-				(void *)frame,
-				&error
-		);
+	std::vector<unsigned char> binary(
+			(std::istreambuf_iterator<char>(in)),
+			std::istreambuf_iterator<char>());
 
-		CheckError(error, "Could not create inputBuffer");
+	if (binary.empty()) {
+		return nullptr;
 	}
 
-	if (rgbOutBuffer == nullptr) {
-		rgbOutBuffer = clCreateBuffer(
-				clContext,
-				//CL_MEM_WRITE_ONLY,
-				CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-				3 * width * height * sizeof(char),
-				rgbOut,
-				&error
-		);
+	size_t binarySize = binary.size();
+	const unsigned char *binaries[1] = {binary.data()};
+	cl_int binaryStatus = CL_SUCCESS;
+	cl_int error = CL_SUCCESS;
+
+	cl_program program = clCreateProgramWithBinary(
+			clContext,
+			1,
+			selectedDeviceIds.data(),
+			&binarySize,
+			binaries,
+			&binaryStatus,
+			&error
+	);
+
+	if (error != CL_SUCCESS || binaryStatus != CL_SUCCESS) {
+		if (program != nullptr) clReleaseProgram(program);
 
-		CheckError(error, "Could not create rgbOutBuffer");
+		return nullptr;
 	}
 
-	if (lookupBuffer == nullptr) {
-		lookupBuffer = clCreateBuffer(
-				clContext,
-				CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-				static_cast<size_t>(colorsLookupSize),
-				(void *)lookup,
-				&error
-		);
+	return program;
+}
+
+void OpenCLCompute::SaveCachedProgram(cl_program program, const std::string &filename, const std::string &key) {
+	size_t binarySize = 0;
 
-		CheckError(error, "Could not create lookupBuffer");
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, nullptr) != CL_SUCCESS
+		|| binarySize == 0) {
+		return;
 	}
 
-	if (segmentedBuffer == nullptr) {
-		segmentedBuffer = clCreateBuffer(
-				clContext,
-				CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-				width * height * sizeof(char),
-				segmentedOut,
-				&error
-		);
+	std::vector<unsigned char> binary(binarySize);
+	unsigned char *binaries[1] = {binary.data()};
 
-		CheckError(error, "Could not create segmentedBuffer");
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr) != CL_SUCCESS) {
+		return;
 	}
 
-	/*clEnqueueUnmapMemObject(clQueue, rgbOutBuffer, rgbOut, 0, nullptr, nullptr);
-	clEnqueueUnmapMemObject(clQueue, segmentedBuffer, segmentedOut, 0, nullptr, nullptr);
-	clEnqueueUnmapMemObject(clQueue, lookupBuffer, lookup, 0, nullptr, nullptr);*/
+	// written under a temporary name first so an interrupted write is never loaded
+	std::string temporaryFilename = filename + ".tmp";
+	std::ofstream out(temporaryFilename, std::ios::binary | std::ios::trunc);
 
-	clSetKernelArg(deBayerKernel, 0, sizeof(cl_mem), &inputBuffer);
-	clSetKernelArg(deBayerKernel, 1, sizeof(cl_mem), &rgbOutBuffer);
-	clSetKernelArg(deBayerKernel, 2, sizeof(cl_mem), &lookupBuffer);
-	clSetKernelArg(deBayerKernel, 3, sizeof(cl_mem), &segmentedBuffer);
+	auto keyLength = static_cast<uint32_t>(key.size());
+	out.write(reinterpret_cast<const char *>(&keyLength), sizeof(keyLength));
+	out.write(key.data(), key.size());
+	out.write(reinterpret_cast<const char *>(binary.data()), binary.size());
+	out.close();
 
-	// http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clEnqueueNDRangeKernel.html
-	std::size_t offset[3] = {0};
-	std::size_t size[3] = {static_cast<size_t>(width / 2), static_cast<size_t>(height / 2), 1};
-	/*CheckError(*/clEnqueueNDRangeKernel(clQueue, deBayerKernel, 2, offset, size, nullptr, 0, nullptr, nullptr)/*)*/;
+	if (!out) {
+		std::remove(temporaryFilename.c_str());
+		std::cout << "- Could not write program cache " << filename << std::endl;
+		return;
+	}
 
-	/*lookup = (unsigned char*)clEnqueueMapBuffer(
-			clQueue,
-			lookupBuffer,
-			CL_TRUE,
-			CL_MAP_READ,
-			0,
-			static_cast<size_t>(colorsLookupSize),
-			0,
-			nullptr,
-			nullptr,
-			nullptr
-	);
+	std::remove(filename.c_str());
 
-	rgbOut = (unsigned char*)clEnqueueMapBuffer(
-			clQueue,
-			rgbOutBuffer,
-			CL_TRUE,
-			CL_MAP_WRITE,
-			0,
-			3 * width * height * sizeof(char),
-			0,
-			nullptr,
-			nullptr,
-			nullptr
-	);
+	if (std::rename(temporaryFilename.c_str(), filename.c_str()) != 0) {
+		std::remove(temporaryFilename.c_str());
+	}
+}
 
-	segmentedOut = (unsigned char*)clEnqueueMapBuffer(
-			clQueue,
-			segmentedBuffer,
-			CL_TRUE,
-			CL_MAP_WRITE,
-			0,
-			width * height * sizeof(char),
-			0,
-			nullptr,
-			nullptr,
-			nullptr
-	);*/
+void OpenCLCompute::LogBuildLog(cl_program program, const char *kernelFile) {
+	size_t size = 0;
+	clGetProgramBuildInfo(program, selectedDeviceIds[0], CL_PROGRAM_BUILD_LOG, 0, nullptr, &size);
 
-	clFinish(clQueue);
+	std::string log;
+	log.resize(size);
+	clGetProgramBuildInfo(program, selectedDeviceIds[0], CL_PROGRAM_BUILD_LOG, size,
+						  const_cast<char *> (log.data()), nullptr);
 
-	//std::cout << "! deBayer time: " << Util::timerEnd(startTime) << std::endl;
+	std::cerr << "Build log of " << kernelFile << ":" << std::endl << log.c_str() << std::endl;
 }
 
-void OpenCLCompute::setupKMeans() {
-    cl_int error = CL_SUCCESS;
+// Loads the program from the binary cache when the device, driver, options and source match the cached build,
+// otherwise builds it from source and caches the result. Returns nullptr if the build fails.
+cl_program OpenCLCompute::BuildProgram(const char *kernelFile, const std::string &options) {
+	std::string source = LoadKernel(kernelFile);
 
-    kMeansProgram = CreateProgram(LoadKernel("../kernels/kmeans.cl"), clContext);
+	if (source.empty()) {
+		std::cerr << "Could not load kernel " << kernelFile << std::endl;
+		return nullptr;
+	}
 
-    CheckError(clBuildProgram(
-            kMeansProgram,
-            static_cast<cl_uint>(selectedDeviceIds.size()),
-            selectedDeviceIds.data(),
-            nullptr,
-            nullptr,
-            nullptr
-    ), "Build program");
+	std::string key = GetProgramCacheKey(source, options);
+	std::string cacheFilename = GetProgramCacheFilename(kernelFile, key);
 
-    kMeansKernel = clCreateKernel(kMeansProgram, "kMeans", &error);
-    CheckError(error, "Create kernel");
-}
+	cl_program program = LoadCachedProgram(cacheFilename, key);
 
-void OpenCLCompute::kMeans(
-		unsigned char* rgb,
-		unsigned char*  clustered,
-		unsigned char* centroids,
-		int centroidCount,
-		int width,
-		int height
-) {
-	__int64 startTime = Util::timerStart();
+	if (program != nullptr) {
+		if (clBuildProgram(program, 1, selectedDeviceIds.data(), options.c_str(), nullptr, nullptr) == CL_SUCCESS) {
+			std::cout << "! Loaded " << kernelFile << " from " << cacheFilename << std::endl;
 
-	cl_int error = CL_SUCCESS;
+			return program;
+		}
 
-	cl_mem inputBuffer = clCreateBuffer(
-			clContext,
-			//CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-			CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-			3 * width * height * sizeof(char),
-			(void *)rgb,
-			&error
-	);
+		std::cout << "- Cached " << cacheFilename << " could not be used, building from source" << std::endl;
 
-	CheckError(error, "Could not create inputBuffer");
+		clReleaseProgram(program);
+	}
 
-	cl_mem clusteredBuffer = clCreateBuffer(
-			clContext,
-			//CL_MEM_WRITE_ONLY,
-			CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-			width * height * sizeof(char),
-			clustered,
-			&error
-	);
+	program = CreateProgram(source, clContext);
 
-	CheckError(error, "Could not create clusteredBuffer");
+	if (program == nullptr) {
+		return nullptr;
+	}
 
-	cl_mem centroidsBuffer = clCreateBuffer(
-			clContext,
-			//CL_MEM_WRITE_ONLY,
-			CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-			3 * centroidCount * sizeof(char),
-			centroids,
-			&error
-	);
+	cl_int error = clBuildProgram(program, 1, selectedDeviceIds.data(), options.c_str(), nullptr, nullptr);
 
-	CheckError(error, "Could not create centroidsBuffer");
+	if (!CheckError(error, std::string("Build program ") + kernelFile)) {
+		if (error == CL_BUILD_PROGRAM_FAILURE) {
+			LogBuildLog(program, kernelFile);
+		}
 
-	clSetKernelArg(kMeansKernel, 0, sizeof(cl_mem), &inputBuffer);
-	clSetKernelArg(kMeansKernel, 1, sizeof(cl_mem), &clusteredBuffer);
-	clSetKernelArg(kMeansKernel, 2, sizeof(cl_mem), &centroidsBuffer);
-	clSetKernelArg(kMeansKernel, 3, sizeof(int), &centroidCount);
+		clReleaseProgram(program);
 
-	// http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clEnqueueNDRangeKernel.html
-	std::size_t offset[2] = {0};
-	std::size_t size[2] = {static_cast<size_t>(width), static_cast<size_t>(height)};
-	/*CheckError(*/clEnqueueNDRangeKernel(clQueue, kMeansKernel, 2, offset, size, nullptr, 0, nullptr, nullptr)/*)*/;
-	clFinish(clQueue);
+		return nullptr;
+	}
+
+	SaveCachedProgram(program, cacheFilename, key);
 
-	//std::cout << "! kMeans time: " << Util::timerEnd(startTime) << std::endl;
+	return program;
 }
 
-void OpenCLCompute::setupGenerateLookupTable() {
+// The debayer program is specialized for the frame size and lookup layout so the address math folds to constants,
+// it is rebuilt when called with a different size
+bool OpenCLCompute::setupDeBayer(int width, int height, int colorsLookupSize) {
 	cl_int error = CL_SUCCESS;
 
-	generateLookupTableProgram = CreateProgram(LoadKernel("../kernels/generate_lookup_table.cl"), clContext);
+	releaseDeBayer();
 
-	CheckError(clBuildProgram(
-			generateLookupTableProgram,
-			static_cast<cl_uint>(selectedDeviceIds.size()),
-			selectedDeviceIds.data(),
-			nullptr,
-			nullptr,
-			nullptr
-	), "Build program");
+	std::string options = "-D WIDTH=" + std::to_string(width)
+			+ " -D HEIGHT=" + std::to_string(height)
+			+ " -D BAYER_PHASE=" + std::to_string(bayerPhase)
+			+ " -D LUT_BITS=" + std::to_string(getLookupBits(colorsLookupSize));
 
-	generateLookupTableKernel = clCreateKernel(generateLookupTableProgram, "generate_lookup_table", &error);
-	CheckError(error, "Create kernel");
-}
+	cl_ulong constantBufferSize = 0;
+	clGetDeviceInfo(selectedDeviceIds[0], CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, sizeof(cl_ulong), &constantBufferSize, nullptr);
 
-void OpenCLCompute::generateLookupTable(
-    unsigned char *centroids,
-    unsigned char *lookupTable,
-    int centroidIndex,
-    int centroidCount,
-	unsigned char color
-) {
-    __int64 startTime = Util::timerStart();
+	// compact lookups are read through the constant cache
+	if ((cl_ulong)colorsLookupSize <= constantBufferSize) {
+		options += " -D LUT_CONSTANT";
+	}
 
-    cl_int error = CL_SUCCESS;
+	if (deBayerWorkGroup.tiled) {
+		options += " -D TILE_WIDTH=" + std::to_string(deBayerWorkGroup.width)
+				+ " -D TILE_HEIGHT=" + std::to_string(deBayerWorkGroup.height);
+	}
+
+	deBayerProgram = BuildProgram("debayer.cl", options);
+
+	if (deBayerProgram == nullptr) {
+		return false;
+	}
+
+	// tiled kernels take the same arguments and replace the interior ones
+	deBayerKernel = clCreateKernel(deBayerProgram, deBayerWorkGroup.tiled ? "debayerAndSegmentTiled" : "debayerAndSegment", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	deBayerBorderKernel = clCreateKernel(deBayerProgram, "debayerAndSegmentBorder", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	segmentKernel = clCreateKernel(deBayerProgram, deBayerWorkGroup.tiled ? "segmentTiled" : "segment", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	segmentBorderKernel = clCreateKernel(deBayerProgram, "segmentBorder", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	segmentQuadsKernel = clCreateKernel(deBayerProgram, "segmentQuads", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	classifyTilesKernel = clCreateKernel(deBayerProgram, "classifyTiles", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	projectClassesKernel = clCreateKernel(deBayerProgram, "projectClasses", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	previewKernel = clCreateKernel(deBayerProgram, "preview", &error);
 
-    cl_mem lookupTableBuffer = clCreateBuffer(
-            clContext,
-            //CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-            CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-            256 * 256 * 256 * sizeof(unsigned char),
-            (void *)lookupTable,
-            &error
-    );
-
-    CheckError(error, "Could not create lookupTableBuffer");
-
-    cl_mem centroidsBuffer = clCreateBuffer(
-            clContext,
-            //CL_MEM_WRITE_ONLY,
-            CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-            3 * centroidCount * sizeof(char),
-            centroids,
-            &error
-    );
-
-    CheckError(error, "Could not create centroidsBuffer");
-
-	clSetKernelArg(generateLookupTableKernel, 0, sizeof(cl_mem), &centroidsBuffer);
-    clSetKernelArg(generateLookupTableKernel, 1, sizeof(cl_mem), &lookupTableBuffer);
-	clSetKernelArg(generateLookupTableKernel, 2, sizeof(int), &centroidIndex);
-    clSetKernelArg(generateLookupTableKernel, 3, sizeof(int), &centroidCount);
-	clSetKernelArg(generateLookupTableKernel, 4, sizeof(unsigned char), &color);
-
-    // http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clEnqueueNDRangeKernel.html
-    std::size_t offset[3] = {0};
-    std::size_t size[3] = {static_cast<size_t>(256), static_cast<size_t>(256), static_cast<size_t>(256)};
-    /*CheckError(*/clEnqueueNDRangeKernel(clQueue, generateLookupTableKernel, 3, offset, size, nullptr, 0, nullptr, nullptr)/*)*/;
-    clFinish(clQueue);
-
-    //std::cout << "! kMeans time: " << Util::timerEnd(startTime) << std::endl;
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	deBayerWidth = width;
+	deBayerHeight = height;
+	deBayerLookupSize = colorsLookupSize;
+
+	return true;
+}
+
+void OpenCLCompute::releaseDeBayer() {
+	if (deBayerKernel != nullptr) clReleaseKernel(deBayerKernel);
+	if (deBayerBorderKernel != nullptr) clReleaseKernel(deBayerBorderKernel);
+	if (segmentKernel != nullptr) clReleaseKernel(segmentKernel);
+	if (segmentBorderKernel != nullptr) clReleaseKernel(segmentBorderKernel);
+	if (segmentQuadsKernel != nullptr) clReleaseKernel(segmentQuadsKernel);
+	if (classifyTilesKernel != nullptr) clReleaseKernel(classifyTilesKernel);
+	if (projectClassesKernel != nullptr) clReleaseKernel(projectClassesKernel);
+	if (previewKernel != nullptr) clReleaseKernel(previewKernel);
+	if (deBayerProgram != nullptr) clReleaseProgram(deBayerProgram);
+
+	deBayerProgram = nullptr;
+	deBayerKernel = nullptr;
+	deBayerBorderKernel = nullptr;
+	segmentKernel = nullptr;
+	segmentBorderKernel = nullptr;
+	segmentQuadsKernel = nullptr;
+	classifyTilesKernel = nullptr;
+	projectClassesKernel = nullptr;
+	previewKernel = nullptr;
+	deBayerWidth = 0;
+	deBayerHeight = 0;
+	deBayerLookupSize = 0;
+}
+
+bool OpenCLCompute::useDeBayerSize(int width, int height, int colorsLookupSize) {
+	if (width == deBayerWidth && height == deBayerHeight && colorsLookupSize == deBayerLookupSize) {
+		return true;
+	}
+
+	if (clQueue != nullptr) clFinish(clQueue);
+
+	std::cout << "! Building debayer kernels for " << width << "x" << height << std::endl;
+
+	// the work group was chosen for the previous size
+	deBayerWorkGroup = {0, 0, false};
+
+	return setupDeBayer(width, height, colorsLookupSize);
+}
+
+bool OpenCLCompute::setDeBayerWorkGroup(WorkGroup workGroup) {
+	if (deBayerWidth == 0) {
+		return false;
+	}
+
+	size_t quadColumns = static_cast<size_t>(deBayerWidth / 2);
+	size_t interiorRows = static_cast<size_t>(deBayerHeight / 2 - 2);
+
+	if (workGroup.width != 0 || workGroup.tiled) {
+		if (workGroup.width <= 0 || workGroup.height <= 0 || quadColumns % workGroup.width != 0) {
+			return false;
+		}
+
+		// untiled kernels have no range checks so the work group has to divide the interior rows
+		if (!workGroup.tiled && interiorRows % workGroup.height != 0) {
+			return false;
+		}
+
+		if (workGroup.tiled && workGroup.width % 8 != 0) {
+			return false;
+		}
+	}
+
+	WorkGroup previous = deBayerWorkGroup;
+	bool rebuild = workGroup.tiled || previous.tiled;
+
+	deBayerWorkGroup = workGroup;
+
+	if (rebuild) {
+		if (clQueue != nullptr) clFinish(clQueue);
+
+		if (!setupDeBayer(deBayerWidth, deBayerHeight, deBayerLookupSize)) {
+			deBayerWorkGroup = previous;
+			setupDeBayer(deBayerWidth, deBayerHeight, deBayerLookupSize);
+
+			return false;
+		}
+	}
+
+	size_t maxWorkGroupSize = 0;
+
+	for (cl_kernel kernel : {deBayerKernel, segmentKernel}) {
+		size_t kernelWorkGroupSize = 0;
+		clGetKernelWorkGroupInfo(kernel, selectedDeviceIds[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernelWorkGroupSize, nullptr);
+
+		maxWorkGroupSize = maxWorkGroupSize == 0 ? kernelWorkGroupSize : std::min(maxWorkGroupSize, kernelWorkGroupSize);
+	}
+
+	if (static_cast<size_t>(workGroup.width * workGroup.height) > maxWorkGroupSize) {
+		deBayerWorkGroup = previous;
+
+		if (rebuild) {
+			setupDeBayer(deBayerWidth, deBayerHeight, deBayerLookupSize);
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+OpenCLCompute::WorkGroup OpenCLCompute::getDeBayerWorkGroup() {
+	return deBayerWorkGroup;
+}
+
+std::vector<OpenCLCompute::WorkGroup> OpenCLCompute::getDeBayerWorkGroups() {
+	std::vector<WorkGroup> workGroups = {{0, 0, false}};
+
+	for (bool tiled : {false, true}) {
+		for (int width : {8, 16, 32, 64, 128}) {
+			for (int height : {1, 2, 4, 8, 16}) {
+				if (width * height >= 32 && width * height <= 512) {
+					workGroups.push_back({width, height, tiled});
+				}
+			}
+		}
+	}
+
+	return workGroups;
+}
+
+// Host allocations are wrapped once and the cl_mem is reused for every later call with the same pointer.
+// Zero copy on Intel needs 4096 byte aligned memory with size a multiple of 64 bytes.
+cl_mem OpenCLCompute::getHostBuffer(void *hostPointer, size_t size, cl_mem_flags flags) {
+	auto it = hostBuffers.find(hostPointer);
+
+	if (it != hostBuffers.end()) {
+		if (it->second.size >= size) {
+			return it->second.buffer;
+		}
+
+		clReleaseMemObject(it->second.buffer);
+		hostBuffers.erase(it);
+	}
+
+	if (reinterpret_cast<uintptr_t>(hostPointer) % 4096 != 0 || size % 64 != 0) {
+		std::cout << "- Host buffer " << hostPointer << " of " << size
+				  << " bytes is not 4096 byte aligned, OpenCL may copy it" << std::endl;
+	}
+
+	cl_int error = CL_SUCCESS;
+
+	cl_mem buffer = clCreateBuffer(clContext, flags | CL_MEM_USE_HOST_PTR, size, hostPointer, &error);
+
+	if (!CheckError(error, "Could not create host buffer")) {
+		return nullptr;
+	}
+
+	hostBuffers[hostPointer] = {buffer, size};
+
+	return buffer;
+}
+
+// Replaces the event of the segmented output, previous one is no longer needed once newer work is queued after it
+void OpenCLCompute::setFrameEvent(unsigned char *segmentedOut, cl_event event) {
+	cl_event& frameEvent = frameEvents[segmentedOut];
+
+	if (frameEvent != nullptr) {
+		clReleaseEvent(frameEvent);
+	}
+
+	frameEvent = event;
+}
+
+bool OpenCLCompute::hasDeviceSegmented(unsigned char *segmented, cl_kernel kernel, unsigned char *frame) {
+	if (kernel != nullptr && hostBuffers.find(segmented) != hostBuffers.end()
+			&& (frame == nullptr || hostBuffers.find(frame) != hostBuffers.end())) {
+		return true;
+	}
+
+	finish(segmented);
+
+	return false;
+}
+
+void OpenCLCompute::releaseBuffer(void *hostPointer) {
+	auto it = hostBuffers.find(hostPointer);
+
+	if (it == hostBuffers.end()) {
+		return;
+	}
+
+	clFinish(clQueue);
+	clReleaseMemObject(it->second.buffer);
+	hostBuffers.erase(it);
+}
+
+void OpenCLCompute::deBayer(
+		unsigned char *frame,
+		unsigned char *rgbOut,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	enqueueDeBayer(frame, rgbOut, lookup, segmentedOut, width, height, colorsLookupSize);
+	finish(segmentedOut);
+}
+
+void OpenCLCompute::enqueueDeBayer(
+		unsigned char *frame,
+		unsigned char *rgbOut,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	if (!useDeBayerSize(width, height, colorsLookupSize)) {
+		return;
+	}
+
+	cl_mem inputBuffer = getHostBuffer(frame, width * height * sizeof(char), CL_MEM_READ_ONLY);
+	cl_mem lookupBuffer = getHostBuffer(lookup, static_cast<size_t>(colorsLookupSize), CL_MEM_READ_WRITE);
+	cl_mem segmentedBuffer = getHostBuffer(segmentedOut, width * height * sizeof(char), CL_MEM_READ_WRITE);
+
+	cl_kernel kernel = rgbOut != nullptr ? deBayerKernel : segmentKernel;
+	cl_kernel borderKernel = rgbOut != nullptr ? deBayerBorderKernel : segmentBorderKernel;
+
+	if (rgbOut != nullptr) {
+		cl_mem rgbOutBuffer = getHostBuffer(rgbOut, 3 * width * height * sizeof(char), CL_MEM_READ_WRITE);
+
+		for (cl_kernel k : {deBayerKernel, deBayerBorderKernel}) {
+			clSetKernelArg(k, 0, sizeof(cl_mem), &inputBuffer);
+			clSetKernelArg(k, 1, sizeof(cl_mem), &rgbOutBuffer);
+			clSetKernelArg(k, 2, sizeof(cl_mem), &lookupBuffer);
+			clSetKernelArg(k, 3, sizeof(cl_mem), &segmentedBuffer);
+		}
+	} else {
+		for (cl_kernel k : {segmentKernel, segmentBorderKernel}) {
+			clSetKernelArg(k, 0, sizeof(cl_mem), &inputBuffer);
+			clSetKernelArg(k, 1, sizeof(cl_mem), &lookupBuffer);
+			clSetKernelArg(k, 2, sizeof(cl_mem), &segmentedBuffer);
+		}
+	}
+
+	cl_event event = nullptr;
+
+	// http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clEnqueueNDRangeKernel.html
+	std::size_t offset[3];
+	std::size_t size[3];
+	std::size_t localSize[3];
+	bool useLocalSize = getDeBayerRange(width, height, offset, size, localSize);
+
+	clEnqueueNDRangeKernel(clQueue, kernel, 2, offset, size, useLocalSize ? localSize : nullptr, 0, nullptr, nullptr);
+
+	std::size_t borderSize[3] = {static_cast<size_t>(width / 2), 2, 1};
+	// in order queue, the border kernel finishes last
+	/*CheckError(*/clEnqueueNDRangeKernel(clQueue, borderKernel, 2, nullptr, borderSize, nullptr, 0, nullptr, &event)/*)*/;
+
+	setFrameEvent(segmentedOut, event);
+
+	// start executing without waiting for it
+	clFlush(clQueue);
+}
+
+// Range of the interior debayer kernels, returns false if the driver chooses the local size
+bool OpenCLCompute::getDeBayerRange(int width, int height, size_t offset[3], size_t size[3], size_t localSize[3]) {
+	// interior quad rows have no bounds checks, first and last quad row are done by the border kernel
+	offset[0] = 0;
+	offset[1] = 1;
+	offset[2] = 0;
+	size[0] = static_cast<size_t>(width / 2);
+	size[1] = static_cast<size_t>(height / 2 - 2);
+	size[2] = 1;
+	localSize[0] = static_cast<size_t>(deBayerWorkGroup.width);
+	localSize[1] = static_cast<size_t>(deBayerWorkGroup.height);
+	localSize[2] = 1;
+
+	if (deBayerWorkGroup.tiled) {
+		// tiled kernels skip the quad rows past the interior
+		size[1] = (size[1] + localSize[1] - 1) / localSize[1] * localSize[1];
+	}
+
+	return deBayerWorkGroup.width != 0;
+}
+
+// Local size of a tuned work group, nullptr lets the driver choose when it was not tuned or does not divide the range
+const size_t* OpenCLCompute::getLocalSize(const WorkGroup &workGroup, const size_t *size, size_t *localSize) {
+	if (workGroup.width == 0
+		|| size[0] % workGroup.width != 0
+		|| size[1] % workGroup.height != 0) {
+		return nullptr;
+	}
+
+	localSize[0] = static_cast<size_t>(workGroup.width);
+	localSize[1] = static_cast<size_t>(workGroup.height);
+	localSize[2] = 1;
+
+	return localSize;
+}
+
+void OpenCLCompute::enqueueClassifyTiles(unsigned char *segmented, int width, int height, unsigned int *tileClassesOut) {
+	if (!hasDeviceSegmented(segmented, classifyTilesKernel)) {
+		ComputeBackend::enqueueClassifyTiles(segmented, width, height, tileClassesOut);
+
+		return;
+	}
+
+	int tileCount = (width / TILE_SIZE) * (height / TILE_SIZE);
+	cl_mem tileClassesBuffer = getHostBuffer(tileClassesOut, tileCount * sizeof(unsigned int), CL_MEM_READ_WRITE);
+
+	clSetKernelArg(classifyTilesKernel, 0, sizeof(cl_mem), &hostBuffers[segmented].buffer);
+	clSetKernelArg(classifyTilesKernel, 1, sizeof(cl_mem), &tileClassesBuffer);
+	clSetKernelArg(classifyTilesKernel, 2, sizeof(int), &width);
+
+	cl_event event = nullptr;
+
+	std::size_t size[3] = {static_cast<size_t>(width / TILE_SIZE), static_cast<size_t>(height), 1};
+	std::size_t localSize[3] = {1, static_cast<size_t>(TILE_SIZE), 1};
+	clEnqueueNDRangeKernel(clQueue, classifyTilesKernel, 2, nullptr, size, localSize, 0, nullptr, &event);
+
+	// in order queue, finishing the summary means the segmentation is done too
+	setFrameEvent(segmented, event);
+
+	clFlush(clQueue);
+}
+
+void OpenCLCompute::enqueueProjectClasses(
+		unsigned char *segmented,
+		int width,
+		int height,
+		int firstClass,
+		int classCount,
+		unsigned short *rowCountsOut,
+		unsigned short *columnCountsOut
+) {
+	if (!hasDeviceSegmented(segmented, projectClassesKernel)) {
+		ComputeBackend::enqueueProjectClasses(segmented, width, height, firstClass, classCount, rowCountsOut, columnCountsOut);
+
+		return;
+	}
+
+	cl_mem rowCountsBuffer = getHostBuffer(rowCountsOut, classCount * height * sizeof(unsigned short), CL_MEM_READ_WRITE);
+	cl_mem columnCountsBuffer = getHostBuffer(columnCountsOut, classCount * width * sizeof(unsigned short), CL_MEM_READ_WRITE);
+
+	clSetKernelArg(projectClassesKernel, 0, sizeof(cl_mem), &hostBuffers[segmented].buffer);
+	clSetKernelArg(projectClassesKernel, 1, sizeof(cl_mem), &rowCountsBuffer);
+	clSetKernelArg(projectClassesKernel, 2, sizeof(cl_mem), &columnCountsBuffer);
+	clSetKernelArg(projectClassesKernel, 3, sizeof(int), &width);
+	clSetKernelArg(projectClassesKernel, 4, sizeof(int), &height);
+	clSetKernelArg(projectClassesKernel, 5, sizeof(int), &firstClass);
+	clSetKernelArg(projectClassesKernel, 6, sizeof(int), &classCount);
+
+	cl_event event = nullptr;
+
+	std::size_t size[3] = {static_cast<size_t>(width + height), 1, 1};
+	clEnqueueNDRangeKernel(clQueue, projectClassesKernel, 1, nullptr, size, nullptr, 0, nullptr, &event);
+
+	setFrameEvent(segmented, event);
+
+	clFlush(clQueue);
+}
+
+void OpenCLCompute::enqueuePreview(
+		unsigned char *frame,
+		unsigned char *segmented,
+		int width,
+		int height,
+		int segmentedScale,
+		int scale,
+		unsigned char *bgrOut,
+		unsigned char *classesOut
+) {
+	if (!hasDeviceSegmented(segmented, previewKernel, frame)) {
+		ComputeBackend::enqueuePreview(frame, segmented, width, height, segmentedScale, scale, bgrOut, classesOut);
+
+		return;
+	}
+
+	size_t previewSize = (size_t)(width / scale) * (height / scale);
+
+	cl_mem bgrBuffer = getHostBuffer(bgrOut, previewSize * 3, CL_MEM_READ_WRITE);
+	cl_mem classesBuffer = getHostBuffer(classesOut, previewSize, CL_MEM_READ_WRITE);
+
+	clSetKernelArg(previewKernel, 0, sizeof(cl_mem), &hostBuffers[frame].buffer);
+	clSetKernelArg(previewKernel, 1, sizeof(cl_mem), &hostBuffers[segmented].buffer);
+	clSetKernelArg(previewKernel, 2, sizeof(cl_mem), &bgrBuffer);
+	clSetKernelArg(previewKernel, 3, sizeof(cl_mem), &classesBuffer);
+	clSetKernelArg(previewKernel, 4, sizeof(int), &scale);
+	clSetKernelArg(previewKernel, 5, sizeof(int), &segmentedScale);
+
+	cl_event event = nullptr;
+
+	std::size_t size[3] = {static_cast<size_t>(width / scale), static_cast<size_t>(height / scale), 1};
+	clEnqueueNDRangeKernel(clQueue, previewKernel, 2, nullptr, size, nullptr, 0, nullptr, &event);
+
+	setFrameEvent(segmented, event);
+
+	clFlush(clQueue);
+}
+
+void OpenCLCompute::finish(unsigned char *segmentedOut) {
+	auto it = frameEvents.find(segmentedOut);
+
+	if (it != frameEvents.end() && it->second != nullptr) {
+		clWaitForEvents(1, &it->second);
+
+		setFrameEvent(segmentedOut, nullptr);
+	}
+}
+
+bool OpenCLCompute::setupEncodeRuns() {
+	cl_int error = CL_SUCCESS;
+
+	encodeRunsProgram = BuildProgram("encode_runs.cl", "");
+
+	if (encodeRunsProgram == nullptr) {
+		return false;
+	}
+
+	countRunsKernel = clCreateKernel(encodeRunsProgram, "countRuns", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	scanRunCountsKernel = clCreateKernel(encodeRunsProgram, "scanRunCounts", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	encodeRunsKernel = clCreateKernel(encodeRunsProgram, "encodeRuns", &error);
+
+	return CheckError(error, "Create kernel");
+}
+
+void OpenCLCompute::releaseEncodeRuns() {
+	if (countRunsKernel != nullptr) clReleaseKernel(countRunsKernel);
+	if (scanRunCountsKernel != nullptr) clReleaseKernel(scanRunCountsKernel);
+	if (encodeRunsKernel != nullptr) clReleaseKernel(encodeRunsKernel);
+	if (encodeRunsProgram != nullptr) clReleaseProgram(encodeRunsProgram);
+
+	encodeRunsProgram = nullptr;
+	countRunsKernel = nullptr;
+	scanRunCountsKernel = nullptr;
+	encodeRunsKernel = nullptr;
+}
+
+int OpenCLCompute::encodeRuns(
+		unsigned char *segmented,
+		int width,
+		int height,
+		unsigned int trackedColors,
+		Run *runsOut,
+		int maxRuns
+) {
+	// works on the segmented image that is already on the device
+	if (encodeRunsProgram == nullptr || hostBuffers.find(segmented) == hostBuffers.end()) {
+		return -1;
+	}
+
+	cl_mem segmentedBuffer = hostBuffers[segmented].buffer;
+
+	cl_int error = CL_SUCCESS;
+
+	// full and half resolution frames have a different row count
+	if (height > rowRunBufferRows) {
+		if (rowRunCountsBuffer != nullptr) clReleaseMemObject(rowRunCountsBuffer);
+		if (rowRunOffsetsBuffer != nullptr) clReleaseMemObject(rowRunOffsetsBuffer);
+
+		rowRunOffsetsBuffer = nullptr;
+		rowRunBufferRows = 0;
+
+		rowRunCountsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, height * sizeof(int), nullptr, &error);
+
+		if (!CheckError(error, "Could not create rowRunCountsBuffer")) {
+			rowRunCountsBuffer = nullptr;
+
+			return -1;
+		}
+
+		rowRunOffsetsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, (height + 1) * sizeof(int), nullptr, &error);
+
+		if (!CheckError(error, "Could not create rowRunOffsetsBuffer")) {
+			rowRunOffsetsBuffer = nullptr;
+
+			return -1;
+		}
+
+		rowRunBufferRows = height;
+	}
+
+	cl_mem runsBuffer = getHostBuffer(runsOut, maxRuns * sizeof(Run), CL_MEM_READ_WRITE);
+
+	clSetKernelArg(countRunsKernel, 0, sizeof(cl_mem), &segmentedBuffer);
+	clSetKernelArg(countRunsKernel, 1, sizeof(cl_mem), &rowRunCountsBuffer);
+	clSetKernelArg(countRunsKernel, 2, sizeof(int), &width);
+	clSetKernelArg(countRunsKernel, 3, sizeof(unsigned int), &trackedColors);
+
+	std::size_t rowCount = static_cast<size_t>(height);
+	clEnqueueNDRangeKernel(clQueue, countRunsKernel, 1, nullptr, &rowCount, nullptr, 0, nullptr, nullptr);
+
+	std::size_t scanSize = 256;
+	clGetKernelWorkGroupInfo(
+			scanRunCountsKernel,
+			selectedDeviceIds[0],
+			CL_KERNEL_WORK_GROUP_SIZE,
+			sizeof(size_t),
+			&scanSize,
+			nullptr
+	);
+	// one work group scans any row count, each work item sums a block of height / scanSize rows first
+	scanSize = std::max(std::min(scanSize, static_cast<size_t>(256)), static_cast<size_t>(1));
+
+	clSetKernelArg(scanRunCountsKernel, 0, sizeof(cl_mem), &rowRunCountsBuffer);
+	clSetKernelArg(scanRunCountsKernel, 1, sizeof(cl_mem), &rowRunOffsetsBuffer);
+	clSetKernelArg(scanRunCountsKernel, 2, sizeof(int), &height);
+	clSetKernelArg(scanRunCountsKernel, 3, scanSize * sizeof(int), nullptr);
+
+	clEnqueueNDRangeKernel(clQueue, scanRunCountsKernel, 1, nullptr, &scanSize, &scanSize, 0, nullptr, nullptr);
+
+	clSetKernelArg(encodeRunsKernel, 0, sizeof(cl_mem), &segmentedBuffer);
+	clSetKernelArg(encodeRunsKernel, 1, sizeof(cl_mem), &rowRunOffsetsBuffer);
+	clSetKernelArg(encodeRunsKernel, 2, sizeof(cl_mem), &runsBuffer);
+	clSetKernelArg(encodeRunsKernel, 3, sizeof(int), &width);
+	clSetKernelArg(encodeRunsKernel, 4, sizeof(unsigned int), &trackedColors);
+	clSetKernelArg(encodeRunsKernel, 5, sizeof(int), &maxRuns);
+
+	clEnqueueNDRangeKernel(clQueue, encodeRunsKernel, 1, nullptr, &rowCount, nullptr, 0, nullptr, nullptr);
+
+	int runCount = 0;
+
+	if (!CheckError(clEnqueueReadBuffer(
+			clQueue,
+			rowRunOffsetsBuffer,
+			CL_TRUE,
+			height * sizeof(int),
+			sizeof(int),
+			&runCount,
+			0,
+			nullptr,
+			nullptr
+	), "Read run count")) {
+		return -1;
+	}
+
+	// the blocking read waited for the encodeRuns kernel before it
+	return std::min(runCount, maxRuns);
+}
+
+bool OpenCLCompute::setupLabelRegions() {
+	cl_int error = CL_SUCCESS;
+
+	labelRegionsProgram = BuildProgram("label_regions.cl", "");
+
+	if (labelRegionsProgram == nullptr) {
+		return false;
+	}
+
+	findRowStartsKernel = clCreateKernel(labelRegionsProgram, "findRowStarts", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	mergeRunsKernel = clCreateKernel(labelRegionsProgram, "mergeRuns", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	flattenLabelsKernel = clCreateKernel(labelRegionsProgram, "flattenLabels", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	numberRegionsKernel = clCreateKernel(labelRegionsProgram, "numberRegions", &error);
+
+	if (!CheckError(error, "Create kernel")) {
+		return false;
+	}
+
+	accumulateRegionsKernel = clCreateKernel(labelRegionsProgram, "accumulateRegions", &error);
+
+	return CheckError(error, "Create kernel");
+}
+
+void OpenCLCompute::releaseLabelRegions() {
+	if (findRowStartsKernel != nullptr) clReleaseKernel(findRowStartsKernel);
+	if (mergeRunsKernel != nullptr) clReleaseKernel(mergeRunsKernel);
+	if (flattenLabelsKernel != nullptr) clReleaseKernel(flattenLabelsKernel);
+	if (numberRegionsKernel != nullptr) clReleaseKernel(numberRegionsKernel);
+	if (accumulateRegionsKernel != nullptr) clReleaseKernel(accumulateRegionsKernel);
+	if (labelRegionsProgram != nullptr) clReleaseProgram(labelRegionsProgram);
+
+	labelRegionsProgram = nullptr;
+	findRowStartsKernel = nullptr;
+	mergeRunsKernel = nullptr;
+	flattenLabelsKernel = nullptr;
+	numberRegionsKernel = nullptr;
+	accumulateRegionsKernel = nullptr;
+}
+
+int OpenCLCompute::labelRegions(
+		Run *runs,
+		int runCount,
+		int maxRuns,
+		int height,
+		unsigned int trackedColors,
+		Region *regionsOut,
+		int maxRegions
+) {
+	if (labelRegionsProgram == nullptr) {
+		return -1;
+	}
+
+	if (runCount == 0) {
+		return 0;
+	}
+
+	cl_int error = CL_SUCCESS;
+
+	if (regionCountBuffer == nullptr) {
+		regionCountBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, sizeof(int), nullptr, &error);
+
+		if (!CheckError(error, "Could not create regionCountBuffer")) {
+			regionCountBuffer = nullptr;
+
+			return -1;
+		}
+	}
+
+	// full and half resolution frames have a different row count
+	if (height > labelRowCapacity) {
+		if (rowStartsBuffer != nullptr) clReleaseMemObject(rowStartsBuffer);
+
+		labelRowCapacity = 0;
+
+		rowStartsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, (height + 1) * sizeof(int), nullptr, &error);
+
+		if (!CheckError(error, "Could not create rowStartsBuffer")) {
+			rowStartsBuffer = nullptr;
+
+			return -1;
+		}
+
+		labelRowCapacity = height;
+	}
+
+	if (maxRuns > labelRunCapacity) {
+		if (labelsBuffer != nullptr) clReleaseMemObject(labelsBuffer);
+		if (regionIdsBuffer != nullptr) clReleaseMemObject(regionIdsBuffer);
+
+		regionIdsBuffer = nullptr;
+		labelRunCapacity = 0;
+
+		labelsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, maxRuns * sizeof(int), nullptr, &error);
+
+		if (!CheckError(error, "Could not create labelsBuffer")) {
+			labelsBuffer = nullptr;
+
+			return -1;
+		}
+
+		regionIdsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, maxRuns * sizeof(int), nullptr, &error);
+
+		if (!CheckError(error, "Could not create regionIdsBuffer")) {
+			regionIdsBuffer = nullptr;
+
+			return -1;
+		}
+
+		labelRunCapacity = maxRuns;
+	}
+
+	// runs written by encodeRuns are already on the device
+	cl_mem runsBuffer = getHostBuffer(runs, maxRuns * sizeof(Run), CL_MEM_READ_WRITE);
+	cl_mem regionsBuffer = getHostBuffer(regionsOut, maxRegions * sizeof(Region), CL_MEM_READ_WRITE);
+
+	std::size_t size = static_cast<size_t>(runCount);
+
+	clSetKernelArg(findRowStartsKernel, 0, sizeof(cl_mem), &runsBuffer);
+	clSetKernelArg(findRowStartsKernel, 1, sizeof(cl_mem), &rowStartsBuffer);
+	clSetKernelArg(findRowStartsKernel, 2, sizeof(cl_mem), &labelsBuffer);
+	clSetKernelArg(findRowStartsKernel, 3, sizeof(int), &runCount);
+
+	clEnqueueNDRangeKernel(clQueue, findRowStartsKernel, 1, nullptr, &size, nullptr, 0, nullptr, nullptr);
+
+	clSetKernelArg(mergeRunsKernel, 0, sizeof(cl_mem), &runsBuffer);
+	clSetKernelArg(mergeRunsKernel, 1, sizeof(cl_mem), &rowStartsBuffer);
+	clSetKernelArg(mergeRunsKernel, 2, sizeof(cl_mem), &labelsBuffer);
+	clSetKernelArg(mergeRunsKernel, 3, sizeof(int), &runCount);
+	clSetKernelArg(mergeRunsKernel, 4, sizeof(unsigned int), &trackedColors);
+
+	clEnqueueNDRangeKernel(clQueue, mergeRunsKernel, 1, nullptr, &size, nullptr, 0, nullptr, nullptr);
+
+	clSetKernelArg(flattenLabelsKernel, 0, sizeof(cl_mem), &labelsBuffer);
+	clSetKernelArg(flattenLabelsKernel, 1, sizeof(int), &runCount);
+
+	clEnqueueNDRangeKernel(clQueue, flattenLabelsKernel, 1, nullptr, &size, nullptr, 0, nullptr, nullptr);
+
+	std::size_t scanSize = 256;
+	clGetKernelWorkGroupInfo(
+			numberRegionsKernel,
+			selectedDeviceIds[0],
+			CL_KERNEL_WORK_GROUP_SIZE,
+			sizeof(size_t),
+			&scanSize,
+			nullptr
+	);
+	scanSize = std::min(scanSize, static_cast<size_t>(256));
+
+	clSetKernelArg(numberRegionsKernel, 0, sizeof(cl_mem), &runsBuffer);
+	clSetKernelArg(numberRegionsKernel, 1, sizeof(cl_mem), &labelsBuffer);
+	clSetKernelArg(numberRegionsKernel, 2, sizeof(cl_mem), &regionIdsBuffer);
+	clSetKernelArg(numberRegionsKernel, 3, sizeof(cl_mem), &regionsBuffer);
+	clSetKernelArg(numberRegionsKernel, 4, sizeof(cl_mem), &regionCountBuffer);
+	clSetKernelArg(numberRegionsKernel, 5, sizeof(int), &runCount);
+	clSetKernelArg(numberRegionsKernel, 6, sizeof(unsigned int), &trackedColors);
+	clSetKernelArg(numberRegionsKernel, 7, sizeof(int), &maxRegions);
+	clSetKernelArg(numberRegionsKernel, 8, scanSize * sizeof(int), nullptr);
+
+	clEnqueueNDRangeKernel(clQueue, numberRegionsKernel, 1, nullptr, &scanSize, &scanSize, 0, nullptr, nullptr);
+
+	clSetKernelArg(accumulateRegionsKernel, 0, sizeof(cl_mem), &runsBuffer);
+	clSetKernelArg(accumulateRegionsKernel, 1, sizeof(cl_mem), &labelsBuffer);
+	clSetKernelArg(accumulateRegionsKernel, 2, sizeof(cl_mem), &regionIdsBuffer);
+	clSetKernelArg(accumulateRegionsKernel, 3, sizeof(cl_mem), &regionsBuffer);
+	clSetKernelArg(accumulateRegionsKernel, 4, sizeof(int), &runCount);
+	clSetKernelArg(accumulateRegionsKernel, 5, sizeof(unsigned int), &trackedColors);
+	clSetKernelArg(accumulateRegionsKernel, 6, sizeof(int), &maxRegions);
+
+	clEnqueueNDRangeKernel(clQueue, accumulateRegionsKernel, 1, nullptr, &size, nullptr, 0, nullptr, nullptr);
+
+	int regionCount = 0;
+
+	if (!CheckError(clEnqueueReadBuffer(
+			clQueue,
+			regionCountBuffer,
+			CL_TRUE,
+			0,
+			sizeof(int),
+			&regionCount,
+			0,
+			nullptr,
+			nullptr
+	), "Read region count")) {
+		return -1;
+	}
+
+	// the blocking read waited for the accumulateRegions kernel before it
+	// same limit as Blobber::segExtractRegions
+	return regionCount < maxRegions ? regionCount : -1;
+}
+
+bool OpenCLCompute::setupKMeans() {
+    cl_int error = CL_SUCCESS;
+
+    kMeansProgram = BuildProgram("kmeans.cl", "");
+
+    if (kMeansProgram == nullptr) {
+        return false;
+    }
+
+    kMeansKernel = clCreateKernel(kMeansProgram, "kMeans", &error);
+
+    if (!CheckError(error, "Create kernel")) {
+        return false;
+    }
+
+    kMeansAccumulateKernel = clCreateKernel(kMeansProgram, "kMeansAccumulate", &error);
+
+    if (!CheckError(error, "Create kernel")) {
+        return false;
+    }
+
+    kMeansUpdateKernel = clCreateKernel(kMeansProgram, "kMeansUpdate", &error);
+
+    if (!CheckError(error, "Create kernel")) {
+        return false;
+    }
+
+    kMeansCentroidsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 3 * MAX_KMEANS_CENTROIDS, nullptr, &error);
+
+    if (!CheckError(error, "Could not create kMeansCentroidsBuffer")) {
+        return false;
+    }
+
+    kMeansSumsBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 4 * MAX_KMEANS_CENTROIDS * sizeof(cl_uint), nullptr, &error);
+
+    if (!CheckError(error, "Could not create kMeansSumsBuffer")) {
+        return false;
+    }
+
+    kMeansStateBuffer = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint), nullptr, &error);
+
+    return CheckError(error, "Could not create kMeansStateBuffer");
+}
+
+void OpenCLCompute::segmentQuads(
+		unsigned char *frame,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	enqueueSegmentQuads(frame, lookup, segmentedOut, width, height, colorsLookupSize);
+	finish(segmentedOut);
+}
+
+void OpenCLCompute::enqueueSegmentQuads(
+		unsigned char *frame,
+		unsigned char *lookup,
+		unsigned char *segmentedOut,
+		int width,
+		int height,
+		int colorsLookupSize
+) {
+	if (!useDeBayerSize(width, height, colorsLookupSize)) {
+		return;
+	}
+
+	cl_mem inputBuffer = getHostBuffer(frame, width * height * sizeof(char), CL_MEM_READ_ONLY);
+	cl_mem lookupBuffer = getHostBuffer(lookup, static_cast<size_t>(colorsLookupSize), CL_MEM_READ_WRITE);
+	// segmented buffer has full frame size as half resolution mode can be switched at runtime
+	cl_mem segmentedBuffer = getHostBuffer(segmentedOut, width * height * sizeof(char), CL_MEM_READ_WRITE);
+
+	clSetKernelArg(segmentQuadsKernel, 0, sizeof(cl_mem), &inputBuffer);
+	clSetKernelArg(segmentQuadsKernel, 1, sizeof(cl_mem), &lookupBuffer);
+	clSetKernelArg(segmentQuadsKernel, 2, sizeof(cl_mem), &segmentedBuffer);
+
+	cl_event event = nullptr;
+
+	std::size_t offset[3] = {0};
+	std::size_t size[3] = {static_cast<size_t>(width / 2), static_cast<size_t>(height / 2), 1};
+	std::size_t localSize[3];
+	clEnqueueNDRangeKernel(clQueue, segmentQuadsKernel, 2, offset, size, getLocalSize(segmentQuadsWorkGroup, size, localSize), 0, nullptr, &event);
+
+	setFrameEvent(segmentedOut, event);
+
+	clFlush(clQueue);
+}
+
+void OpenCLCompute::kMeans(
+		unsigned char* rgb,
+		unsigned char*  clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height
+) {
+	enqueueKMeans(rgb, clustered, centroids, centroidCount, width, height);
+	finishCalibration();
+}
+
+void OpenCLCompute::enqueueKMeans(
+		unsigned char* rgb,
+		unsigned char*  clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height
+) {
+	if (centroidCount > MAX_KMEANS_CENTROIDS) {
+		std::cout << "- kMeans supports at most " << MAX_KMEANS_CENTROIDS << " centroids" << std::endl;
+
+		return;
+	}
+
+	cl_mem inputBuffer = getHostBuffer(rgb, 3 * width * height * sizeof(char), CL_MEM_READ_WRITE);
+	cl_mem clusteredBuffer = getHostBuffer(clustered, width * height * sizeof(char), CL_MEM_READ_WRITE);
+
+	// blocking so the centroids can change once this returns
+	clEnqueueWriteBuffer(calibrationQueue, kMeansCentroidsBuffer, CL_TRUE, 0, 3 * centroidCount, centroids, 0, nullptr, nullptr);
+
+	enqueueKMeansKernel(inputBuffer, clusteredBuffer, centroidCount, width, height);
+
+	clFlush(calibrationQueue);
+}
+
+void OpenCLCompute::enqueueKMeansIterations(
+		unsigned char* bgr,
+		unsigned char* clustered,
+		unsigned char* centroids,
+		int centroidCount,
+		int width,
+		int height,
+		int sampleStep,
+		int maxIterations
+) {
+	const size_t groupSize = 64;
+
+	if (centroidCount > MAX_KMEANS_CENTROIDS) {
+		std::cout << "- kMeans supports at most " << MAX_KMEANS_CENTROIDS << " centroids" << std::endl;
+
+		return;
+	}
+
+	cl_mem inputBuffer = getHostBuffer(bgr, 3 * width * height * sizeof(char), CL_MEM_READ_WRITE);
+	cl_mem clusteredBuffer = getHostBuffer(clustered, width * height * sizeof(char), CL_MEM_READ_WRITE);
+
+	int sampleColumns = (width + sampleStep - 1) / sampleStep;
+	int sampleCount = sampleColumns * ((height + sampleStep - 1) / sampleStep);
+	std::vector<cl_uint> zeroSums(4 * centroidCount, 0);
+	cl_uint state[2] = {0, 0};
+
+	clEnqueueWriteBuffer(calibrationQueue, kMeansCentroidsBuffer, CL_TRUE, 0, 3 * centroidCount, centroids, 0, nullptr, nullptr);
+	clEnqueueWriteBuffer(calibrationQueue, kMeansSumsBuffer, CL_TRUE, 0, zeroSums.size() * sizeof(cl_uint), zeroSums.data(), 0, nullptr, nullptr);
+	clEnqueueWriteBuffer(calibrationQueue, kMeansStateBuffer, CL_TRUE, 0, sizeof(state), state, 0, nullptr, nullptr);
+
+	clSetKernelArg(kMeansAccumulateKernel, 0, sizeof(cl_mem), &inputBuffer);
+	clSetKernelArg(kMeansAccumulateKernel, 1, sizeof(cl_mem), &kMeansCentroidsBuffer);
+	clSetKernelArg(kMeansAccumulateKernel, 2, sizeof(cl_mem), &kMeansSumsBuffer);
+	clSetKernelArg(kMeansAccumulateKernel, 3, sizeof(cl_mem), &kMeansStateBuffer);
+	clSetKernelArg(kMeansAccumulateKernel, 4, sizeof(int), &centroidCount);
+	clSetKernelArg(kMeansAccumulateKernel, 5, sizeof(int), &width);
+	clSetKernelArg(kMeansAccumulateKernel, 6, sizeof(int), &sampleStep);
+	clSetKernelArg(kMeansAccumulateKernel, 7, sizeof(int), &sampleColumns);
+	clSetKernelArg(kMeansAccumulateKernel, 8, sizeof(int), &sampleCount);
+	clSetKernelArg(kMeansAccumulateKernel, 9, 4 * centroidCount * sizeof(cl_uint), nullptr);
+
+	clSetKernelArg(kMeansUpdateKernel, 0, sizeof(cl_mem), &kMeansCentroidsBuffer);
+	clSetKernelArg(kMeansUpdateKernel, 1, sizeof(cl_mem), &kMeansSumsBuffer);
+	clSetKernelArg(kMeansUpdateKernel, 2, sizeof(cl_mem), &kMeansStateBuffer);
+	clSetKernelArg(kMeansUpdateKernel, 3, sizeof(int), &centroidCount);
+
+	// rounds after convergence return right away, so the host does not wait for the state between them
+	std::size_t offset[1] = {0};
+	std::size_t accumulateSize[1] = {(sampleCount + groupSize - 1) / groupSize * groupSize};
+	std::size_t accumulateLocalSize[1] = {groupSize};
+	std::size_t updateSize[1] = {1};
+
+	for (int iteration = 0; iteration < maxIterations; iteration++) {
+		clEnqueueNDRangeKernel(calibrationQueue, kMeansAccumulateKernel, 1, offset, accumulateSize, accumulateLocalSize, 0, nullptr, nullptr);
+		clEnqueueNDRangeKernel(calibrationQueue, kMeansUpdateKernel, 1, offset, updateSize, nullptr, 0, nullptr, nullptr);
+	}
+
+	enqueueKMeansKernel(inputBuffer, clusteredBuffer, centroidCount, width, height);
+
+	cl_event event = nullptr;
+
+	clEnqueueReadBuffer(calibrationQueue, kMeansCentroidsBuffer, CL_FALSE, 0, 3 * centroidCount, centroids, 0, nullptr, &event);
+
+	setCalibrationEvent(event);
+
+	clFlush(calibrationQueue);
+}
+
+void OpenCLCompute::enqueueKMeansKernel(cl_mem inputBuffer, cl_mem clusteredBuffer, int centroidCount, int width, int height) {
+	clSetKernelArg(kMeansKernel, 0, sizeof(cl_mem), &inputBuffer);
+	clSetKernelArg(kMeansKernel, 1, sizeof(cl_mem), &clusteredBuffer);
+	clSetKernelArg(kMeansKernel, 2, sizeof(cl_mem), &kMeansCentroidsBuffer);
+	clSetKernelArg(kMeansKernel, 3, sizeof(int), &centroidCount);
+
+	cl_event event = nullptr;
+
+	// http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clEnqueueNDRangeKernel.html
+	std::size_t offset[2] = {0};
+	std::size_t size[2] = {static_cast<size_t>(width), static_cast<size_t>(height)};
+	std::size_t localSize[3];
+	/*CheckError(*/clEnqueueNDRangeKernel(calibrationQueue, kMeansKernel, 2, offset, size, getLocalSize(kMeansWorkGroup, size, localSize), 0, nullptr, &event)/*)*/;
+
+	setCalibrationEvent(event);
+}
+
+void OpenCLCompute::setCalibrationEvent(cl_event event) {
+	if (calibrationEvent != nullptr) {
+		clReleaseEvent(calibrationEvent);
+	}
+
+	calibrationEvent = event;
+}
+
+bool OpenCLCompute::isCalibrationDone() {
+	if (calibrationEvent == nullptr) {
+		return true;
+	}
+
+	cl_int status = CL_COMPLETE;
+	clGetEventInfo(calibrationEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+
+	// negative status is an error, the work will not complete
+	return status <= CL_COMPLETE;
+}
+
+void OpenCLCompute::finishCalibration() {
+	if (calibrationEvent != nullptr) {
+		clWaitForEvents(1, &calibrationEvent);
+
+		setCalibrationEvent(nullptr);
+	}
+}
+
+// Median run time in milliseconds of the kernel with its current arguments, -1 if it can not run with the local size
+double OpenCLCompute::timeKernel(
+		cl_command_queue queue,
+		cl_kernel kernel,
+		cl_uint dimensions,
+		const size_t *offset,
+		const size_t *size,
+		const size_t *localSize
+) {
+	const int runs = 7;
+	std::vector<double> times;
+
+	// first run is a warm up
+	for (int i = 0; i <= runs; i++) {
+		cl_event event = nullptr;
+
+		if (clEnqueueNDRangeKernel(queue, kernel, dimensions, offset, size, localSize, 0, nullptr, &event) != CL_SUCCESS) {
+			return -1.0;
+		}
+
+		clWaitForEvents(1, &event);
+
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+		clReleaseEvent(event);
+
+		if (i > 0) {
+			times.push_back((end - start) / 1000000.0);
+		}
+	}
+
+	std::sort(times.begin(), times.end());
+
+	return times[times.size() / 2];
+}
+
+// Power of two local sizes that divide the range and fit the kernel, the first one lets the driver choose
+std::vector<OpenCLCompute::WorkGroup> OpenCLCompute::getWorkGroups(cl_kernel kernel, size_t width, size_t height) {
+	size_t maxSize = 0;
+	clGetKernelWorkGroupInfo(kernel, selectedDeviceIds[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxSize, nullptr);
+
+	std::vector<WorkGroup> workGroups = {{0, 0, false}};
+
+	for (size_t groupWidth = 1; groupWidth <= maxSize; groupWidth *= 2) {
+		for (size_t groupHeight = 1; groupWidth * groupHeight <= maxSize; groupHeight *= 2) {
+			if (groupWidth * groupHeight >= 16 && width % groupWidth == 0 && height % groupHeight == 0) {
+				workGroups.push_back({static_cast<int>(groupWidth), static_cast<int>(groupHeight), false});
+			}
+		}
+	}
+
+	return workGroups;
+}
+
+static std::string workGroupToString(const OpenCLCompute::WorkGroup &workGroup) {
+	if (workGroup.width == 0) {
+		return "driver";
+	}
+
+	return std::to_string(workGroup.width) + "x" + std::to_string(workGroup.height) + (workGroup.tiled ? " tiled" : "");
+}
+
+static nlohmann::json workGroupToJson(const OpenCLCompute::WorkGroup &workGroup) {
+	return {{"width", workGroup.width}, {"height", workGroup.height}, {"tiled", workGroup.tiled}};
+}
+
+static OpenCLCompute::WorkGroup workGroupFromJson(const nlohmann::json &json) {
+	if (!json.is_object()) {
+		return {0, 0, false};
+	}
+
+	return {json.value("width", 0), json.value("height", 0), json.value("tiled", false)};
+}
+
+void OpenCLCompute::tune(
+		unsigned char *frame,
+		unsigned char *lookup,
+		int width,
+		int height,
+		int colorsLookupSize,
+		bool retune
+) {
+	if (workGroupsLoaded && !retune) {
+		return;
+	}
+
+	if (!useDeBayerSize(width, height, colorsLookupSize)) {
+		return;
+	}
+
+	std::cout << "! Tuning work groups for " << GetDeviceName(selectedDeviceIds[0]) << std::endl;
+
+	cl_int error = CL_SUCCESS;
+	cl_command_queue profilingQueue = clCreateCommandQueue(
+			clContext,
+			selectedDeviceIds[0],
+			CL_QUEUE_PROFILING_ENABLE,
+			&error
+	);
+
+	if (!CheckError(error, "Create profiling queue")) {
+		return;
+	}
+
+	const int centroidCount = 16;
+	unsigned char centroids[centroidCount * 3];
+
+	for (int i = 0; i < centroidCount * 3; i++) {
+		centroids[i] = static_cast<unsigned char>(i * 53);
+	}
+
+	auto* bgr = (unsigned char *)_aligned_malloc(3 * width * height, 4096);
+	auto* segmented = (unsigned char *)_aligned_malloc(width * height, 4096);
+	auto* clustered = (unsigned char *)_aligned_malloc(width * height, 4096);
+
+	cl_mem inputBuffer = getHostBuffer(frame, width * height * sizeof(char), CL_MEM_READ_ONLY);
+	cl_mem lookupBuffer = getHostBuffer(lookup, static_cast<size_t>(colorsLookupSize), CL_MEM_READ_WRITE);
+	cl_mem bgrBuffer = getHostBuffer(bgr, 3 * width * height * sizeof(char), CL_MEM_READ_WRITE);
+	cl_mem segmentedBuffer = getHostBuffer(segmented, width * height * sizeof(char), CL_MEM_READ_WRITE);
+	cl_mem clusteredBuffer = getHostBuffer(clustered, width * height * sizeof(char), CL_MEM_READ_WRITE);
+	cl_mem centroidsBuffer = clCreateBuffer(
+			clContext,
+			CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(centroids),
+			centroids,
+			&error
+	);
+
+	double bestTime = -1.0;
+	WorkGroup bestWorkGroup = {0, 0, false};
+
+	// deBayer and segment only share the work group, both are timed
+	for (const auto& workGroup : getDeBayerWorkGroups()) {
+		if (!setDeBayerWorkGroup(workGroup)) {
+			continue;
+		}
+
+		clSetKernelArg(deBayerKernel, 0, sizeof(cl_mem), &inputBuffer);
+		clSetKernelArg(deBayerKernel, 1, sizeof(cl_mem), &bgrBuffer);
+		clSetKernelArg(deBayerKernel, 2, sizeof(cl_mem), &lookupBuffer);
+		clSetKernelArg(deBayerKernel, 3, sizeof(cl_mem), &segmentedBuffer);
+		clSetKernelArg(segmentKernel, 0, sizeof(cl_mem), &inputBuffer);
+		clSetKernelArg(segmentKernel, 1, sizeof(cl_mem), &lookupBuffer);
+		clSetKernelArg(segmentKernel, 2, sizeof(cl_mem), &segmentedBuffer);
+
+		std::size_t offset[3];
+		std::size_t size[3];
+		std::size_t localSize[3];
+		const size_t* local = getDeBayerRange(width, height, offset, size, localSize) ? localSize : nullptr;
+
+		double deBayerTime = timeKernel(profilingQueue, deBayerKernel, 2, offset, size, local);
+		double segmentTime = timeKernel(profilingQueue, segmentKernel, 2, offset, size, local);
+
+		if (deBayerTime < 0.0 || segmentTime < 0.0) {
+			continue;
+		}
+
+		std::cout << "  > deBayer " << workGroupToString(workGroup) << ": "
+				  << deBayerTime << " ms, segment only " << segmentTime << " ms" << std::endl;
+
+		if (bestTime < 0.0 || deBayerTime + segmentTime < bestTime) {
+			bestTime = deBayerTime + segmentTime;
+			bestWorkGroup = workGroup;
+		}
+	}
+
+	setDeBayerWorkGroup(bestWorkGroup);
+
+	clSetKernelArg(segmentQuadsKernel, 0, sizeof(cl_mem), &inputBuffer);
+	clSetKernelArg(segmentQuadsKernel, 1, sizeof(cl_mem), &lookupBuffer);
+	clSetKernelArg(segmentQuadsKernel, 2, sizeof(cl_mem), &segmentedBuffer);
+
+	clSetKernelArg(kMeansKernel, 0, sizeof(cl_mem), &bgrBuffer);
+	clSetKernelArg(kMeansKernel, 1, sizeof(cl_mem), &clusteredBuffer);
+	clSetKernelArg(kMeansKernel, 2, sizeof(cl_mem), &centroidsBuffer);
+	clSetKernelArg(kMeansKernel, 3, sizeof(int), &centroidCount);
+
+	struct {
+		const char* name;
+		cl_kernel kernel;
+		cl_uint dimensions;
+		size_t size[3];
+		WorkGroup* workGroup;
+	} kernels[] = {
+			{"segmentQuads", segmentQuadsKernel, 2, {static_cast<size_t>(width / 2), static_cast<size_t>(height / 2), 1}, &segmentQuadsWorkGroup},
+			{"kMeans", kMeansKernel, 2, {static_cast<size_t>(width), static_cast<size_t>(height), 1}, &kMeansWorkGroup},
+	};
+
+	for (auto& tuned : kernels) {
+		bestTime = -1.0;
+		bestWorkGroup = {0, 0, false};
+
+		for (const auto& workGroup : getWorkGroups(tuned.kernel, tuned.size[0], tuned.size[1])) {
+			std::size_t localSize[3];
+			double time = timeKernel(profilingQueue, tuned.kernel, tuned.dimensions, nullptr, tuned.size, getLocalSize(workGroup, tuned.size, localSize));
+
+			if (time < 0.0) {
+				continue;
+			}
+
+			std::cout << "  > " << tuned.name << " " << workGroupToString(workGroup) << ": " << time << " ms" << std::endl;
+
+			if (bestTime < 0.0 || time < bestTime) {
+				bestTime = time;
+				bestWorkGroup = workGroup;
+			}
+		}
+
+		*tuned.workGroup = bestWorkGroup;
+	}
+
+	clFinish(profilingQueue);
+	clReleaseCommandQueue(profilingQueue);
+	clReleaseMemObject(centroidsBuffer);
+
+	releaseBuffer(bgr);
+	releaseBuffer(segmented);
+	releaseBuffer(clustered);
+
+	_aligned_free(bgr);
+	_aligned_free(segmented);
+	_aligned_free(clustered);
+
+	std::cout << "! Tuned work groups: deBayer " << workGroupToString(deBayerWorkGroup)
+			  << ", segmentQuads " << workGroupToString(segmentQuadsWorkGroup)
+			  << ", kMeans " << workGroupToString(kMeansWorkGroup) << std::endl;
+
+	saveWorkGroups();
+	workGroupsLoaded = true;
+}
+
+// Tuning results are only reused on the same device and driver
+std::string OpenCLCompute::GetDeviceKey() {
+	return GetDeviceName(selectedDeviceIds[0]) + " " + GetDeviceInfoString(selectedDeviceIds[0], CL_DRIVER_VERSION);
+}
+
+bool OpenCLCompute::loadWorkGroups() {
+	std::ifstream in(workGroupsFilename);
+
+	if (!in) {
+		return false;
+	}
+
+	nlohmann::json devices;
+
+	try {
+		in >> devices;
+	} catch (const std::exception& e) {
+		std::cout << "- Could not read " << workGroupsFilename << ": " << e.what() << std::endl;
+
+		return false;
+	}
+
+	auto it = devices.find(GetDeviceKey());
+
+	if (it == devices.end() || !it->is_object()) {
+		return false;
+	}
+
+	segmentQuadsWorkGroup = workGroupFromJson(it->value("segmentQuads", nlohmann::json()));
+	kMeansWorkGroup = workGroupFromJson(it->value("kMeans", nlohmann::json()));
+
+	if (!setDeBayerWorkGroup(workGroupFromJson(it->value("deBayer", nlohmann::json())))) {
+		std::cout << "- Saved deBayer work group can not be used, letting the driver choose" << std::endl;
+	}
+
+	std::cout << "! Loaded work groups of " << it.key() << " from " << workGroupsFilename << std::endl;
+
+	return true;
+}
+
+void OpenCLCompute::saveWorkGroups() {
+	nlohmann::json devices = nlohmann::json::object();
+
+	std::ifstream in(workGroupsFilename);
+
+	if (in) {
+		try {
+			in >> devices;
+		} catch (const std::exception&) {
+			devices = nlohmann::json::object();
+		}
+
+		in.close();
+	}
+
+	devices[GetDeviceKey()] = {
+			{"deBayer", workGroupToJson(deBayerWorkGroup)},
+			{"segmentQuads", workGroupToJson(segmentQuadsWorkGroup)},
+			{"kMeans", workGroupToJson(kMeansWorkGroup)}
+	};
+
+	std::string temporaryFilename = std::string(workGroupsFilename) + ".tmp";
+	std::ofstream out(temporaryFilename, std::ios::trunc);
+
+	out << devices.dump(4) << std::endl;
+	out.close();
+
+	if (!out) {
+		std::remove(temporaryFilename.c_str());
+		std::cout << "- Could not write " << workGroupsFilename << std::endl;
+
+		return;
+	}
+
+	std::remove(workGroupsFilename);
+
+	if (std::rename(temporaryFilename.c_str(), workGroupsFilename) != 0) {
+		std::remove(temporaryFilename.c_str());
+		std::cout << "- Could not write " << workGroupsFilename << std::endl;
+	}
 }
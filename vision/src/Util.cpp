@@ -77,6 +77,36 @@ std::string Util::base64Encode(const unsigned char* data, unsigned int length) {
     return ret;
 }
 
+bool Util::base64Decode(const std::string& text, std::vector<unsigned char>& dataOut) {
+    unsigned int bits = 0;
+    int bitCount = 0;
+
+    dataOut.clear();
+    dataOut.reserve(text.size() * 3 / 4);
+
+    for (char c : text) {
+        if (c == '=') {
+            break;
+        }
+
+        size_t value = base64Chars.find(c);
+
+        if (value == std::string::npos) {
+            return false;
+        }
+
+        bits = (bits << 6) | (unsigned int)value;
+        bitCount += 6;
+
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            dataOut.push_back((unsigned char)(bits >> bitCount));
+        }
+    }
+
+    return true;
+}
+
 double Util::millitime() {
 	return (double)timeGetTime() / 1000.0;
 }
@@ -196,7 +196,15 @@ ObjectList Vision::processBaskets(Dir dir) {
     Distance distance;
 
     for (int i = 0; i < 2; i++) {
-        Blobber::BlobInfo* blobInfo = blobber->getBlobs(i == 0 ? Blobber::BlobColor::blue : Blobber::BlobColor::magenta);
+        Blobber::BlobColor basketColor = i == 0 ? Blobber::BlobColor::blue : Blobber::BlobColor::magenta;
+        int scale = blobber->getSegmentedScale();
+
+        // not enough pixels of the color in the whole frame for a basket blob
+        if (blobber->getRowsColorCount(basketColor, 0, Config::cameraHeight - 1) * scale * scale < Config::basketBlobMinArea) {
+            continue;
+        }
+
+        Blobber::BlobInfo* blobInfo = blobber->getBlobs(basketColor);
 
         for (int j = 0; j < blobInfo->count; j++) {
         	Blobber::Blob blob = blobInfo->blobs[j];
@@ -1015,6 +1023,14 @@ int Vision::getBorderY() {
 
 	LineSegment borderSegment = {};
 
+	// scanned column has neither of the colors
+	if (
+		blobber->getColumnColorCount(Blobber::BlobColor::white, segment.startX) == 0
+		&& blobber->getColumnColorCount(Blobber::BlobColor::black, segment.startX) == 0
+	) {
+		return 0;
+	}
+
 	if (getBorderDirectionOnSegment(segment, colors, &borderSegment) == -1) {
         return 0;
     }
@@ -1439,7 +1455,12 @@ float Vision::getSurroundMetric(
             continue;
 		}
 
-        Blobber::BlobColor color = blobber->getColorAt(senseX, senseY);
+        unsigned int tileClasses = blobber->getTileClasses(senseX, senseY);
+
+        // uniform tiles answer without reading the segmented image
+        Blobber::BlobColor color = Blobber::isSingleClass(tileClasses)
+            ? Blobber::BlobColor(__builtin_ctz(tileClasses))
+            : blobber->getColorAt(senseX, senseY);
 
         if (color != Blobber::BlobColor::unknown) {
             if (find(validColors.begin(), validColors.end(), color) != validColors.end()) {
@@ -2895,21 +2916,39 @@ float Vision::getAreaMetric(int x1, int y1, int areaWidth, int areaHeight, std::
 	int yLimit = std::min(y1 + areaHeight, Config::cameraHeight - 1);
     int xStepCount = (xLimit - xStart) / xStep + 1;
     int yStepCount = (yLimit - yStart) / yStep + 1;
-    Blobber::BlobColor color;
+    int tileSize = blobber->getTileSize();
+    unsigned int validClasses = 0;
 
     if (xStepCount < 2 || yStepCount < 2) {
         return NAN;
     }
 
+    for (Blobber::BlobColor validColor : validColors) {
+        validClasses |= 1u << validColor;
+    }
+
 	for (int x = xStart; x < xLimit; x += xStep) {
-        for (int y = yStart; y < yLimit; y += yStep) {
-		    color = blobber->getColorAt(x, y);
+        for (int y = yStart; y < yLimit; ) {
+            unsigned int tileClasses = blobber->getTileClasses(x, y);
+
+            // samples down to the end of an uniform tile all have the same result
+            int sampleEnd = Blobber::isSingleClass(tileClasses) ? std::min((y / tileSize + 1) * tileSize, yLimit) : y + 1;
+            int sampleCount = (sampleEnd - y + yStep - 1) / yStep;
+
+			if (!Blobber::isSingleClass(tileClasses)) {
+				int sampleClass = blobber->getColorAt(x, y);
 
-			if (std::find(validColors.begin(), validColors.end(), color) != validColors.end()) {
-				matches++;
+				// classes of 32 or more have no bit and never match, like the run encoder
+				tileClasses = sampleClass < 32 ? 1u << sampleClass : 0u;
+			}
+
+			if ((tileClasses & validClasses) != 0) {
+				matches += sampleCount;
 			} else {
-				misses++;
+				misses += sampleCount;
 			}
+
+			y += sampleCount * yStep;
 		}
 	}
 
@@ -3,11 +3,14 @@
 #include "Gui.h"
 #include "FpsCounter.h"
 #include "SignalHandler.h"
+#include "ComputeBackend.h"
 #include "Util.h"
+#include "LargeBuffers.h"
 #include <algorithm>
 #include <json.hpp>
 
 VisionManager::VisionManager() :
+	computeBackend(nullptr),
 	frontCamera(nullptr),
 	gui(nullptr),
 	blobber(nullptr),
@@ -16,7 +19,9 @@ VisionManager::VisionManager() :
 	hubCom(nullptr),
 	running(false), debugVision(false),
 	dt(0.01666f), lastStepTime(0.0), totalTime(0.0f),
-	debugCameraDir(Dir::FRONT)
+	debugCameraDir(Dir::FRONT),
+	lookupTransferId(-1),
+	lookupChunksReceived(0)
 {
 	visionResult = new Vision::Result();
 	visionResult->vision = vision;
@@ -27,6 +32,9 @@ VisionManager::~VisionManager() {
 
 	delete gui;
 	gui = nullptr;
+	// releases device buffers wrapping camera and blobber memory, so goes first
+	delete computeBackend;
+	computeBackend = nullptr;
 	delete frontCamera;
 	frontCamera = nullptr;
     delete blobber;
@@ -71,6 +79,15 @@ void VisionManager::run() {
 
 	if (frontCamera->isOpened()) {
 		frontCamera->startAcquisition();
+
+		// first run on a device picks the kernel work groups on a real frame, later runs load the saved ones
+		if (conf.value("autoTune", true)) {
+			BaseCamera::Frame* frame = frontCamera->getFrame();
+
+			if (frame != nullptr) {
+				blobber->tuneComputeBackend(frame->data, false);
+			}
+		}
 	}
 
 	if (!frontCamera->isOpened()) {
@@ -124,15 +141,27 @@ void VisionManager::run() {
 
 		fpsCounter->step();
 
+		if (showGui && gui == nullptr) {
+			setupGui();
+		} else if (!showGui && gui != nullptr) {
+			std::cout << "! Closing GUI" << std::endl;
+
+			vision->setDebugImage(nullptr, Config::cameraWidth, Config::cameraHeight);
+
+			delete gui;
+			gui = nullptr;
+		}
+
 		BaseCamera::Frame *frame = frontCamera->getFrame();
 
 		blobber->analyse(frame->data);
 
-		if (showGui) {
-			if (gui == nullptr) {
-				setupGui();
-			}
+		// transparent huge pages only back buffers that have been written
+		if (fpsCounter->frameNumber == 2) {
+			LargeBuffers::report();
+		}
 
+		if (showGui) {
 			gui->processFrame(blobber->bgr);
 
 			vision->setDebugImage(gui->rgb, Config::cameraWidth, Config::cameraHeight);
@@ -141,7 +170,6 @@ void VisionManager::run() {
 		visionResult = vision->process();
 
 		if (showGui) {
-
 			gui->setFps(fpsCounter->getFps());
 
 			gui->update(visionResult);
@@ -192,7 +220,7 @@ void VisionManager::setupCameras() {
 
 	//frontCamera = new XimeaCamera(374363729);
 	//frontCamera = new XimeaCamera(857769553);
-	frontCamera = new XimeaCamera(conf["cameraSerial"].get<int>());
+	frontCamera = new XimeaCamera(conf["cameraSerial"].get<int>(), conf.value("cameraFrameBuffers", 3));
 	frontCamera->open();
 
 	if (frontCamera->isOpened()) {
@@ -237,9 +265,25 @@ void VisionManager::setupSignalHandler() {
 }
 
 void VisionManager::setupVision() {
-	blobber = new Blobber();
+	std::vector<std::string> computeBackends = {"opencl:Intel(R) OpenCL:gpu", "opencl", "cpu"};
+
+	if (conf.find("computeBackends") != conf.end()) {
+		computeBackends = conf["computeBackends"].get<std::vector<std::string>>();
+	}
 
-    blobber->loadColors("colors.dat");
+	computeBackend = ComputeBackend::createFirstAvailable(computeBackends);
+
+	if (computeBackend == nullptr) {
+		throw std::runtime_error("No compute backend available");
+	}
+
+	blobber = new Blobber(computeBackend);
+
+    if (!blobber->loadColors("colors.lut") && blobber->loadColors("colors.dat")) {
+        std::cout << "! Imported colors.dat, it is saved as colors.lut" << std::endl;
+    }
+
+	blobber->setLookupBits(conf.value("lookupBits", 8));
 	blobber->setColorMinArea(1, 5);
 	blobber->setColorMinArea(2, 100);
 	blobber->setColorMinArea(3, 100);
@@ -247,6 +291,12 @@ void VisionManager::setupVision() {
 	blobber->setColorMinArea(5, 100);
 	blobber->setColorMinArea(6, 100);
 
+	blobber->setHalfResolution(conf.value("halfResolution", false));
+	blobber->setDeviceRunEncoding(conf.value("deviceRunEncoding", false));
+	blobber->setDeviceRegionLabelling(conf.value("deviceRegionLabelling", false));
+	blobber->setPipelineDepth(conf.value("pipelineDepth", 1));
+	blobber->setFrameBufferCount(frontCamera->getFrameBufferCount());
+
 	vision = new Vision(blobber, Dir::FRONT, Config::cameraWidth, Config::cameraHeight);
 }
 
@@ -391,9 +441,96 @@ void VisionManager::handleCommunicationMessage(std::string message) {
 
 	if ((jsonMessage["topic"] == "vision_close")) {
 		running = false;
+	} else if (jsonMessage["topic"] == "vision_gui") {
+		showGui = jsonMessage.value("show", false);
+	} else if (jsonMessage["topic"] == "vision_lut") {
+		// a malformed message from the network must not stop the vision
+		try {
+			handleLookupMessage(jsonMessage);
+		} catch (const nlohmann::json::exception& e) {
+			std::cout << "- Invalid vision_lut message: " << e.what() << std::endl;
+		}
 	}
 }
 
+// {"file": "colors.lut"} loads a lookup file on this machine, lookup file data is sent in base64 chunks of
+// {"id": transfer id, "index": chunk index, "count": chunk count, "data": chunk}. Chunks may come in any order and
+// a transfer can be sent again with the same id to fill in lost ones.
+void VisionManager::handleLookupMessage(const nlohmann::json& message) {
+	const int maxChunkCount = 65536;
+
+	if (message.count("file") > 0) {
+		if (!message["file"].is_string()) {
+			std::cout << "- Invalid vision_lut file" << std::endl;
+
+			return;
+		}
+
+		blobber->loadStandbyColors(message["file"].get<std::string>());
+
+		return;
+	}
+
+	for (const char* field : {"id", "index", "count"}) {
+		if (!message.count(field) || !message[field].is_number_integer()) {
+			std::cout << "- Invalid vision_lut chunk " << field << std::endl;
+
+			return;
+		}
+	}
+
+	if (!message.count("data") || !message["data"].is_string()) {
+		std::cout << "- Invalid vision_lut chunk data" << std::endl;
+
+		return;
+	}
+
+	int id = message["id"].get<int>();
+	int index = message["index"].get<int>();
+	int count = message["count"].get<int>();
+	std::vector<unsigned char> chunk;
+
+	if (
+		index < 0 || index >= count || count > maxChunkCount
+		|| !Util::base64Decode(message["data"].get<std::string>(), chunk) || chunk.empty()
+	) {
+		std::cout << "- Invalid vision_lut chunk " << index << " of " << count << std::endl;
+
+		return;
+	}
+
+	if (id != lookupTransferId || (int)lookupChunks.size() != count) {
+		lookupTransferId = id;
+		lookupChunks.assign((size_t)count, std::vector<unsigned char>());
+		lookupChunksReceived = 0;
+	}
+
+	if (!lookupChunks[index].empty()) {
+		return;
+	}
+
+	lookupChunks[index] = std::move(chunk);
+	lookupChunksReceived++;
+
+	if (lookupChunksReceived < count) {
+		return;
+	}
+
+	std::vector<unsigned char> data;
+
+	for (const auto& receivedChunk : lookupChunks) {
+		data.insert(data.end(), receivedChunk.begin(), receivedChunk.end());
+	}
+
+	lookupTransferId = -1;
+	lookupChunks.clear();
+	lookupChunksReceived = 0;
+
+	std::cout << "! Received colors lookup of " << data.size() << " bytes" << std::endl;
+
+	blobber->loadStandbyColors(std::move(data));
+}
+
 bool VisionManager::isBlobBall(Blobber::Blob blob) {
 	// Simple validations
 	if (blob.y2 > 1000) {
@@ -1,14 +1,20 @@
 #include "XimeaCamera.h"
 
 #include <iostream>
+#include <algorithm>
 
-XimeaCamera::XimeaCamera(int serial) : opened(false), acquisitioning(false), serialNumber(serial){
+XimeaCamera::XimeaCamera(int serial, int frameBufferCount) : opened(false), acquisitioning(false), serialNumber(serial){
     image.size = sizeof(XI_IMG);
     device = nullptr;
 
 	// setIntParam(XI_PRM_BUFFER_POLICY, XI_BP_SAFE) allows to use self-allocated buffer
 	// This allows to align buffer for Intel OpenCL CL_MEM_USE_HOST_PTR implementation.
-    frame.data = (unsigned char*)_aligned_malloc(1280 * 1024 * sizeof(char), 4096);
+	for (int i = 0; i < std::max(frameBufferCount, 1); i++) {
+		frameBuffers.push_back((unsigned char*)_aligned_malloc(1280 * 1024 * sizeof(char), 4096));
+	}
+
+	nextFrameBuffer = 0;
+    frame.data = frameBuffers[0];
 
 	image.bp = frame.data;
 	image.bp_size = 1280 * 1024 * sizeof(char);
@@ -17,7 +23,9 @@ XimeaCamera::XimeaCamera(int serial) : opened(false), acquisitioning(false), ser
 XimeaCamera::~XimeaCamera() {
     close();
 
-	_aligned_free(frame.data);
+	for (auto frameBuffer : frameBuffers) {
+		_aligned_free(frameBuffer);
+	}
 }
 
 unsigned long XimeaCamera::getNumberDevices()
@@ -109,6 +117,10 @@ XimeaCamera::Frame* XimeaCamera::getFrame() {
 		return NULL;
 	}
 
+	// previous frames stay untouched while they are still being processed
+	image.bp = frameBuffers[nextFrameBuffer];
+	nextFrameBuffer = (nextFrameBuffer + 1) % (int)frameBuffers.size();
+
     xiGetImage(device, 1000, &image);
     //xiGetImage(device, 64, &image);
 
@@ -116,7 +128,7 @@ XimeaCamera::Frame* XimeaCamera::getFrame() {
         return NULL;
     }
 
-    //frame.data = (unsigned char*)image.bp;
+    frame.data = (unsigned char*)image.bp;
     //frame.size = image.bp_size;
     frame.number = image.nframe;
     frame.width = image.width;